@@ -0,0 +1,65 @@
+// Measures overhead of all on wide fan-outs of tiny branches, where the join
+// state is the hottest shared data.
+
+#include <chrono>
+#include <type_traits>
+#include <utility>
+
+#include "benchmark/benchmark.h"
+#include "task_runner/task_graph.h"
+#include "task_runner/task_runner.h"
+
+namespace tg = base::task_graph;
+
+namespace {
+
+// Every branch of all must have its own type.
+template <std::size_t I>
+struct small_result {
+  int operator()(int val) const { return val + static_cast<int>(I); }
+};
+
+template <std::size_t I>
+struct void_result {
+  void operator()(int) const {}
+};
+
+// Branch known to be cheap, so all packs many of them into one task.
+template <std::size_t I>
+struct hinted_result {
+  auto operator()() const {
+    return tg::with_cost(small_result<I>{}, std::chrono::nanoseconds{10});
+  }
+};
+
+template <template <std::size_t> class Branch, std::size_t... Is>
+auto make_fanout(std::index_sequence<Is...>) {
+  if constexpr (std::is_invocable_v<Branch<0>>) {
+    return tg::when_all(Branch<Is>{}()...);
+  } else {
+    return tg::when_all(Branch<Is>{}...);
+  }
+}
+
+template <template <std::size_t> class Branch, std::size_t N>
+void fanout_benchmark(const char* const name, const int iterations,
+                      base::simple_task_runner* const tr) {
+  auto node = make_fanout<Branch>(std::make_index_sequence<N>{});
+  base::bench::run(name, iterations, [&] {
+    tg::sync_execute(tr, &node, [](auto&&...) {}, 1);
+  });
+}
+
+}  // namespace
+
+int main() {
+  base::simple_task_runner tr;
+
+  fanout_benchmark<void_result, 8>("all/void/8", 20000, &tr);
+  fanout_benchmark<small_result, 8>("all/int/8", 20000, &tr);
+  fanout_benchmark<void_result, 64>("all/void/64", 2000, &tr);
+  fanout_benchmark<small_result, 64>("all/int/64", 2000, &tr);
+  fanout_benchmark<small_result, 256>("all/int/256", 500, &tr);
+  fanout_benchmark<hinted_result, 64>("all/int_hinted/64", 2000, &tr);
+  fanout_benchmark<hinted_result, 256>("all/int_hinted/256", 500, &tr);
+}
@@ -0,0 +1,40 @@
+#ifndef _BENCHMARK_H_
+#define _BENCHMARK_H_
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <utility>
+
+namespace base::bench {
+
+// Runs f iterations times and prints average wall time of one run.
+// Takes the best of several repetitions to cut the scheduling noise.
+template <class F>
+void run(const char* const name, const int iterations, F&& f) {
+  using clock = std::chrono::steady_clock;
+  constexpr int repetitions = 5;
+
+  // Warm up caches and thread pools.
+  for (int i = 0; i < iterations / 10 + 1; ++i) {
+    f();
+  }
+
+  auto best = clock::duration::max();
+  for (int r = 0; r < repetitions; ++r) {
+    const auto start = clock::now();
+    for (int i = 0; i < iterations; ++i) {
+      f();
+    }
+    best = std::min(best, clock::now() - start);
+  }
+
+  const auto ns =
+      std::chrono::duration_cast<std::chrono::nanoseconds>(best).count();
+  std::printf("%-40s %12.1f ns/op\n", name,
+              static_cast<double>(ns) / iterations);
+}
+
+}  // namespace base::bench
+
+#endif  // _BENCHMARK_H_
@@ -0,0 +1,79 @@
+#!/usr/bin/env python3
+"""Measures compile time and peak memory of wide task graphs.
+
+Compiles wide_graph.cc with different numbers of all's branches and reports
+wall time and peak resident memory of the compiler and size of the object
+code, so regressions of compile time of wide graphs are easy to catch.
+Every size is compiled as a plain graph and as one erased by modules with
+any_node (-DERASED), to compare the two.
+
+Usage: compile_benchmark.py [--cxx=g++] [--flags="-O1"] [branches...]
+"""
+
+import argparse
+import os
+import subprocess
+import sys
+import tempfile
+import time
+
+ROOT = os.path.dirname(os.path.dirname(os.path.dirname(
+    os.path.abspath(__file__))))
+SOURCE = os.path.join(ROOT, "benchmark", "compile_time", "wide_graph.cc")
+
+
+def compile_once(cxx, flags, branches, erased, output):
+    """Returns (wall seconds, peak rss in MiB) of a single compilation."""
+    cmd = [cxx, "-std=c++17", "-I", ROOT, "-c", SOURCE, "-o", output,
+           "-DBRANCHES=%d" % branches] + flags
+    if erased:
+        cmd.append("-DERASED")
+    start = time.monotonic()
+    # wait4 reports resource usage of exactly this compiler process.
+    pid = os.fork()
+    if pid == 0:
+        os.execvp(cmd[0], cmd)
+    _, status, usage = os.wait4(pid, 0)
+    elapsed = time.monotonic() - start
+    if os.waitstatus_to_exitcode(status) != 0:
+        sys.exit("compilation with %d branches failed: %s" %
+                 (branches, " ".join(cmd)))
+    return elapsed, usage.ru_maxrss / 1024
+
+
+def text_size(path):
+    """Returns size of the code in the object file in KiB, or of the whole
+    file if binutils are not available."""
+    try:
+        out = subprocess.run(["size", path], check=True, capture_output=True,
+                             text=True).stdout
+        return int(out.splitlines()[1].split()[0]) / 1024
+    except (OSError, subprocess.CalledProcessError):
+        return os.path.getsize(path) / 1024
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--cxx", default=os.environ.get("CXX", "g++"))
+    parser.add_argument("--flags", default="-O1",
+                        help="extra compiler flags, space separated")
+    parser.add_argument("branches", nargs="*", type=int,
+                        default=[10, 100, 1000])
+    args = parser.parse_args()
+
+    print("%10s %8s %12s %14s %12s" % ("branches", "graph", "time, s",
+                                         "peak RSS, MiB", "code, KiB"))
+    with tempfile.TemporaryDirectory() as tmp:
+        output = os.path.join(tmp, "wide_graph.o")
+        for branches in args.branches:
+            for erased in (False, True):
+                elapsed, rss = compile_once(args.cxx, args.flags.split(),
+                                            branches, erased, output)
+                print("%10d %8s %12.1f %14.0f %12.0f" % (
+                    branches, "erased" if erased else "plain", elapsed, rss,
+                    text_size(output)))
+                sys.stdout.flush()
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,67 @@
+// Translation unit used to measure compile time of wide graphs.
+// Number of branches of the graph is set with -DBRANCHES=<n>. With -DERASED
+// branches are split into modules of ten, every module is erased behind
+// any_node, as large programs do at module boundaries.
+
+#include <utility>
+
+#include "task_runner/task_graph.h"
+#include "task_runner/task_runner.h"
+
+#ifndef BRANCHES
+#define BRANCHES 10
+#endif
+
+namespace tg = base::task_graph;
+
+namespace {
+
+// Every branch of all must have its own type.
+template <std::size_t I>
+struct branch {
+  int operator()(int val) const { return val + static_cast<int>(I); }
+};
+
+constexpr auto sum = [](auto... vals) { return (0 + ... + vals); };
+
+#ifndef ERASED
+
+template <std::size_t... Is>
+auto make_graph(std::index_sequence<Is...>) {
+  return tg::when_all(branch<Is>{}...).then(sum);
+}
+
+#else
+
+constexpr std::size_t module_size = 10;
+static_assert(BRANCHES % module_size == 0);
+
+using module_node = tg::any_node<int(int), base::simple_task_runner>;
+
+template <std::size_t First, std::size_t... Is>
+module_node make_module(std::index_sequence<Is...>) {
+  return tg::when_all(branch<First + Is>{}...).then(sum);
+}
+
+template <std::size_t... Ms>
+auto make_graph(std::index_sequence<Ms...>) {
+  return tg::when_all(make_module<Ms * module_size>(
+                          std::make_index_sequence<module_size>{})...)
+      .then(sum);
+}
+
+#endif
+
+}  // namespace
+
+int main() {
+  base::simple_task_runner tr;
+#ifndef ERASED
+  auto node = make_graph(std::make_index_sequence<BRANCHES>{});
+#else
+  auto node = make_graph(std::make_index_sequence<BRANCHES / module_size>{});
+#endif
+  int result = 0;
+  tg::sync_execute(&tr, &node, [&result](int val) { result = val; }, 1);
+  return result == 0;
+}
@@ -0,0 +1,52 @@
+// Compares task systems on tiny graphs, where thread hops cost more than the
+// work itself. The inline task system shows the pure overhead of graphs.
+
+#include <chrono>
+
+#include "benchmark/benchmark.h"
+#include "task_runner/inline_task_system.h"
+#include "task_runner/task_graph.h"
+#include "task_runner/task_runner.h"
+
+namespace tg = base::task_graph;
+
+namespace {
+
+auto make_small_graph() {
+  return tg::when_all([](int val) { return val + 1; },
+                      [](int val) { return val * 2; },
+                      [](int val) { return val - 3; })
+      .then([](int a, int b, int c) { return a + b + c; });
+}
+
+template <class TaskRunner, class Node>
+void small_graph_benchmark(const char* const name, TaskRunner* const tr,
+                           Node node) {
+  base::bench::run(name, 20000, [&] {
+    tg::sync_execute(tr, &node, [](int) {}, 1);
+  });
+}
+
+template <class TaskRunner>
+void small_graph_benchmark(const char* const name, TaskRunner* const tr) {
+  small_graph_benchmark(name, tr, make_small_graph());
+}
+
+}  // namespace
+
+int main() {
+  base::simple_task_runner simple_tr;
+  base::task_runner_base<base::inline_task_system> inline_tr;
+  base::task_runner_base<base::hybrid_task_system> hybrid_tr{
+      std::chrono::microseconds{50}};
+
+  small_graph_benchmark("small_graph/simple", &simple_tr);
+  small_graph_benchmark("small_graph/inline", &inline_tr);
+  small_graph_benchmark("small_graph/hybrid", &hybrid_tr);
+
+  // Cost of type erasure of the whole graph.
+  using inline_runner = base::task_runner_base<base::inline_task_system>;
+  small_graph_benchmark(
+      "small_graph/inline_erased", &inline_tr,
+      tg::any_node<int(int), inline_runner>{make_small_graph()});
+}
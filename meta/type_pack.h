@@ -102,7 +102,7 @@ constexpr auto make_pack(just_type<Ts>...) {
 
 template <class F, class... Ts>
 constexpr decltype(auto) apply(F f, type_pack<Ts...>) {
-  return std::invoke(f, just_type_v<Ts>...);
+  return f(just_type_v<Ts>...);
 }
 
 template <template <class...> class F>
@@ -287,70 +287,65 @@ static_assert(transform(type_fn_v<std::add_pointer>,
                         type_pack_v<int, double, char>) ==
               type_pack_v<int*, double*, char*>);
 
-// ==================== reverse ====================
+// ==================== get ====================
 
 namespace detail {
 
-template <class... Ts>
-constexpr auto reverse_impl(empty_pack, type_pack<Ts...>) {
-  return type_pack_v<Ts...>;
-}
+template <std::size_t I, class T>
+struct indexed_type {};
 
-template <class T, class... Ts, class... Us>
-constexpr auto reverse_impl(type_pack<T, Ts...>, type_pack<Us...>) {
-  return reverse_impl(type_pack_v<Ts...>, type_pack_v<T, Us...>);
-}
+template <class IS, class... Ts>
+struct indexer;
 
-}  // namespace detail
+// Inherits every type of the pack tagged with its index, so looking up type
+// by index is a single overload resolution instead of a recursive
+// instantiation. Is instantiated once per pack and reused for every index.
+template <std::size_t... Is, class... Ts>
+struct indexer<std::index_sequence<Is...>, Ts...> : indexed_type<Is, Ts>... {};
 
-template <class... Ts>
-constexpr auto reverse(type_pack<Ts...> tp) {
-  return detail::reverse_impl(tp, {});
+template <std::size_t I, class T>
+constexpr just_type<T> select(indexed_type<I, T>) {
+  return {};
 }
 
-static_assert(reverse(type_pack_v<int, double, char>) ==
-              type_pack_v<char, double, int>);
-
-// ==================== get ====================
-
-namespace detail {
-
-template <class IS>
-struct get_impl;
-
-template <std::size_t... Is>
-struct get_impl<std::index_sequence<Is...>> {
-  template <class T>
-  static constexpr T dummy(decltype(Is, (void*)0)..., T*, ...);
-};
-
 }  // namespace detail
 
 template <std::size_t I, class... Ts>
 constexpr auto get(type_pack<Ts...>) {
-  return just_type_v<decltype(
-      detail::get_impl<std::make_index_sequence<I>>::dummy((Ts*)(0)...))>;
+  static_assert(I < sizeof...(Ts));
+  return detail::select<I>(
+      detail::indexer<std::index_sequence_for<Ts...>, Ts...>{});
 }
 
 static_assert(get<1>(type_pack_v<double, int, char>) == just_type_v<int>);
 
+// ==================== reverse ====================
+
 namespace detail {
 
 template <std::size_t... is, class TP>
-constexpr auto fast_reverse_impl(std::index_sequence<is...>, TP tp) {
+constexpr auto reverse_impl(std::index_sequence<is...>, TP tp) {
   return type_pack_v<subtype<decltype(get<size(tp) - is - 1>(tp))>...>;
 }
 
 }  // namespace detail
 
+template <class... Ts>
+constexpr auto reverse(type_pack<Ts...> tp) {
+  return detail::reverse_impl(std::index_sequence_for<Ts...>{}, tp);
+}
+
+// Kept for compatibility: reverse has constant instantiation depth now.
 template <class... Ts>
 constexpr auto fast_reverse(type_pack<Ts...> tp) {
-  return detail::fast_reverse_impl(std::index_sequence_for<Ts...>{}, tp);
+  return reverse(tp);
 }
 
+static_assert(reverse(type_pack_v<int, double, char>) ==
+              type_pack_v<char, double, int>);
+static_assert(reverse(empty_pack_v) == empty_pack_v);
 static_assert(fast_reverse(type_pack_v<int, double, char>) ==
               type_pack_v<char, double, int>);
-static_assert(fast_reverse(empty_pack_v) == empty_pack_v);
 
 // ==================== generate ====================
 
@@ -380,41 +375,166 @@ static_assert(generate<3, int>() != type_pack_v<int, int, double>);
 
 namespace detail {
 
-template <template <class...> class F, class T>
-constexpr auto filter_one() {
-  if constexpr (F<T>::value) {
-    return type_pack_v<T>;
-  } else {
-    return empty_pack_v;
+// Fixed size array usable as a template argument source in C++17.
+template <std::size_t N>
+struct index_array {
+  // Zero sized arrays are not allowed.
+  std::size_t data[N + 1] = {};
+};
+
+template <std::size_t N>
+constexpr std::size_t count(const bool (&bs)[N]) {
+  std::size_t result = 0;
+  for (std::size_t i = 0; i < N; ++i) {
+    result += bs[i] ? 1 : 0;
   }
+  return result;
 }
 
-template <class F, class T>
-constexpr auto filter_one(F f, just_type<T> jt) {
-  if constexpr (f(jt)) {
-    return type_pack_v<T>;
-  } else {
-    return empty_pack_v;
+// Positions of true values in bs.
+template <std::size_t M, std::size_t N>
+constexpr index_array<M> positions(const bool (&bs)[N]) {
+  index_array<M> result;
+  std::size_t k = 0;
+  for (std::size_t i = 0; i < N; ++i) {
+    if (bs[i]) {
+      result.data[k++] = i;
+    }
   }
+  return result;
+}
+
+template <class TP, std::size_t N, const bool (&bs)[N], std::size_t... Is>
+constexpr auto filter_impl(std::index_sequence<Is...>) {
+  [[maybe_unused]] constexpr auto poses = positions<sizeof...(Is)>(bs);
+  return type_pack_v<subtype<decltype(get<poses.data[Is]>(TP{}))>...>;
+}
+
+template <bool... bs>
+struct bool_array {
+  // One extra element keeps array nonempty for empty packs.
+  static constexpr bool value[] = {bs..., false};
+};
+
+template <class TP, bool... bs>
+constexpr auto filter_by(TP) {
+  constexpr auto& flags = bool_array<bs...>::value;
+  return filter_impl<TP, sizeof...(bs) + 1, flags>(
+      std::make_index_sequence<count(flags)>{});
 }
 
 }  // namespace detail
 
+// Filters have constant instantiation depth: matching positions are computed
+// by constexpr loop and then picked with get.
+
 // type-based
 template <template <class...> class F, class... Ts>
-constexpr auto filter(type_pack<Ts...>) {
-  return (empty_pack_v + ... + detail::filter_one<F, Ts>());
+constexpr auto filter(type_pack<Ts...> tp) {
+  return detail::filter_by<type_pack<Ts...>, F<Ts>::value...>(tp);
 }
 
 // value-based
 template <class F, class... Ts>
-constexpr auto filter(F f, type_pack<Ts...>) {
-  return (empty_pack_v + ... + detail::filter_one(f, just_type_v<Ts>));
+constexpr auto filter(F f, type_pack<Ts...> tp) {
+  return detail::filter_by<type_pack<Ts...>, f(just_type_v<Ts>)...>(tp);
 }
 
 static_assert(filter<std::is_pointer>(type_pack_v<char, double*, int*>) ==
               type_pack_v<double*, int*>);
 static_assert(filter<std::is_pointer>(empty_pack_v) == empty_pack_v);
+static_assert(filter(value_fn_v<std::is_pointer>,
+                     type_pack_v<char*, double, int*>) ==
+              type_pack_v<char*, int*>);
+
+// ==================== concat ====================
+
+namespace detail {
+
+// For every position of concatenation: index of the source pack and index of
+// the element inside it.
+template <std::size_t N>
+struct concat_map {
+  index_array<N> pack;
+  index_array<N> elem;
+};
+
+template <std::size_t N, std::size_t... Sizes>
+constexpr concat_map<N> make_concat_map() {
+  const std::size_t sizes[] = {Sizes..., 0};
+  concat_map<N> result;
+  std::size_t k = 0;
+  for (std::size_t p = 0; p < sizeof...(Sizes); ++p) {
+    for (std::size_t e = 0; e < sizes[p]; ++e) {
+      result.pack.data[k] = p;
+      result.elem.data[k] = e;
+      ++k;
+    }
+  }
+  return result;
+}
+
+template <class... Packs, std::size_t... Is>
+constexpr auto concat_impl(std::index_sequence<Is...>) {
+  [[maybe_unused]] constexpr auto map =
+      make_concat_map<sizeof...(Is), size(Packs{})...>();
+  constexpr auto packs = type_pack_v<Packs...>;
+  return type_pack_v<subtype<decltype(get<map.elem.data[Is]>(
+      subtype<decltype(get<map.pack.data[Is]>(packs))>{}))>...>;
+}
+
+}  // namespace detail
+
+// Concatenates any number of packs with constant instantiation depth, unlike
+// fold of operator+ which instantiates a new intermediate pack per argument.
+template <class... Packs>
+constexpr auto concat(Packs...) {
+  return detail::concat_impl<Packs...>(
+      std::make_index_sequence<(0 + ... + size(Packs{}))>{});
+}
+
+static_assert(concat() == empty_pack_v);
+static_assert(concat(type_pack_v<int>, empty_pack_v,
+                     type_pack_v<double, char>) ==
+              type_pack_v<int, double, char>);
+
+// ==================== exclusive scan ====================
+
+namespace detail {
+
+template <std::size_t... ns>
+constexpr index_array<sizeof...(ns)> exclusive_scan_values() {
+  const std::size_t vals[] = {ns..., 0};
+  index_array<sizeof...(ns)> result;
+  std::size_t sum = 0;
+  for (std::size_t i = 0; i < sizeof...(ns); ++i) {
+    result.data[i] = sum;
+    sum += vals[i];
+  }
+  return result;
+}
+
+template <std::size_t... ns, std::size_t... is>
+constexpr auto exclusive_scan_impl(std::index_sequence<is...>) {
+  constexpr auto scan = exclusive_scan_values<ns...>();
+  return std::index_sequence<scan.data[is]...>{};
+}
+
+}  // namespace detail
+
+// Positions where consecutive ranges of given sizes start.
+// Example: <3, 6, 9, 1> -> <0, 3, 9, 18>
+template <std::size_t... ns>
+constexpr auto exclusive_scan(std::index_sequence<ns...>) {
+  return detail::exclusive_scan_impl<ns...>(
+      std::make_index_sequence<sizeof...(ns)>{});
+}
+
+static_assert(std::is_same_v<decltype(exclusive_scan(
+                                 std::index_sequence<3, 6, 9, 1>{})),
+                             std::index_sequence<0, 3, 9, 18>>);
+static_assert(std::is_same_v<decltype(exclusive_scan(std::index_sequence<>{})),
+                             std::index_sequence<>>);
 
 }  // namespace tp
 
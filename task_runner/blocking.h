@@ -0,0 +1,96 @@
+#ifndef _BLOCKING_H_
+#define _BLOCKING_H_
+
+namespace base {
+
+// Interface of task systems that want to know when their workers block, e.g.
+// to keep the number of runnable workers constant.
+class blocking_observer {
+ public:
+  // Called by a worker right before it blocks.
+  virtual void on_blocking_start() = 0;
+  // Called by a worker right after it has unblocked.
+  virtual void on_blocking_finish() = 0;
+
+ protected:
+  ~blocking_observer() = default;
+};
+
+namespace detail {
+
+// Observer of the task system owning the calling worker thread.
+inline thread_local blocking_observer* current_blocking_observer = nullptr;
+
+// Whether the calling thread must not wait for space in bounded task queues.
+inline thread_local bool current_thread_nonblocking = false;
+
+}  // namespace detail
+
+// Marks a region of a task where its worker might block for a long time (on a
+// lock, a syscall, a nested sync_execute). Task system of the worker is
+// notified, so it can bring in a spare worker for the time of the block.
+// Does nothing on threads that don't belong to a task system.
+class blocking_region {
+ public:
+  blocking_region() : observer_{detail::current_blocking_observer} {
+    if (observer_ != nullptr) {
+      observer_->on_blocking_start();
+    }
+  }
+
+  ~blocking_region() {
+    if (observer_ != nullptr) {
+      observer_->on_blocking_finish();
+    }
+  }
+
+  blocking_region(const blocking_region&) = delete;
+  blocking_region& operator=(const blocking_region&) = delete;
+
+ private:
+  blocking_observer* const observer_;
+};
+
+// Sets observer for blocking regions of the calling thread while alive.
+// Intended for task systems' worker threads.
+class scoped_blocking_observer {
+ public:
+  explicit scoped_blocking_observer(blocking_observer* const observer)
+      : previous_{detail::current_blocking_observer} {
+    detail::current_blocking_observer = observer;
+  }
+
+  ~scoped_blocking_observer() {
+    detail::current_blocking_observer = previous_;
+  }
+
+  scoped_blocking_observer(const scoped_blocking_observer&) = delete;
+  scoped_blocking_observer& operator=(const scoped_blocking_observer&) =
+      delete;
+
+ private:
+  blocking_observer* const previous_;
+};
+
+// Marks the calling thread as one that must never wait for space in bounded
+// task queues while alive, e.g. a timer thread serving the whole process:
+// stalling it on one full queue would stall timers of everyone else. Its
+// submissions go over the capacity like the ones of workers.
+class nonblocking_scope {
+ public:
+  nonblocking_scope() : previous_{detail::current_thread_nonblocking} {
+    detail::current_thread_nonblocking = true;
+  }
+
+  ~nonblocking_scope() { detail::current_thread_nonblocking = previous_; }
+
+  nonblocking_scope(const nonblocking_scope&) = delete;
+  nonblocking_scope& operator=(const nonblocking_scope&) = delete;
+
+ private:
+  const bool previous_;
+};
+
+}  // namespace base
+
+#endif  // _BLOCKING_H_
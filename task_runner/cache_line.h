@@ -0,0 +1,14 @@
+#ifndef _CACHE_LINE_H_
+#define _CACHE_LINE_H_
+
+#include <cstddef>
+
+namespace base::detail {
+
+// std::hardware_destructive_interference_size is not provided by every
+// standard library yet, and it is 64 on the platforms we care about.
+inline constexpr std::size_t cache_line_size = 64;
+
+}  // namespace base::detail
+
+#endif  // _CACHE_LINE_H_
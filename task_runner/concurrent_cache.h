@@ -0,0 +1,195 @@
+#ifndef _CONCURRENT_CACHE_H_
+#define _CONCURRENT_CACHE_H_
+
+#include <algorithm>
+#include <cassert>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <tuple>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "unique_function.h"
+
+namespace base {
+
+namespace detail {
+
+inline std::size_t hash_combine(std::size_t seed, std::size_t value) {
+  return seed ^ (value + 0x9e3779b97f4a7c15ull + (seed << 6) + (seed >> 2));
+}
+
+}  // namespace detail
+
+// Hash for std::tuple keys. Combines std::hash of every element.
+struct tuple_hash {
+  template <class... Ts>
+  std::size_t operator()(const std::tuple<Ts...>& t) const {
+    return std::apply(
+        [](const auto&... vals) {
+          std::size_t seed = 0;
+          (..., (seed = detail::hash_combine(
+                     seed, std::hash<std::decay_t<decltype(vals)>>{}(vals))));
+          return seed;
+        },
+        t);
+  }
+};
+
+// Thread safe bounded cache with LRU eviction.
+// Keys are distributed between independent shards by hash, every shard is
+// guarded by its own mutex, so threads working with different keys rarely
+// contend. Capacity is split between shards so that they hold at most
+// capacity values together; there are no more shards than capacity.
+// Besides plain lookups, cache deduplicates concurrent computations of the
+// same key (see get_or_compute()).
+template <class Key, class Value, class Hash = std::hash<Key>>
+class concurrent_lru_cache {
+ public:
+  static constexpr std::size_t default_shard_count = 16;
+
+  using value_ptr = std::shared_ptr<const Value>;
+
+ public:
+  explicit concurrent_lru_cache(std::size_t capacity,
+                                std::size_t shard_count = default_shard_count)
+      : shards_(std::min(capacity, shard_count)) {
+    assert(capacity > 0);
+    assert(shard_count > 0);
+    // The first capacity % shards_.size() shards take the remainder.
+    for (std::size_t i = 0; i < shards_.size(); ++i) {
+      shards_[i].capacity = capacity / shards_.size() +
+                            (i < capacity % shards_.size() ? 1 : 0);
+    }
+  }
+
+  // Returns cached value or nullptr if there is no such key in cache.
+  // Marks found entry as the most recently used one.
+  value_ptr find(const Key& key) {
+    auto& s = shard_for(key);
+    std::unique_lock guard{s.mtx};
+    return s.find(key);
+  }
+
+  // Puts value to the cache, replacing the previous one for this key.
+  // Evicts the least recently used entry if the shard is full.
+  void insert(const Key& key, Value value) {
+    auto& s = shard_for(key);
+    std::unique_lock guard{s.mtx};
+    s.insert(key, std::make_shared<const Value>(std::move(value)));
+  }
+
+  // Calls then with the value for the key.
+  // If value is cached, then is invoked immediately on the calling thread.
+  // If value for the key is being computed by other thread at the moment,
+  // then is scheduled to tr when that computation finishes, so the calling
+  // thread is released immediately and the value is computed only once.
+  // Otherwise compute(key) is invoked on the calling thread, its result is
+  // cached and passed to then.
+  // Notice: compute must not throw, otherwise waiters would never be resumed.
+  template <class TaskRunner, class Compute, class Then>
+  void get_or_compute(TaskRunner* const tr, const Key& key, Compute&& compute,
+                      Then&& then) {
+    assert(tr != nullptr);
+    auto& s = shard_for(key);
+    {
+      std::unique_lock guard{s.mtx};
+      if (auto value = s.find(key)) {
+        guard.unlock();
+        std::invoke(then, *value);
+        return;
+      }
+      if (auto it = s.in_flight.find(key); it != s.in_flight.end()) {
+        it->second.emplace_back(
+            [tr, then = std::forward<Then>(then)](value_ptr value) mutable {
+              tr->run(
+                  [then = std::move(then)](const value_ptr& value) mutable {
+                    std::invoke(then, *value);
+                  },
+                  std::move(value));
+            });
+        return;
+      }
+      s.in_flight.emplace(key, std::vector<waiter_type>{});
+    }
+
+    auto value = std::make_shared<const Value>(std::invoke(compute, key));
+
+    std::vector<waiter_type> waiters;
+    {
+      std::unique_lock guard{s.mtx};
+      auto it = s.in_flight.find(key);
+      assert(it != s.in_flight.end());
+      waiters = std::move(it->second);
+      s.in_flight.erase(it);
+      s.insert(key, value);
+    }
+    for (auto& w : waiters) {
+      w(value);
+    }
+    std::invoke(then, *value);
+  }
+
+  // Returns number of cached values.
+  std::size_t size() const {
+    std::size_t result = 0;
+    for (auto& s : shards_) {
+      std::unique_lock guard{s.mtx};
+      result += s.lru.size();
+    }
+    return result;
+  }
+
+ private:
+  using waiter_type = unique_function<void(value_ptr)>;
+  using entry_type = std::pair<Key, value_ptr>;
+  using lru_list = std::list<entry_type>;
+
+  struct shard {
+    value_ptr find(const Key& key) {
+      auto it = index.find(key);
+      if (it == index.end()) {
+        return nullptr;
+      }
+      lru.splice(lru.begin(), lru, it->second);
+      return it->second->second;
+    }
+
+    void insert(const Key& key, value_ptr value) {
+      if (auto it = index.find(key); it != index.end()) {
+        it->second->second = std::move(value);
+        lru.splice(lru.begin(), lru, it->second);
+        return;
+      }
+      if (lru.size() >= capacity) {
+        index.erase(lru.back().first);
+        lru.pop_back();
+      }
+      lru.emplace_front(key, std::move(value));
+      index.emplace(key, lru.begin());
+    }
+
+    std::size_t capacity = 0;
+    mutable std::mutex mtx;
+    // Most recently used entries are at the front.
+    lru_list lru;
+    std::unordered_map<Key, typename lru_list::iterator, Hash> index;
+    std::unordered_map<Key, std::vector<waiter_type>, Hash> in_flight;
+  };
+
+  shard& shard_for(const Key& key) {
+    // Mix hash a bit, so shard choice doesn't correlate with buckets inside
+    // the shard.
+    return shards_[detail::hash_combine(Hash{}(key), 0) % shards_.size()];
+  }
+
+ private:
+  std::vector<shard> shards_;
+};
+
+}  // namespace base
+
+#endif  // _CONCURRENT_CACHE_H_
@@ -0,0 +1,106 @@
+#include "concurrent_cache.h"
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "catch2/catch_all.hpp"
+#include "event.h"
+#include "task_runner.h"
+
+TEST_CASE("concurrent_lru_cache_test", "[concurrent_cache]") {
+  SECTION("Inserted values can be found") {
+    base::concurrent_lru_cache<int, std::string> cache{16};
+    REQUIRE(cache.find(1) == nullptr);
+    cache.insert(1, "one");
+    cache.insert(2, "two");
+    REQUIRE(*cache.find(1) == "one");
+    REQUIRE(*cache.find(2) == "two");
+    cache.insert(1, "uno");
+    REQUIRE(*cache.find(1) == "uno");
+    REQUIRE(cache.size() == 2);
+  }
+
+  SECTION("Least recently used value is evicted") {
+    base::concurrent_lru_cache<int, int> cache{2, 1};
+    cache.insert(1, 1);
+    cache.insert(2, 2);
+    REQUIRE(cache.find(1) != nullptr);
+    cache.insert(3, 3);
+    REQUIRE(cache.size() == 2);
+    REQUIRE(cache.find(1) != nullptr);
+    REQUIRE(cache.find(2) == nullptr);
+    REQUIRE(cache.find(3) != nullptr);
+  }
+
+  SECTION("Shards together hold at most capacity values") {
+    base::concurrent_lru_cache<int, int> single{1};
+    for (int i = 0; i < 100; ++i) {
+      single.insert(i, i);
+    }
+    REQUIRE(single.size() == 1);
+    REQUIRE(single.find(99) != nullptr);
+
+    base::concurrent_lru_cache<int, int> cache{20, 16};
+    for (int i = 0; i < 1000; ++i) {
+      cache.insert(i, i);
+    }
+    REQUIRE(cache.size() <= 20);
+  }
+
+  SECTION("Tuple keys are supported") {
+    base::concurrent_lru_cache<std::tuple<int, std::string>, int,
+                               base::tuple_hash>
+        cache{4};
+    cache.insert({1, "a"}, 1);
+    REQUIRE(*cache.find({1, "a"}) == 1);
+    REQUIRE(cache.find({1, "b"}) == nullptr);
+  }
+}
+
+TEST_CASE("concurrent_lru_cache_dedup_test", "[concurrent_cache]") {
+  base::simple_task_runner tr;
+  base::concurrent_lru_cache<int, int> cache{16};
+
+  constexpr int waiters = 8;
+  std::atomic<int> computations = 0;
+  std::atomic<int> results = 0;
+  base::manual_event computing;
+  base::manual_event release;
+  base::manual_event finished;
+
+  std::thread computer{[&] {
+    cache.get_or_compute(
+        &tr, 42,
+        [&](int key) {
+          ++computations;
+          computing.notify();
+          release.wait();
+          return key * 2;
+        },
+        [&](int val) {
+          if (val == 84 && results.fetch_add(1) + 1 == waiters + 1) {
+            finished.notify();
+          }
+        });
+  }};
+
+  computing.wait();
+  for (int i = 0; i < waiters; ++i) {
+    cache.get_or_compute(
+        &tr, 42, [&](int key) { return ++computations, key * 2; },
+        [&](int val) {
+          if (val == 84 && results.fetch_add(1) + 1 == waiters + 1) {
+            finished.notify();
+          }
+        });
+  }
+  release.notify();
+  finished.wait();
+  computer.join();
+
+  REQUIRE(computations == 1);
+  REQUIRE(results == waiters + 1);
+  REQUIRE(*cache.find(42) == 84);
+}
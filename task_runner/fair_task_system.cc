@@ -0,0 +1,202 @@
+#include "fair_task_system.h"
+
+#include <algorithm>
+#include <cassert>
+
+#include "histogram.h"
+#include "task_system.h"
+
+namespace base {
+
+struct fair_task_system::tenant_state {
+  explicit tenant_state(const tenant_id id) : id{id} {}
+
+  const tenant_id id;
+  std::uint32_t weight = 1;
+  // Execution time left for the current turn, negative when overdrawn.
+  std::chrono::nanoseconds deficit{0};
+  std::deque<task_context> tasks;
+  // Whether the tenant takes part in the round.
+  bool active = false;
+
+  std::uint64_t started = 0;
+  std::chrono::nanoseconds busy{0};
+  latency_histogram wait;
+};
+
+thread_local const fair_task_system* fair_task_system::current_ = nullptr;
+
+thread_local std::size_t fair_task_system::current_index_ = no_worker;
+
+fair_task_system::fair_task_system(const options& opts)
+    : quantum_{opts.quantum} {
+  assert(quantum_.count() > 0);
+  const std::size_t count = std::min(
+      opts.thread_count != 0
+          ? opts.thread_count
+          : std::max<std::size_t>(simple_task_system::thread_count, 1),
+      max_worker_count);
+  for (std::size_t i = 0; i < count; ++i) {
+    threads_.emplace_back([this, i] { worker_loop(i); });
+  }
+}
+
+fair_task_system::~fair_task_system() {
+  {
+    std::unique_lock guard{mtx_};
+    stopping_ = true;
+    cv_.notify_all();
+  }
+  for (auto& t : threads_) {
+    t.join();
+  }
+}
+
+void fair_task_system::run(const task_type f, void* const args,
+                           const task_type) {
+  assert(f != nullptr);
+  const auto now = clock::now();
+  std::unique_lock guard{mtx_};
+  assert(!stopping_ || running_in_this_thread());
+  auto& t = find_or_add(current_tenant());
+  t.tasks.push_back({f, args, &t, now});
+  ++queued_;
+  if (!t.active) {
+    activate(t);
+  }
+  // Under the lock for the same reason as in notification_queue.
+  cv_.notify_one();
+}
+
+bool fair_task_system::run_pending_task() {
+  task_context task;
+  {
+    std::unique_lock guard{mtx_};
+    if (queued_ == 0) {
+      return false;
+    }
+    task = take_next();
+  }
+  const auto cost = execute(task);
+  std::unique_lock guard{mtx_};
+  charge(*task.owner, cost);
+  return true;
+}
+
+std::size_t fair_task_system::queue_size() const {
+  std::unique_lock guard{mtx_};
+  return queued_;
+}
+
+void fair_task_system::set_weight(const tenant_id tenant,
+                                  const std::uint32_t weight) {
+  assert(weight > 0);
+  std::unique_lock guard{mtx_};
+  find_or_add(tenant).weight = weight;
+}
+
+fair_task_system::tenant_stats fair_task_system::stats(
+    const tenant_id tenant) const {
+  std::unique_lock guard{mtx_};
+  auto it = tenants_.find(tenant);
+  if (it == tenants_.end()) {
+    return {};
+  }
+  const tenant_state& t = *it->second;
+  tenant_stats result;
+  result.queue_size = t.tasks.size();
+  result.started = t.started;
+  result.busy = t.busy;
+  result.wait_p50 = t.wait.percentile(0.5);
+  result.wait_p99 = t.wait.percentile(0.99);
+  return result;
+}
+
+fair_task_system::tenant_state& fair_task_system::find_or_add(
+    const tenant_id tenant) {
+  auto& t = tenants_[tenant];
+  if (t == nullptr) {
+    t = std::make_unique<tenant_state>(tenant);
+  }
+  return *t;
+}
+
+void fair_task_system::activate(tenant_state& t) {
+  t.active = true;
+  round_.push_back(&t);
+  if (round_.size() == 1) {
+    give_quantum(t);
+  }
+}
+
+void fair_task_system::charge(tenant_state& t,
+                              const std::chrono::nanoseconds cost) {
+  t.deficit -= cost;
+  t.busy += cost;
+}
+
+fair_task_system::task_context fair_task_system::take_next() {
+  assert(queued_ > 0);
+  for (;;) {
+    tenant_state& t = *round_.front();
+    round_.pop_front();
+    if (t.tasks.empty()) {
+      // Idle tenants don't save unused time, but pay their debts.
+      t.active = false;
+      t.deficit = std::min(t.deficit, std::chrono::nanoseconds{0});
+    } else if (t.deficit.count() > 0) {
+      round_.push_front(&t);
+      task_context task = t.tasks.front();
+      t.tasks.pop_front();
+      --queued_;
+      ++t.started;
+      t.wait.record(clock::now() - task.queued);
+      return task;
+    } else {
+      round_.push_back(&t);
+    }
+    // Turn of the next tenant.
+    if (!round_.empty()) {
+      give_quantum(*round_.front());
+    }
+  }
+}
+
+void fair_task_system::give_quantum(tenant_state& t) {
+  t.deficit += quantum_ * t.weight;
+}
+
+std::chrono::nanoseconds fair_task_system::execute(const task_context& task) {
+  scoped_tenant tenant{task.owner->id};
+  const auto start = clock::now();
+  task.func(task.args);
+  return clock::now() - start;
+}
+
+void fair_task_system::worker_loop(const std::size_t index) {
+  current_ = this;
+  current_index_ = index;
+  tenant_state* last = nullptr;
+  std::chrono::nanoseconds last_cost{0};
+  for (;;) {
+    task_context task;
+    {
+      std::unique_lock guard{mtx_};
+      // Charged together with taking the next task to lock once per task.
+      if (last != nullptr) {
+        charge(*last, last_cost);
+      }
+      while (queued_ == 0 && !stopping_) {
+        cv_.wait(guard);
+      }
+      if (queued_ == 0) {
+        break;
+      }
+      task = take_next();
+    }
+    last_cost = execute(task);
+    last = task.owner;
+  }
+}
+
+}  // namespace base
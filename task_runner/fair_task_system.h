@@ -0,0 +1,142 @@
+#ifndef _FAIR_TASK_SYSTEM_H_
+#define _FAIR_TASK_SYSTEM_H_
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "tenant.h"
+
+namespace base {
+
+// Pool of worker threads sharing the processor time between tenants (see
+// tenant.h) in proportion to their weights, so one tenant flooding the pool
+// with a huge fan-out doesn't stall everybody else.
+// Every tenant has a FIFO queue of its own. Tenants with queued tasks are
+// served by deficit round-robin: a tenant at the head of the round gets
+// quantum * weight of execution time, its tasks run until it is spent, then
+// the next tenant goes. Execution time of a task is charged after it
+// finishes, so with several workers a tenant may overdraw by a task per
+// worker, which is taken from its next turn.
+// Tasks run as the tenant they were queued by, so tasks they submit are
+// queued by the same tenant.
+// Unlike simple_task_system the pool isn't compensated for workers blocking
+// inside blocking_region.
+class fair_task_system {
+ public:
+  using task_type = void (*)(void*);
+  using clock = std::chrono::steady_clock;
+
+  // Upper bound of worker count.
+  static constexpr std::size_t max_worker_count = 64;
+  static constexpr std::size_t no_worker = static_cast<std::size_t>(-1);
+
+  struct options {
+    // Zero means one worker per hardware thread.
+    std::size_t thread_count = 0;
+    // Execution time a tenant of weight one gets per round.
+    std::chrono::nanoseconds quantum = std::chrono::microseconds{100};
+  };
+
+  // Counters of a tenant, to verify the isolation.
+  struct tenant_stats {
+    // Tasks queued at the moment.
+    std::size_t queue_size = 0;
+    // Tasks taken for execution.
+    std::uint64_t started = 0;
+    // Total execution time of finished tasks, lags behind a bit.
+    std::chrono::nanoseconds busy{0};
+    // Percentiles of time tasks spent in the queue.
+    std::chrono::nanoseconds wait_p50{0};
+    std::chrono::nanoseconds wait_p99{0};
+  };
+
+ public:
+  fair_task_system() : fair_task_system{options{}} {}
+  explicit fair_task_system(const options& opts);
+  ~fair_task_system();
+
+  fair_task_system(const fair_task_system&) = delete;
+  fair_task_system& operator=(const fair_task_system&) = delete;
+
+  // Queues f(args) for execution on behalf of current_tenant().
+  void run(task_type f, void* args, task_type drop = nullptr);
+
+  // Queues are unbounded, so tasks are never rejected.
+  bool try_run(const task_type f, void* const args,
+               const task_type drop = nullptr) {
+    run(f, args, drop);
+    return true;
+  }
+
+  // Executes the task picked by the round on the calling thread, if there is
+  // one.
+  bool run_pending_task();
+
+  // Number of tasks queued by all tenants.
+  std::size_t queue_size() const;
+
+  // Tasks are never discarded.
+  bool discards_tasks() const { return false; }
+
+  bool running_in_this_thread() const { return current_ == this; }
+
+  std::size_t current_worker_index() const {
+    return running_in_this_thread() ? current_index_ : no_worker;
+  }
+
+  // Sets share of tenant relative to others, tenants have weight one by
+  // default.
+  void set_weight(tenant_id tenant, std::uint32_t weight);
+
+  tenant_stats stats(tenant_id tenant) const;
+
+ private:
+  struct tenant_state;
+
+  struct task_context {
+    task_type func = nullptr;
+    void* args = nullptr;
+    tenant_state* owner = nullptr;
+    clock::time_point queued;
+  };
+
+  // Must be called under mtx_.
+  tenant_state& find_or_add(tenant_id tenant);
+  void activate(tenant_state& t);
+  void charge(tenant_state& t, std::chrono::nanoseconds cost);
+  // Takes the next task of the round. Must be called under mtx_ with tasks
+  // queued.
+  task_context take_next();
+  void give_quantum(tenant_state& t);
+
+  // Executes task as its tenant, returns its execution time.
+  static std::chrono::nanoseconds execute(const task_context& task);
+  void worker_loop(std::size_t index);
+
+ private:
+  static thread_local const fair_task_system* current_;
+  static thread_local std::size_t current_index_;
+
+  const std::chrono::nanoseconds quantum_;
+  std::vector<std::thread> threads_;
+
+  mutable std::mutex mtx_;
+  std::condition_variable cv_;
+  std::unordered_map<tenant_id, std::unique_ptr<tenant_state>> tenants_;
+  // Tenants with queued tasks in order of the round, the head is served.
+  std::deque<tenant_state*> round_;
+  std::size_t queued_ = 0;
+  bool stopping_ = false;
+};
+
+}  // namespace base
+
+#endif  // _FAIR_TASK_SYSTEM_H_
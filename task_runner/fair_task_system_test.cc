@@ -0,0 +1,184 @@
+#include "fair_task_system.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <vector>
+
+#include "catch2/catch_all.hpp"
+#include "event.h"
+#include "task_graph.h"
+#include "task_runner.h"
+
+namespace tg = base::task_graph;
+
+namespace {
+
+using fair_task_runner = base::task_runner_base<base::fair_task_system>;
+
+// Single worker makes the order of tasks deterministic.
+base::fair_task_system::options single_worker() {
+  base::fair_task_system::options opts;
+  opts.thread_count = 1;
+  opts.quantum = std::chrono::microseconds{100};
+  return opts;
+}
+
+void spin_for(const std::chrono::nanoseconds duration) {
+  const auto start = std::chrono::steady_clock::now();
+  while (std::chrono::steady_clock::now() - start < duration) {
+  }
+}
+
+}  // namespace
+
+TEST_CASE("fair_task_system_test", "[fair_task_system]") {
+  SECTION("Tasks inherit tenant of their execution") {
+    fair_task_runner tr;
+    std::atomic<bool> same_tenant = true;
+    auto check = [&] {
+      same_tenant = same_tenant && base::current_tenant() == 7;
+    };
+    auto node = tg::when_all(
+                    [&](int val) {
+                      check();
+                      return val;
+                    },
+                    [&](int val) {
+                      check();
+                      return val * 2;
+                    })
+                    .then([&](int a, int b) {
+                      check();
+                      return a + b;
+                    });
+    int result = 0;
+    tg::sync_execute_as(7, &tr, &node, [&result](int val) { result = val; },
+                        1);
+    REQUIRE(result == 3);
+    REQUIRE(same_tenant);
+    REQUIRE(base::current_tenant() == base::default_tenant);
+    // Branches of all, then() runs in the task of the last one.
+    REQUIRE(tr.tenant_stats(7).started == 2);
+    REQUIRE(tr.tenant_stats(7).queue_size == 0);
+    REQUIRE(tr.tenant_stats(8).started == 0);
+  }
+
+  SECTION("Tenant survives hops through timers and other runners") {
+    fair_task_runner tr;
+    base::simple_task_runner other;
+    std::atomic<bool> same_tenant = true;
+    auto check = [&] {
+      same_tenant = same_tenant && base::current_tenant() == 7;
+    };
+    // The batch is dispatched by the timer thread once its window expires,
+    // the on() branch comes back from a pool of another runner.
+    auto node = tg::when_all(
+                    tg::make_batched_leaf<int>(
+                        [&](const std::vector<int>& vals) {
+                          check();
+                          return vals;
+                        },
+                        {/*max_size=*/100,
+                         /*window=*/std::chrono::milliseconds{1}}),
+                    tg::on(&other,
+                           [&](int val) {
+                             check();
+                             return val * 2;
+                           }))
+                    .then([&](int a, int b) {
+                      check();
+                      return a + b;
+                    });
+    int result = 0;
+    tg::sync_execute_as(7, &tr, &node, [&result](int val) { result = val; },
+                        1);
+    REQUIRE(result == 3);
+    REQUIRE(same_tenant);
+    REQUIRE(tr.tenant_stats(7).started > 0);
+    REQUIRE(tr.tenant_stats(base::default_tenant).started == 0);
+  }
+
+  SECTION("Flooding tenant doesn't delay others") {
+    fair_task_runner tr{single_worker()};
+    constexpr int flood = 1000;
+    base::manual_event gate;
+    base::manual_event done;
+    std::atomic<int> flooded = 0;
+    std::atomic<int> flooded_before_other = -1;
+    tr.run([&] { gate.wait(); });
+    {
+      base::scoped_tenant tenant{1};
+      for (int i = 0; i < flood; ++i) {
+        tr.run([&] {
+          spin_for(std::chrono::microseconds{10});
+          if (++flooded == flood) {
+            done.notify();
+          }
+        });
+      }
+    }
+    {
+      base::scoped_tenant tenant{2};
+      tr.run([&] { flooded_before_other = flooded.load(); });
+    }
+    REQUIRE(tr.tenant_stats(1).queue_size == flood);
+    REQUIRE(tr.tenant_stats(2).queue_size == 1);
+    gate.notify();
+    done.wait();
+    REQUIRE(flooded_before_other >= 0);
+    REQUIRE(flooded_before_other < 100);
+    REQUIRE(tr.tenant_stats(1).started == flood);
+    REQUIRE(tr.tenant_stats(1).wait_p99 > tr.tenant_stats(2).wait_p99);
+  }
+
+  SECTION("Tenants share time by weights") {
+    fair_task_runner tr{single_worker()};
+    tr.set_tenant_weight(1, 3);
+    // Tasks are long enough for the shares to add up over many rounds, so a
+    // few preempted tasks don't skew them.
+    constexpr int count = 1000;
+    base::manual_event gate;
+    base::manual_event done;
+    std::mutex mtx;
+    struct record {
+      base::tenant_id tenant;
+      std::chrono::nanoseconds time;
+    };
+    std::vector<record> order;
+    tr.run([&] { gate.wait(); });
+    for (const base::tenant_id tenant : {1, 2}) {
+      base::scoped_tenant scope{tenant};
+      for (int i = 0; i < count; ++i) {
+        tr.run([&, tenant] {
+          const auto start = std::chrono::steady_clock::now();
+          spin_for(std::chrono::microseconds{50});
+          const auto time = std::chrono::steady_clock::now() - start;
+          std::unique_lock guard{mtx};
+          order.push_back({tenant, time});
+          if (order.size() == 2 * count) {
+            done.notify();
+          }
+        });
+      }
+    }
+    gate.notify();
+    done.wait();
+    // While both have tasks queued, the first one gets about three times more
+    // of the worker time. Time is compared rather than task counts, since
+    // that is what tenants are charged for.
+    std::size_t last[2] = {};
+    for (std::size_t i = 0; i < order.size(); ++i) {
+      last[order[i].tenant - 1] = i;
+    }
+    std::chrono::nanoseconds busy[2] = {};
+    for (std::size_t i = 0; i <= std::min(last[0], last[1]); ++i) {
+      busy[order[i].tenant - 1] += order[i].time;
+    }
+    const double ratio = static_cast<double>(busy[0].count()) /
+                         static_cast<double>(busy[1].count());
+    REQUIRE(ratio > 2);
+    REQUIRE(ratio < 4.5);
+  }
+}
@@ -0,0 +1,113 @@
+#ifndef _HISTOGRAM_H_
+#define _HISTOGRAM_H_
+
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+namespace base {
+
+// Lock-free histogram of durations with HDR-style log-linear buckets: every
+// power of two range of nanoseconds is split into 16 equal buckets, so any
+// recorded value is reported with relative error below 1/16 while the whole
+// range up to centuries takes under a thousand counters.
+// Recording is a single relaxed increment, so it is cheap enough to stay on
+// in production and can be called from any number of threads.
+class latency_histogram {
+ public:
+  using duration = std::chrono::nanoseconds;
+
+  static constexpr int sub_bucket_bits = 4;
+  static constexpr std::size_t sub_bucket_count = 1 << sub_bucket_bits;
+  static constexpr std::size_t bucket_count =
+      (64 - sub_bucket_bits + 1) * sub_bucket_count;
+
+ public:
+  void record(const duration d) {
+    const auto ns = d.count() > 0 ? static_cast<std::uint64_t>(d.count()) : 0;
+    buckets_[bucket_index(ns)].fetch_add(1, std::memory_order_relaxed);
+  }
+
+  std::uint64_t count() const {
+    std::uint64_t result = 0;
+    for (const auto& b : buckets_) {
+      result += b.load(std::memory_order_relaxed);
+    }
+    return result;
+  }
+
+  // Smallest bucket bound below which at least p (in [0, 1]) of recorded
+  // values lie. Zero for empty histogram.
+  duration percentile(const double p) const {
+    assert(p >= 0 && p <= 1);
+    const std::uint64_t total = count();
+    if (total == 0) {
+      return duration::zero();
+    }
+    // Rank of the value in question, counting from one.
+    auto rank = static_cast<std::uint64_t>(p * static_cast<double>(total));
+    if (rank == 0) {
+      rank = 1;
+    }
+    std::uint64_t seen = 0;
+    for (std::size_t i = 0; i < bucket_count; ++i) {
+      seen += buckets_[i].load(std::memory_order_relaxed);
+      if (seen >= rank) {
+        return duration{static_cast<duration::rep>(bucket_upper_bound(i))};
+      }
+    }
+    return duration{static_cast<duration::rep>(
+        bucket_upper_bound(bucket_count - 1))};
+  }
+
+  void reset() {
+    for (auto& b : buckets_) {
+      b.store(0, std::memory_order_relaxed);
+    }
+  }
+
+  static std::size_t bucket_index(const std::uint64_t ns) {
+    if (ns < sub_bucket_count) {
+      return static_cast<std::size_t>(ns);
+    }
+    const int exp = highest_bit(ns);
+    const auto sub = (ns >> (exp - sub_bucket_bits)) & (sub_bucket_count - 1);
+    return static_cast<std::size_t>(exp - sub_bucket_bits + 1) *
+               sub_bucket_count +
+           static_cast<std::size_t>(sub);
+  }
+
+  // Largest value mapped to bucket i.
+  static std::uint64_t bucket_upper_bound(const std::size_t i) {
+    if (i < sub_bucket_count) {
+      return i;
+    }
+    const int exp =
+        static_cast<int>(i / sub_bucket_count) + sub_bucket_bits - 1;
+    const std::uint64_t sub = i % sub_bucket_count;
+    const int shift = exp - sub_bucket_bits;
+    const std::uint64_t lower = (sub_bucket_count + sub) << shift;
+    return lower + ((std::uint64_t{1} << shift) - 1);
+  }
+
+ private:
+  // Position of the highest set bit, value must not be zero.
+  static int highest_bit(std::uint64_t value) {
+    int result = 0;
+    for (int shift = 32; shift > 0; shift /= 2) {
+      if (value >> shift) {
+        value >>= shift;
+        result += shift;
+      }
+    }
+    return result;
+  }
+
+  std::atomic<std::uint64_t> buckets_[bucket_count] = {};
+};
+
+}  // namespace base
+
+#endif  // _HISTOGRAM_H_
@@ -0,0 +1,46 @@
+#include "histogram.h"
+
+#include <chrono>
+
+#include "catch2/catch_all.hpp"
+
+using namespace std::chrono_literals;
+
+TEST_CASE("latency_histogram_test", "[histogram]") {
+  base::latency_histogram h;
+
+  SECTION("Empty histogram") {
+    REQUIRE(h.count() == 0);
+    REQUIRE(h.percentile(0.5) == 0ns);
+  }
+
+  SECTION("Small values are exact") {
+    for (int i = 0; i < 10; ++i) {
+      h.record(std::chrono::nanoseconds{i});
+    }
+    REQUIRE(h.count() == 10);
+    REQUIRE(h.percentile(0.5) == 4ns);
+    REQUIRE(h.percentile(1) == 9ns);
+  }
+
+  SECTION("Relative error is bounded") {
+    for (int i = 1; i <= 100; ++i) {
+      h.record(std::chrono::microseconds{i});
+    }
+    const auto p50 = h.percentile(0.5);
+    const auto p99 = h.percentile(0.99);
+    REQUIRE(p50 >= 50us);
+    REQUIRE(p50 <= 50us + 50us / 16);
+    REQUIRE(p99 >= 99us);
+    REQUIRE(p99 <= 99us + 99us / 16);
+  }
+
+  SECTION("Bucket bounds are monotonic") {
+    for (std::size_t i = 1; i < base::latency_histogram::bucket_count; ++i) {
+      REQUIRE(base::latency_histogram::bucket_upper_bound(i - 1) <
+              base::latency_histogram::bucket_upper_bound(i));
+      REQUIRE(base::latency_histogram::bucket_index(
+                  base::latency_histogram::bucket_upper_bound(i)) == i);
+    }
+  }
+}
@@ -0,0 +1,251 @@
+#ifndef _INLINE_TASK_SYSTEM_H_
+#define _INLINE_TASK_SYSTEM_H_
+
+#include <cassert>
+#include <chrono>
+#include <cstddef>
+#include <deque>
+
+#include "blocking.h"
+#include "task_system.h"
+
+namespace base {
+
+namespace detail {
+
+// Tasks submitted to an inline task system by the thread draining it at the
+// moment. Queues of nested drains (e.g. sync_execute on other inline task
+// system from inside a task) form a stack.
+struct inline_run_queue {
+  using task_type = void (*)(void*);
+
+  struct task_context {
+    task_type func = nullptr;
+    void* args = nullptr;
+    task_type drop = nullptr;
+  };
+
+  explicit inline_run_queue(const void* const owner)
+      : owner{owner}, prev{current} {
+    current = this;
+  }
+
+  // Tasks left behind by a throwing task are released without execution.
+  ~inline_run_queue() {
+    current = prev;
+    for (const auto& task : tasks) {
+      if (task.drop != nullptr) {
+        task.drop(task.args);
+      }
+    }
+  }
+
+  inline_run_queue(const inline_run_queue&) = delete;
+  inline_run_queue& operator=(const inline_run_queue&) = delete;
+
+  // Queue of owner if calling thread drains it right now.
+  static inline_run_queue* find(const void* const owner) {
+    return current != nullptr && current->owner == owner ? current : nullptr;
+  }
+
+  const void* const owner;
+  inline_run_queue* const prev;
+  std::deque<task_context> tasks;
+  // Start of the drain, set by task systems that limit it.
+  std::chrono::steady_clock::time_point start;
+
+  static inline thread_local inline_run_queue* current = nullptr;
+};
+
+}  // namespace detail
+
+// Task system executing tasks on the submitting thread.
+// Task submitted from outside of the task system is executed right away,
+// tasks it submits are queued and executed by the same thread in FIFO order
+// after it returns. So all's fan-out runs breadth-first and long chains of
+// continuations don't grow the stack.
+// An exception thrown by a task leaves run() (or run_pending_task()) and
+// tasks still queued by the thread are discarded without execution.
+// Useful for tiny graphs, where a thread hop costs more than the graph
+// itself, and for measuring the pure overhead of graphs.
+// Having no threads, it runs tasks submitted by the timer thread on the
+// timer thread, delaying all other timers of the process. So nodes firing
+// timers (batched leaves, hedge) must not run on it, hybrid_task_system
+// handles them.
+class inline_task_system {
+ public:
+  using task_type = void (*)(void*);
+
+  // Inline task system has no workers of its own.
+  static constexpr std::size_t max_worker_count = 0;
+  static constexpr std::size_t no_worker = static_cast<std::size_t>(-1);
+
+ public:
+  void run(const task_type f, void* const args,
+           const task_type drop = nullptr) {
+    assert(f != nullptr);
+    if (auto* const queue = detail::inline_run_queue::find(this)) {
+      queue->tasks.push_back({f, args, drop});
+      return;
+    }
+    detail::inline_run_queue queue{this};
+    f(args);
+    while (!queue.tasks.empty()) {
+      const auto task = queue.tasks.front();
+      queue.tasks.pop_front();
+      task.func(task.args);
+    }
+  }
+
+  // Tasks are never rejected.
+  bool try_run(const task_type f, void* const args,
+               const task_type drop = nullptr) {
+    run(f, args, drop);
+    return true;
+  }
+
+  // Executes the oldest task queued by the calling thread.
+  bool run_pending_task() {
+    auto* const queue = detail::inline_run_queue::find(this);
+    if (queue == nullptr || queue->tasks.empty()) {
+      return false;
+    }
+    const auto task = queue->tasks.front();
+    queue->tasks.pop_front();
+    task.func(task.args);
+    return true;
+  }
+
+  // Number of tasks queued by the calling thread.
+  std::size_t queue_size() const {
+    const auto* const queue = detail::inline_run_queue::find(this);
+    return queue != nullptr ? queue->tasks.size() : 0;
+  }
+
+  // Tasks are never discarded.
+  bool discards_tasks() const { return false; }
+
+  // Whether calling thread is draining tasks of this task system.
+  bool running_in_this_thread() const {
+    return detail::inline_run_queue::find(this) != nullptr;
+  }
+
+  std::size_t current_worker_index() const { return no_worker; }
+};
+
+// Task system running graphs inline (see inline_task_system) until they have
+// been running for longer than the inline budget, after that the rest of the
+// tasks is offloaded to a pool. Cheap graphs don't pay for thread hops, while
+// expensive ones still get parallelism.
+// Budget is checked between tasks, so a single long task can't be
+// interrupted. Tasks submitted by the pool workers stay in the pool, as do
+// the ones of threads that must not block (e.g. the timer thread, see
+// nonblocking_scope), so timers never run graphs themselves.
+class hybrid_task_system {
+ public:
+  using task_type = void (*)(void*);
+  using clock = std::chrono::steady_clock;
+
+  // Refers to the value of the pool, its initialization order relative to
+  // this class is unknown.
+  static inline const std::size_t& max_worker_count =
+      simple_task_system::max_worker_count;
+  static constexpr std::size_t no_worker = simple_task_system::no_worker;
+
+ public:
+  explicit hybrid_task_system(
+      const clock::duration inline_budget = std::chrono::microseconds{50},
+      const simple_task_system::options& pool_options = {})
+      : inline_budget_{inline_budget}, pool_{pool_options} {}
+
+  void run(const task_type f, void* const args,
+           const task_type drop = nullptr) {
+    assert(f != nullptr);
+    if (pool_.running_in_this_thread() || detail::current_thread_nonblocking) {
+      pool_.run(f, args, drop);
+      return;
+    }
+    if (auto* const queue = detail::inline_run_queue::find(this)) {
+      if (over_budget(*queue)) {
+        pool_.run(f, args, drop);
+      } else {
+        queue->tasks.push_back({f, args, drop});
+      }
+      return;
+    }
+
+    detail::inline_run_queue queue{this};
+    queue.start = clock::now();
+    f(args);
+    while (!queue.tasks.empty()) {
+      const auto task = queue.tasks.front();
+      queue.tasks.pop_front();
+      if (over_budget(queue)) {
+        pool_.run(task.func, task.args, task.drop);
+      } else {
+        task.func(task.args);
+      }
+    }
+  }
+
+  bool try_run(const task_type f, void* const args,
+               const task_type drop = nullptr) {
+    if (!pool_.running_in_this_thread() &&
+        !detail::current_thread_nonblocking) {
+      auto* const queue = detail::inline_run_queue::find(this);
+      if (queue == nullptr) {
+        run(f, args, drop);
+        return true;
+      }
+      if (!over_budget(*queue)) {
+        queue->tasks.push_back({f, args, drop});
+        return true;
+      }
+    }
+    return pool_.try_run(f, args, drop);
+  }
+
+  // Executes a task queued by the calling thread: an inline one if the
+  // thread drains tasks inline, a pool one if it is a pool worker.
+  bool run_pending_task() {
+    if (pool_.running_in_this_thread()) {
+      return pool_.run_pending_task();
+    }
+    auto* const queue = detail::inline_run_queue::find(this);
+    if (queue == nullptr || queue->tasks.empty()) {
+      return false;
+    }
+    const auto task = queue->tasks.front();
+    queue->tasks.pop_front();
+    task.func(task.args);
+    return true;
+  }
+
+  // Number of tasks queued in the pool.
+  std::size_t queue_size() const { return pool_.queue_size(); }
+
+  // Whether the pool may discard tasks offloaded to it.
+  bool discards_tasks() const { return pool_.discards_tasks(); }
+
+  bool running_in_this_thread() const {
+    return pool_.running_in_this_thread() ||
+           detail::inline_run_queue::find(this) != nullptr;
+  }
+
+  std::size_t current_worker_index() const {
+    return pool_.current_worker_index();
+  }
+
+ private:
+  bool over_budget(const detail::inline_run_queue& queue) const {
+    return clock::now() - queue.start > inline_budget_;
+  }
+
+ private:
+  const clock::duration inline_budget_;
+  simple_task_system pool_;
+};
+
+}  // namespace base
+
+#endif  // _INLINE_TASK_SYSTEM_H_
@@ -0,0 +1,165 @@
+#include "inline_task_system.h"
+
+#include <chrono>
+#include <future>
+#include <memory>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "catch2/catch_all.hpp"
+#include "task_graph.h"
+#include "task_runner.h"
+#include "timer.h"
+
+namespace tg = base::task_graph;
+
+TEST_CASE("inline_task_system_test", "[inline_task_system]") {
+  base::task_runner_base<base::inline_task_system> tr;
+
+  SECTION("Tasks run on submitting thread") {
+    const auto caller = std::this_thread::get_id();
+    std::thread::id executor;
+    tr.run([&] { executor = std::this_thread::get_id(); });
+    REQUIRE(executor == caller);
+    REQUIRE_FALSE(tr.running_in_this_thread());
+  }
+
+  SECTION("Nested tasks run breadth-first") {
+    std::vector<int> order;
+    tr.run([&] {
+      order.push_back(0);
+      tr.run([&] {
+        order.push_back(1);
+        tr.run([&] { order.push_back(3); });
+      });
+      tr.run([&] { order.push_back(2); });
+    });
+    REQUIRE(order == std::vector<int>{0, 1, 2, 3});
+  }
+
+  SECTION("Long chains don't grow stack") {
+    constexpr int total = 1000000;
+    int count = 0;
+    struct chain {
+      void operator()() const {
+        if (++*count < total) {
+          tr->run(*this);
+        }
+      }
+      base::task_runner_base<base::inline_task_system>* tr;
+      int* count;
+    };
+    tr.run(chain{&tr, &count});
+    REQUIRE(count == total);
+  }
+
+  SECTION("Graphs execute synchronously") {
+    auto node = tg::when_all([](int val) { return val + 1; },
+                             [](int val) { return val * 2; })
+                    .then([](int a, int b) { return a + b; });
+    int result = 0;
+    tg::sync_execute(&tr, &node, [&result](int val) { result = val; }, 10);
+    REQUIRE(result == 31);
+  }
+
+  SECTION("Nested graphs execute synchronously") {
+    auto inner = tg::when_all([](int val) { return val + 1; },
+                              [](int val) { return val * 2; })
+                     .then([](int a, int b) { return a + b; });
+    auto outer = tg::when_all([&](int val) {
+      int result = 0;
+      tg::sync_execute(&tr, &inner, [&result](int val) { result = val; }, val);
+      return result;
+    });
+    int result = 0;
+    tg::sync_execute(&tr, &outer, [&result](int val) { result = val; }, 10);
+    REQUIRE(result == 31);
+  }
+
+  SECTION("Throwing tasks are released") {
+    auto token = std::make_shared<int>(0);
+    REQUIRE_THROWS_AS(tr.run([token] { throw std::runtime_error{"task"}; }),
+                      std::runtime_error);
+    tr.run([&] {
+      tr.run([token] { throw std::runtime_error{"task"}; });
+      REQUIRE_THROWS_AS(tr.run_pending_task(), std::runtime_error);
+    });
+    REQUIRE(token.use_count() == 1);
+  }
+
+  SECTION("Tasks queued behind a throwing leaf are released") {
+    auto token = std::make_shared<int>(0);
+    auto node = tg::when_all(
+        [&tr, token](int) {
+          tr.run([token] {});
+          throw std::runtime_error{"leaf"};
+        },
+        [](int val) { return val; });
+    REQUIRE_THROWS_AS(tg::sync_execute(&tr, &node, [](int) {}, 1),
+                      std::runtime_error);
+    // Only the copy held by the node is left.
+    REQUIRE(token.use_count() == 2);
+  }
+}
+
+TEST_CASE("hybrid_task_system_test", "[inline_task_system]") {
+  base::task_runner_base<base::hybrid_task_system> tr{
+      std::chrono::milliseconds{1}};
+  const auto caller = std::this_thread::get_id();
+
+  SECTION("Cheap graphs run inline") {
+    auto node = tg::when_all([] { return std::this_thread::get_id(); });
+    std::thread::id executor;
+    tg::sync_execute(&tr, &node,
+                     [&executor](std::thread::id id) { executor = id; });
+    REQUIRE(executor == caller);
+  }
+
+  SECTION("Expensive graphs are offloaded") {
+    auto slow = [] {
+      std::this_thread::sleep_for(std::chrono::milliseconds{5});
+    };
+    auto node = tg::when_all(slow).then(
+        tg::when_all([] { return std::this_thread::get_id(); }));
+    std::thread::id executor;
+    tg::sync_execute(&tr, &node,
+                     [&executor](std::thread::id id) { executor = id; });
+    REQUIRE(executor != caller);
+  }
+
+  SECTION("Nested graphs execute synchronously") {
+    auto inner = tg::when_all([](int val) { return val + 1; },
+                              [](int val) { return val * 2; })
+                     .then([](int a, int b) { return a + b; });
+    auto outer = tg::when_all([&](int val) {
+      int result = 0;
+      tg::sync_execute(&tr, &inner, [&result](int val) { result = val; }, val);
+      return result;
+    });
+    int result = 0;
+    tg::sync_execute(&tr, &outer, [&result](int val) { result = val; }, 10);
+    REQUIRE(result == 31);
+  }
+
+  SECTION("Tasks of the timer thread are offloaded") {
+    std::promise<std::thread::id> timer_id;
+    base::timer_thread::shared().post_after(
+        std::chrono::nanoseconds{0},
+        [&timer_id] { timer_id.set_value(std::this_thread::get_id()); });
+    const auto timer = timer_id.get_future().get();
+
+    // The batch is dispatched by its window timer.
+    auto node = tg::make_batched_leaf<int>(
+        [](const std::vector<int>& vals) {
+          return std::vector<std::thread::id>(vals.size(),
+                                              std::this_thread::get_id());
+        },
+        {/*max_size=*/100, /*window=*/std::chrono::milliseconds{1}});
+    std::thread::id executor;
+    tg::sync_execute(
+        &tr, &node, [&executor](std::thread::id id) { executor = id; }, 1);
+    REQUIRE(executor != timer);
+    REQUIRE(executor != caller);
+  }
+}
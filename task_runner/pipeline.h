@@ -0,0 +1,340 @@
+#ifndef _PIPELINE_H_
+#define _PIPELINE_H_
+
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+namespace base {
+
+// Pipeline stage processing items one at a time, in the order they were
+// produced by the source.
+template <class F>
+struct serial_in_order_stage {
+  F f;
+};
+
+// Pipeline stage processing any number of items concurrently.
+template <class F>
+struct parallel_stage {
+  F f;
+};
+
+template <class F>
+auto serial_in_order(F f) {
+  return serial_in_order_stage<F>{std::move(f)};
+}
+
+template <class F>
+auto parallel(F f) {
+  return parallel_stage<F>{std::move(f)};
+}
+
+namespace detail {
+
+template <class Stage>
+struct is_serial_stage : std::false_type {};
+
+template <class F>
+struct is_serial_stage<serial_in_order_stage<F>> : std::true_type {};
+
+// Reorder buffer in front of a serial stage. Items arrive from any thread in
+// any order and leave it strictly by their sequence numbers. Every sequence
+// number has its own slot: there are never more items in flight than slots,
+// so the slot is free by the time the next item mapped to it arrives.
+// Items are taken out by a single draining thread at a time (see try_lock()).
+template <class T>
+class reorder_buffer {
+ public:
+  explicit reorder_buffer(const std::size_t size)
+      : size_{size}, slots_{std::make_unique<slot[]>(size)} {
+    assert(size_ > 0);
+  }
+
+  void put(const std::uint64_t seq, T value) {
+    auto& s = slots_[seq % size_];
+    assert(s.stamp.load(std::memory_order_relaxed) == 0);
+    s.value.emplace(std::move(value));
+    s.stamp.store(seq + 1);
+  }
+
+  // Returns the next item in order if it has arrived already.
+  // Must be called by the draining thread only.
+  std::optional<T> try_take(std::uint64_t* const seq) {
+    assert(seq != nullptr);
+    const auto next = next_.load(std::memory_order_relaxed);
+    auto& s = slots_[next % size_];
+    if (s.stamp.load() != next + 1) {
+      return std::nullopt;
+    }
+    std::optional<T> result = std::move(s.value);
+    s.value.reset();
+    s.stamp.store(0, std::memory_order_release);
+    next_.store(next + 1, std::memory_order_relaxed);
+    *seq = next;
+    return result;
+  }
+
+  // Whether the next item in order has arrived.
+  bool ready() const {
+    const auto next = next_.load(std::memory_order_relaxed);
+    return slots_[next % size_].stamp.load() == next + 1;
+  }
+
+  // Makes calling thread the draining one unless there is one already.
+  bool try_lock() {
+    bool expected = false;
+    return draining_.compare_exchange_strong(expected, true);
+  }
+
+  void unlock() { draining_.store(false); }
+
+ private:
+  struct slot {
+    // Sequence number of the stored item plus one, zero for empty slot.
+    std::atomic<std::uint64_t> stamp = 0;
+    std::optional<T> value;
+  };
+
+  const std::size_t size_;
+  std::unique_ptr<slot[]> slots_;
+  std::atomic<std::uint64_t> next_ = 0;
+  std::atomic<bool> draining_ = false;
+};
+
+// Parallel stages don't need any buffer.
+struct no_buffer {
+  explicit no_buffer(std::size_t) {}
+};
+
+template <class Stage, class T>
+using stage_buffer_t =
+    std::conditional_t<is_serial_stage<Stage>::value, reorder_buffer<T>,
+                       no_buffer>;
+
+template <class Stage, class T>
+using stage_result_t = std::invoke_result_t<decltype(Stage::f)&, T&&>;
+
+// Types of items every stage consumes.
+template <class T, class... Stages>
+struct stage_inputs {
+  using type = std::tuple<>;
+};
+
+template <class T, class Stage, class... Stages>
+struct stage_inputs<T, Stage, Stages...> {
+  using type = decltype(std::tuple_cat(
+      std::declval<std::tuple<T>>(),
+      std::declval<typename stage_inputs<stage_result_t<Stage, T>,
+                                         Stages...>::type>()));
+};
+
+}  // namespace detail
+
+// Streaming counterpart of task graphs. Source is a serial generator of
+// items (it returns std::optional, nullopt marks the end of the stream),
+// every item flows through the stages and ends up in the sink, which is a
+// serial in order stage itself. Each hop between stages is a separate task,
+// so different stages work on different items at the same time and
+// throughput approaches that of the slowest stage.
+// Items in flight are bounded by the number of tokens: source waits for a
+// token to produce the next item and the sink returns it. That bounds the
+// memory occupied by items as well as the reorder buffers of serial stages,
+// which are fixed size lock-free rings.
+template <class Source, class... Stages>
+class pipeline {
+  using source_value_type =
+      typename std::invoke_result_t<Source&>::value_type;
+  using inputs_type =
+      typename detail::stage_inputs<source_value_type, Stages...>::type;
+
+  static constexpr std::size_t stage_count = sizeof...(Stages);
+
+ public:
+  explicit pipeline(Source source, Stages... stages)
+      : source_{std::move(source)}, stages_{std::move(stages)...} {}
+
+  // Runs all items of the source through the pipeline using tr and calls
+  // done() after the last item has left the sink. At most tokens items are
+  // in flight at any moment.
+  // Pipeline must outlive the run. Runs of the same pipeline must not
+  // overlap.
+  template <class TaskRunner, class Done>
+  void run(TaskRunner* const tr, const std::size_t tokens, Done done) & {
+    assert(tr != nullptr);
+    assert(tokens > 0);
+    auto exec = std::make_shared<execution<TaskRunner, Done>>(
+        this, tr, tokens, std::move(done),
+        std::make_index_sequence<stage_count>{});
+    exec->pull();
+  }
+
+ private:
+  template <std::size_t I>
+  using stage_t = std::tuple_element_t<I, std::tuple<Stages...>>;
+
+  template <std::size_t I>
+  using input_t = std::tuple_element_t<I, inputs_type>;
+
+  template <class IS>
+  struct buffers;
+
+  template <std::size_t... Is>
+  struct buffers<std::index_sequence<Is...>> {
+    using type =
+        std::tuple<detail::stage_buffer_t<stage_t<Is>, input_t<Is>>...>;
+  };
+
+  template <class TaskRunner, class Done>
+  class execution
+      : public std::enable_shared_from_this<execution<TaskRunner, Done>> {
+   public:
+    template <std::size_t... Is>
+    execution(pipeline* const p, TaskRunner* const tr,
+              const std::size_t tokens, Done done, std::index_sequence<Is...>)
+        : p_{p},
+          tr_{tr},
+          done_{std::move(done)},
+          buffers_{(static_cast<void>(Is), tokens)...},
+          tokens_{tokens} {}
+
+    // Produces items while there are tokens. Only one thread at a time runs
+    // the source.
+    void pull() {
+      while (try_lock_source()) {
+        bool exhausted_now = false;
+        while (!exhausted_ && tokens_.load() > 0) {
+          auto item = std::invoke(p_->source_);
+          if (!item) {
+            exhausted_ = exhausted_now = true;
+            break;
+          }
+          tokens_.fetch_sub(1);
+          remaining_.fetch_add(1);
+          schedule<0>(produced_++, std::move(*item));
+        }
+        const bool exhausted = exhausted_;
+        pulling_.store(false);
+        if (exhausted_now) {
+          arrive();
+        }
+        // Recheck tokens: the sink might have returned some while the
+        // source has been giving up.
+        if (exhausted || tokens_.load() == 0) {
+          return;
+        }
+      }
+    }
+
+   private:
+    bool try_lock_source() {
+      bool expected = false;
+      return pulling_.compare_exchange_strong(expected, true);
+    }
+
+    template <std::size_t I, class T>
+    void schedule(const std::uint64_t seq, T&& value) {
+      tr_->run(
+          [self = this->shared_from_this(), seq](auto&& value) {
+            self->template accept<I>(seq,
+                                     std::forward<decltype(value)>(value));
+          },
+          std::forward<T>(value));
+    }
+
+    template <std::size_t I>
+    void accept(const std::uint64_t seq, input_t<I> value) {
+      if constexpr (detail::is_serial_stage<stage_t<I>>::value) {
+        auto& buffer = std::get<I>(buffers_);
+        buffer.put(seq, std::move(value));
+        while (buffer.try_lock()) {
+          std::uint64_t next = 0;
+          while (auto item = buffer.try_take(&next)) {
+            process<I>(next, std::move(*item));
+          }
+          buffer.unlock();
+          // Recheck: the next item might have arrived while this thread has
+          // been giving up.
+          if (!buffer.ready()) {
+            return;
+          }
+        }
+      } else {
+        process<I>(seq, std::move(value));
+      }
+    }
+
+    template <std::size_t I>
+    void process(const std::uint64_t seq, input_t<I> value) {
+      auto& stage = std::get<I>(p_->stages_);
+      if constexpr (I + 1 == stage_count) {
+        std::invoke(stage.f, std::move(value));
+        // The source stops only when it runs out of tokens, so the first
+        // returned token resumes it.
+        if (tokens_.fetch_add(1) == 0) {
+          tr_->run([self = this->shared_from_this()] { self->pull(); });
+        }
+        arrive();
+      } else {
+        schedule<I + 1>(seq, std::invoke(stage.f, std::move(value)));
+      }
+    }
+
+    // Called once for every item left the sink and once for exhausted
+    // source.
+    void arrive() {
+      if (remaining_.fetch_sub(1) == 1) {
+        std::invoke(done_);
+      }
+    }
+
+    pipeline* const p_;
+    TaskRunner* const tr_;
+    Done done_;
+    typename buffers<std::make_index_sequence<stage_count>>::type buffers_;
+    std::atomic<std::size_t> tokens_;
+    std::atomic<bool> pulling_ = false;
+    // Source state, guarded by pulling_.
+    bool exhausted_ = false;
+    std::uint64_t produced_ = 0;
+    // Items in flight plus one for the source until it is exhausted.
+    std::atomic<std::int64_t> remaining_ = 1;
+  };
+
+  Source source_;
+  std::tuple<Stages...> stages_;
+};
+
+namespace detail {
+
+template <class Source, class Tuple, std::size_t... Is>
+auto make_pipeline_impl(Source source, Tuple stages,
+                        std::index_sequence<Is...>) {
+  auto sink = std::get<sizeof...(Is)>(std::move(stages));
+  return pipeline<Source, std::tuple_element_t<Is, Tuple>...,
+                  serial_in_order_stage<decltype(sink)>>{
+      std::move(source), std::get<Is>(std::move(stages))...,
+      serial_in_order(std::move(sink))};
+}
+
+}  // namespace detail
+
+// Makes pipeline(source, stages..., sink). Stages are made with
+// serial_in_order() or parallel(), sink is a plain invocable.
+template <class Source, class... Ts>
+auto make_pipeline(Source source, Ts... ts) {
+  static_assert(sizeof...(Ts) > 0, "Pipeline needs a sink");
+  return detail::make_pipeline_impl(
+      std::move(source), std::make_tuple(std::move(ts)...),
+      std::make_index_sequence<sizeof...(Ts) - 1>{});
+}
+
+}  // namespace base
+
+#endif  // _PIPELINE_H_
@@ -0,0 +1,88 @@
+#include "pipeline.h"
+
+#include <algorithm>
+#include <atomic>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "catch2/catch_all.hpp"
+#include "event.h"
+#include "task_runner.h"
+
+namespace {
+
+// Source producing numbers [0, count).
+auto make_counter(int count) {
+  return [i = 0, count]() mutable -> std::optional<int> {
+    if (i == count) {
+      return std::nullopt;
+    }
+    return i++;
+  };
+}
+
+}  // namespace
+
+TEST_CASE("pipeline_test", "[pipeline]") {
+  base::simple_task_runner tr;
+  constexpr int count = 1000;
+  base::manual_event done;
+
+  SECTION("Serial stages see items in source order") {
+    std::vector<int> order;
+    std::vector<std::string> sunk;
+    auto p = base::make_pipeline(
+        make_counter(count), base::parallel([](int val) { return val * 2; }),
+        base::serial_in_order([&order](int val) {
+          order.push_back(val);
+          return std::to_string(val);
+        }),
+        base::parallel([](std::string s) { return s + "!"; }),
+        [&sunk](std::string s) { sunk.push_back(std::move(s)); });
+    p.run(&tr, 8, [&done] { done.notify(); });
+    done.wait();
+
+    REQUIRE(order.size() == count);
+    REQUIRE(sunk.size() == count);
+    for (int i = 0; i < count; ++i) {
+      REQUIRE(order[i] == i * 2);
+      REQUIRE(sunk[i] == std::to_string(i * 2) + "!");
+    }
+  }
+
+  SECTION("Tokens bound items in flight") {
+    constexpr std::size_t tokens = 3;
+    std::atomic<std::size_t> in_flight = 0;
+    std::size_t max_in_flight = 0;
+    int sum = 0;
+    auto p = base::make_pipeline(
+        [&, next = make_counter(count)]() mutable {
+          auto item = next();
+          if (item) {
+            ++in_flight;
+          }
+          return item;
+        },
+        base::parallel([](int val) { return val + 1; }),
+        [&](int val) {
+          max_in_flight = std::max<std::size_t>(max_in_flight, in_flight);
+          --in_flight;
+          sum += val;
+        });
+    p.run(&tr, tokens, [&done] { done.notify(); });
+    done.wait();
+
+    REQUIRE(sum == count * (count + 1) / 2);
+    REQUIRE(max_in_flight <= tokens);
+  }
+
+  SECTION("Empty source") {
+    int sunk = 0;
+    auto p = base::make_pipeline(make_counter(0),
+                                 [&sunk](int) { ++sunk; });
+    p.run(&tr, 1, [&done] { done.notify(); });
+    done.wait();
+    REQUIRE(sunk == 0);
+  }
+}
@@ -0,0 +1,449 @@
+#include "remote.h"
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <limits>
+#include <system_error>
+
+namespace base {
+
+namespace {
+
+[[noreturn]] void throw_errno(const char* const what) {
+  throw std::system_error{errno, std::generic_category(), what};
+}
+
+sockaddr_un make_address(const std::string& path) {
+  sockaddr_un addr{};
+  addr.sun_family = AF_UNIX;
+  if (path.size() >= sizeof(addr.sun_path)) {
+    throw std::system_error{ENAMETOOLONG, std::generic_category(),
+                            "unix socket path"};
+  }
+  path.copy(addr.sun_path, path.size());
+  return addr;
+}
+
+#ifdef MSG_NOSIGNAL
+constexpr int send_flags = MSG_NOSIGNAL;
+#else
+constexpr int send_flags = 0;
+#endif
+
+void send_all(const int fd, const char* data, std::size_t size) {
+  while (size > 0) {
+    const auto sent = ::send(fd, data, size, send_flags);
+    if (sent < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      throw_errno("send");
+    }
+    data += sent;
+    size -= static_cast<std::size_t>(sent);
+  }
+}
+
+// Returns false if the peer has closed the connection.
+bool receive_all(const int fd, char* data, std::size_t size) {
+  while (size > 0) {
+    const auto received = ::recv(fd, data, size, 0);
+    if (received < 0 && errno == EINTR) {
+      continue;
+    }
+    if (received <= 0) {
+      return false;
+    }
+    data += received;
+    size -= static_cast<std::size_t>(received);
+  }
+  return true;
+}
+
+}  // namespace
+
+// ==================== unix_socket_transport ====================
+
+std::unique_ptr<unix_socket_transport> unix_socket_transport::connect(
+    const std::string& path) {
+  const auto addr = make_address(path);
+  const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0) {
+    throw_errno("socket");
+  }
+  if (::connect(fd, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr)) !=
+      0) {
+    const int err = errno;
+    ::close(fd);
+    throw std::system_error{err, std::generic_category(), "connect"};
+  }
+  return std::make_unique<unix_socket_transport>(fd);
+}
+
+unix_socket_transport::~unix_socket_transport() { ::close(fd_); }
+
+void unix_socket_transport::send(const char* const data,
+                                 const std::size_t size) {
+  assert(size <= std::numeric_limits<std::uint32_t>::max());
+  const auto header = static_cast<std::uint32_t>(size);
+  send_all(fd_, reinterpret_cast<const char*>(&header), sizeof(header));
+  send_all(fd_, data, size);
+}
+
+bool unix_socket_transport::receive(std::vector<char>* const message) {
+  assert(message != nullptr);
+  std::uint32_t size = 0;
+  if (!receive_all(fd_, reinterpret_cast<char*>(&size), sizeof(size))) {
+    return false;
+  }
+  message->resize(size);
+  return receive_all(fd_, message->data(), size);
+}
+
+void unix_socket_transport::close() { shutdown(fd_, SHUT_RDWR); }
+
+// ==================== unix_socket_listener ====================
+
+unix_socket_listener::unix_socket_listener(const std::string& path)
+    : path_{path} {
+  const auto addr = make_address(path_);
+  fd_ = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd_ < 0) {
+    throw_errno("socket");
+  }
+  unlink(path_.c_str());
+  if (bind(fd_, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr)) != 0 ||
+      listen(fd_, SOMAXCONN) != 0) {
+    const int err = errno;
+    ::close(fd_);
+    throw std::system_error{err, std::generic_category(), "bind"};
+  }
+}
+
+unix_socket_listener::~unix_socket_listener() {
+  ::close(fd_);
+  unlink(path_.c_str());
+}
+
+std::unique_ptr<unix_socket_transport> unix_socket_listener::accept() {
+  for (;;) {
+    const int fd = ::accept(fd_, nullptr, nullptr);
+    if (fd >= 0) {
+      return std::make_unique<unix_socket_transport>(fd);
+    }
+    if (errno != EINTR) {
+      throw_errno("accept");
+    }
+  }
+}
+
+// ==================== serve_remote ====================
+
+namespace {
+
+// Size of the result of a rejected request.
+constexpr std::uint32_t rejected_size =
+    std::numeric_limits<std::uint32_t>::max();
+
+// Reads fields of a message checking that they fit into it, since messages
+// come from other processes.
+class message_reader {
+ public:
+  explicit message_reader(const std::vector<char>& message)
+      : p_{message.data()}, end_{message.data() + message.size()} {}
+
+  template <class T>
+  bool read(T* const value) {
+    if (left() < sizeof(T)) {
+      return false;
+    }
+    *value = detail::read_bytes<T>(&p_);
+    return true;
+  }
+
+  // Points data to the next size bytes.
+  bool take(const std::size_t size, const char** const data) {
+    if (left() < size) {
+      return false;
+    }
+    *data = p_;
+    p_ += size;
+    return true;
+  }
+
+  bool done() const { return p_ == end_; }
+
+ private:
+  std::size_t left() const { return static_cast<std::size_t>(end_ - p_); }
+
+  const char* p_;
+  const char* const end_;
+};
+
+}  // namespace
+
+// Request message: u32 count, then count times
+//   u64 request id, u32 leaf id, u32 size, size bytes of parameters.
+// Response message: u32 count, then count times
+//   u64 request id, u32 size, size bytes of result. Rejected requests have
+//   rejected_size and no result bytes.
+std::size_t serve_remote(transport* const t, remote_registry* const registry) {
+  assert(t != nullptr);
+  assert(registry != nullptr);
+  std::size_t rejected = 0;
+  std::vector<char> message;
+  std::vector<char> response;
+  std::vector<char> result;
+  while (t->receive(&message)) {
+    message_reader in{message};
+    std::uint32_t count = 0;
+    bool valid = in.read(&count);
+    response.clear();
+    detail::append_bytes(&response, count);
+    for (std::uint32_t i = 0; valid && i < count; ++i) {
+      std::uint64_t id = 0;
+      remote_leaf_id leaf = 0;
+      std::uint32_t size = 0;
+      const char* args = nullptr;
+      valid = in.read(&id) && in.read(&leaf) && in.read(&size) &&
+              in.take(size, &args);
+      if (!valid) {
+        break;
+      }
+      detail::append_bytes(&response, id);
+      result.clear();
+      if (!registry->call(leaf, args, size, &result)) {
+        ++rejected;
+        detail::append_bytes(&response, rejected_size);
+        continue;
+      }
+      detail::append_bytes(&response,
+                           static_cast<std::uint32_t>(result.size()));
+      response.insert(response.end(), result.begin(), result.end());
+    }
+    if (!valid || !in.done()) {
+      // Ids of the broken requests are unknown, so they can't be answered.
+      // The client fails them over once the connection is closed.
+      t->close();
+      break;
+    }
+    try {
+      t->send(response.data(), response.size());
+    } catch (const std::system_error&) {
+      // Client is gone.
+      break;
+    }
+  }
+  return rejected;
+}
+
+// ==================== remote_executor ====================
+
+remote_executor::remote_executor(
+    std::vector<std::unique_ptr<transport>> workers, const options& opts)
+    : opts_{opts} {
+  assert(!workers.empty());
+  assert(opts_.max_batch > 0);
+  assert(opts_.max_in_flight > 0);
+  for (auto& w : workers) {
+    auto c = std::make_unique<connection>();
+    c->t = std::move(w);
+    connections_.push_back(std::move(c));
+  }
+  for (auto& c : connections_) {
+    c->reader = std::thread{[this, c = c.get()] { read_loop(*c); }};
+    c->writer = std::thread{[this, c = c.get()] { write_loop(*c); }};
+  }
+}
+
+remote_executor::~remote_executor() {
+  // Requests of closed connections fail instead of moving around.
+  stopping_.store(true);
+  for (auto& c : connections_) {
+    c->t->close();
+  }
+  // Readers stop writers on their way out, see fail_over().
+  for (auto& c : connections_) {
+    c->reader.join();
+    c->writer.join();
+  }
+}
+
+void remote_executor::call(const remote_leaf_id leaf, std::vector<char> args,
+                           done_type done) {
+  submit(request{leaf, std::move(args), std::move(done), current_tenant()});
+}
+
+void remote_executor::submit(request r) {
+  for (;;) {
+    connection* target = nullptr;
+    if (!stopping_.load()) {
+      for (auto& c : connections_) {
+        if (c->alive.load() &&
+            (target == nullptr ||
+             c->load.load(std::memory_order_relaxed) <
+                 target->load.load(std::memory_order_relaxed))) {
+          target = c.get();
+        }
+      }
+    }
+    if (target == nullptr) {
+      scoped_tenant tenant{r.tenant};
+      r.done(nullptr, 0);
+      return;
+    }
+
+    auto& c = *target;
+    std::unique_lock guard{c.mtx};
+    if (!c.alive.load()) {
+      // Failed meanwhile, pick another one.
+      continue;
+    }
+    const auto id = next_id_.fetch_add(1, std::memory_order_relaxed);
+    c.requests.emplace(id, std::move(r));
+    c.pending.push_back(id);
+    c.load.fetch_add(1, std::memory_order_relaxed);
+    // With requests in flight the batch waits for their responses to fill
+    // up.
+    if (c.in_flight == 0 || c.pending.size() >= opts_.max_batch) {
+      c.flush = true;
+      c.writer_cv.notify_one();
+    }
+    return;
+  }
+}
+
+std::vector<std::vector<char>> remote_executor::take_batches(connection& c) {
+  std::vector<std::vector<char>> messages;
+  while (!c.pending.empty() && c.in_flight < opts_.max_in_flight) {
+    const auto count = std::min({c.pending.size(), opts_.max_batch,
+                                 opts_.max_in_flight - c.in_flight});
+    auto& message = messages.emplace_back();
+    detail::append_bytes(&message, static_cast<std::uint32_t>(count));
+    for (std::size_t i = 0; i < count; ++i) {
+      const auto id = c.pending.front();
+      c.pending.pop_front();
+      auto& r = c.requests.at(id);
+      r.sent = true;
+      detail::append_bytes(&message, id);
+      detail::append_bytes(&message, r.leaf);
+      detail::append_bytes(&message, static_cast<std::uint32_t>(r.args.size()));
+      message.insert(message.end(), r.args.begin(), r.args.end());
+    }
+    c.in_flight += count;
+  }
+  return messages;
+}
+
+void remote_executor::write_loop(connection& c) {
+  for (;;) {
+    std::vector<std::vector<char>> messages;
+    {
+      std::unique_lock guard{c.mtx};
+      while (!c.flush && c.alive.load()) {
+        c.writer_cv.wait(guard);
+      }
+      if (!c.alive.load()) {
+        return;
+      }
+      c.flush = false;
+      messages = take_batches(c);
+    }
+    try {
+      for (auto& m : messages) {
+        c.t->send(m.data(), m.size());
+      }
+    } catch (const std::system_error&) {
+      // Reader sees the connection closed and fails its requests over.
+      c.t->close();
+      continue;
+    }
+    sent_messages_.fetch_add(messages.size(), std::memory_order_relaxed);
+  }
+}
+
+void remote_executor::read_loop(connection& c) {
+  std::vector<char> message;
+  while (c.t->receive(&message)) {
+    if (!complete(c, message)) {
+      // Nothing else the worker sends can be trusted.
+      c.t->close();
+      break;
+    }
+  }
+  fail_over(c);
+}
+
+bool remote_executor::complete(connection& c,
+                               const std::vector<char>& message) {
+  struct completion {
+    done_type done;
+    tenant_id tenant;
+    const char* data;
+    std::size_t size;
+  };
+  std::vector<completion> completions;
+  bool valid = true;
+  {
+    message_reader in{message};
+    std::uint32_t count = 0;
+    valid = in.read(&count);
+    std::unique_lock guard{c.mtx};
+    for (std::uint32_t i = 0; valid && i < count; ++i) {
+      std::uint64_t id = 0;
+      std::uint32_t size = 0;
+      const char* data = nullptr;
+      valid = in.read(&id) && in.read(&size) &&
+              (size == rejected_size || in.take(size, &data));
+      auto it = valid ? c.requests.find(id) : c.requests.end();
+      if (it == c.requests.end() || !it->second.sent) {
+        valid = false;
+        break;
+      }
+      completions.push_back({std::move(it->second.done), it->second.tenant,
+                             data, data != nullptr ? size : 0});
+      c.requests.erase(it);
+      --c.in_flight;
+      c.load.fetch_sub(1, std::memory_order_relaxed);
+    }
+    valid = valid && in.done();
+    if (valid && !c.pending.empty()) {
+      c.flush = true;
+      c.writer_cv.notify_one();
+    }
+  }
+
+  // Results point into the message.
+  for (auto& r : completions) {
+    scoped_tenant tenant{r.tenant};
+    r.done(r.data, r.size);
+  }
+  return valid;
+}
+
+void remote_executor::fail_over(connection& c) {
+  std::vector<request> orphans;
+  {
+    std::unique_lock guard{c.mtx};
+    c.alive.store(false);
+    for (auto& [id, r] : c.requests) {
+      orphans.push_back(std::move(r));
+    }
+    c.requests.clear();
+    c.pending.clear();
+    c.in_flight = 0;
+    c.load.store(0);
+    c.writer_cv.notify_one();
+  }
+  c.t->close();
+  // The worker might have executed some of them already.
+  for (auto& r : orphans) {
+    r.sent = false;
+    submit(std::move(r));
+  }
+}
+
+}  // namespace base
@@ -0,0 +1,330 @@
+#ifndef _REMOTE_H_
+#define _REMOTE_H_
+
+#include <atomic>
+#include <cassert>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "task_graph.h"
+#include "tenant.h"
+#include "unique_function.h"
+
+namespace base {
+
+// Bidirectional channel delivering whole messages between processes.
+class transport {
+ public:
+  virtual ~transport() = default;
+
+  // Sends message. Throws std::system_error on failure.
+  virtual void send(const char* data, std::size_t size) = 0;
+  // Waits for the next message. Returns false when the channel is closed.
+  virtual bool receive(std::vector<char>* message) = 0;
+  // Makes pending and future receive() calls on both ends return false.
+  virtual void close() = 0;
+};
+
+// Transport over a connected Unix domain stream socket. Messages are framed
+// with their sizes.
+class unix_socket_transport final : public transport {
+ public:
+  // Connects to the listener at path. Throws std::system_error on failure.
+  static std::unique_ptr<unix_socket_transport> connect(
+      const std::string& path);
+
+  // Takes ownership of the socket.
+  explicit unix_socket_transport(int fd) : fd_{fd} { assert(fd_ >= 0); }
+  ~unix_socket_transport() override;
+
+  void send(const char* data, std::size_t size) override;
+  bool receive(std::vector<char>* message) override;
+  void close() override;
+
+ private:
+  const int fd_;
+};
+
+// Listening Unix domain socket.
+class unix_socket_listener {
+ public:
+  // Binds to path, replacing a stale socket file if there is one. Throws
+  // std::system_error on failure.
+  explicit unix_socket_listener(const std::string& path);
+  ~unix_socket_listener();
+
+  unix_socket_listener(const unix_socket_listener&) = delete;
+  unix_socket_listener& operator=(const unix_socket_listener&) = delete;
+
+  // Waits for the next connection.
+  std::unique_ptr<unix_socket_transport> accept();
+
+ private:
+  const std::string path_;
+  int fd_ = -1;
+};
+
+using remote_leaf_id = std::uint32_t;
+
+namespace detail {
+
+template <class T>
+void append_bytes(std::vector<char>* const out, const T& value) {
+  static_assert(std::is_trivially_copyable_v<T>);
+  const auto* const p = reinterpret_cast<const char*>(&value);
+  out->insert(out->end(), p, p + sizeof(T));
+}
+
+template <class T>
+T read_bytes(const char** const p) {
+  static_assert(std::is_trivially_copyable_v<T>);
+  T value;
+  std::memcpy(&value, *p, sizeof(T));
+  *p += sizeof(T);
+  return value;
+}
+
+}  // namespace detail
+
+// Leaves worker processes can execute by ids. Parameters and results are
+// copied between processes bytewise, so they must be trivially copyable.
+class remote_registry {
+ public:
+  // Registers f taking parameters of types Args... under id.
+  template <class... Args, class F>
+  void add(const remote_leaf_id id, F f) {
+    using result_type = std::invoke_result_t<F&, Args...>;
+    static_assert((... && std::is_trivially_copyable_v<std::decay_t<Args>>),
+                  "Remote parameters are copied bytewise");
+    static_assert(std::is_void_v<result_type> ||
+                      std::is_trivially_copyable_v<result_type>,
+                  "Remote results are copied bytewise");
+    leaves_[id] = [f = std::move(f)](const char* args, std::size_t size,
+                                     std::vector<char>* const result) mutable {
+      if (size != (0 + ... + sizeof(std::decay_t<Args>))) {
+        return false;
+      }
+      // Braced initialization reads parameters in order.
+      std::tuple<std::decay_t<Args>...> values{
+          detail::read_bytes<std::decay_t<Args>>(&args)...};
+      if constexpr (std::is_void_v<result_type>) {
+        std::apply(f, std::move(values));
+      } else {
+        detail::append_bytes(result, std::apply(f, std::move(values)));
+      }
+      return true;
+    };
+  }
+
+  // Executes leaf id with serialized parameters, appends serialized result.
+  // Returns false without executing anything if there is no such leaf or
+  // the parameters don't fit it.
+  bool call(const remote_leaf_id id, const char* const args,
+            const std::size_t size, std::vector<char>* const result) {
+    auto it = leaves_.find(id);
+    if (it == leaves_.end()) {
+      return false;
+    }
+    return it->second(args, size, result);
+  }
+
+ private:
+  std::unordered_map<remote_leaf_id,
+                     std::function<bool(const char*, std::size_t,
+                                        std::vector<char>*)>>
+      leaves_;
+};
+
+// Worker side of remote execution: executes batches of requests coming
+// through t and sends back batches of their results until t is closed.
+// Requests for unknown leaves or with parameters of wrong sizes are rejected
+// and the client is told so. Malformed messages close t, since nothing after
+// them can be trusted. Returns the number of rejected requests.
+std::size_t serve_remote(transport* t, remote_registry* registry);
+
+// Client side of remote execution. Spreads requests between worker
+// processes, preferring the least loaded one.
+// Small requests are batched: while a worker has requests in flight, new ones
+// accumulate and leave as one message when a response arrives or the batch
+// is full. Requests in flight to a single worker are bounded, the rest wait
+// on the client.
+// When a connection fails (it is closed, a send fails or the worker answers
+// with garbage), its outstanding requests are resent to other workers, so
+// remote leaves must tolerate being executed more than once. Requests fail
+// once no worker is left.
+// Every connection has a reader and a writer thread. The reader never sends,
+// so responses keep being drained while big requests are being written and
+// both ends can't get stuck sending to each other.
+class remote_executor {
+ public:
+  struct options {
+    // Maximal number of requests in one message.
+    std::size_t max_batch = 32;
+    // Maximal number of requests in flight to a single worker.
+    std::size_t max_in_flight = 256;
+  };
+
+  // Called with the serialized result of request, or with nullptr if the
+  // request has failed: the worker has rejected it or no worker is left.
+  using done_type = unique_function<void(const char*, std::size_t)>;
+
+ public:
+  remote_executor(std::vector<std::unique_ptr<transport>> workers,
+                  const options& opts);
+  explicit remote_executor(std::vector<std::unique_ptr<transport>> workers)
+      : remote_executor{std::move(workers), options{}} {}
+  ~remote_executor();
+
+  remote_executor(const remote_executor&) = delete;
+  remote_executor& operator=(const remote_executor&) = delete;
+
+  // Executes leaf id with serialized parameters on one of the workers. done
+  // is called on the thread receiving the responses, so it should be short.
+  void call(remote_leaf_id id, std::vector<char> args, done_type done);
+
+  // Number of messages sent so far.
+  std::size_t sent_message_count() const { return sent_messages_.load(); }
+
+ private:
+  struct request {
+    remote_leaf_id leaf;
+    // Kept till the response arrives to resend the request elsewhere if the
+    // worker fails.
+    std::vector<char> args;
+    done_type done;
+    // The caller's, done runs as it on the reader thread.
+    tenant_id tenant = default_tenant;
+    bool sent = false;
+  };
+
+  struct connection {
+    std::unique_ptr<transport> t;
+    std::mutex mtx;
+    // Wakes the writer when pending requests should be sent or the
+    // connection has failed.
+    std::condition_variable writer_cv;
+    // Whether pending requests should leave without waiting for the batch to
+    // fill up.
+    bool flush = false;
+    // Ids of requests waiting to be sent.
+    std::deque<std::uint64_t> pending;
+    // Pending and in flight requests.
+    std::unordered_map<std::uint64_t, request> requests;
+    std::size_t in_flight = 0;
+    // Pending plus in flight requests, read without the lock to pick the
+    // least loaded worker.
+    std::atomic<std::size_t> load = 0;
+    // Cleared under mtx once the connection has failed, read without the
+    // lock to pick a worker.
+    std::atomic<bool> alive = true;
+    std::thread reader;
+    std::thread writer;
+  };
+
+  // Queues r to the least loaded live worker, fails it if there is none.
+  void submit(request r);
+  // Moves as many pending requests of c into messages as in flight limit
+  // allows. Must be called under c.mtx.
+  std::vector<std::vector<char>> take_batches(connection& c);
+  // Sends batches of pending requests of c until it fails. Closes c if a
+  // send fails, its reader takes care of the requests then.
+  void write_loop(connection& c);
+  void read_loop(connection& c);
+  // Completes requests of response message. Returns false if the message
+  // is malformed or answers requests c hasn't sent.
+  bool complete(connection& c, const std::vector<char>& message);
+  // Marks c failed and resends its requests to other workers.
+  void fail_over(connection& c);
+
+ private:
+  const options opts_;
+  std::vector<std::unique_ptr<connection>> connections_;
+  std::atomic<std::uint64_t> next_id_ = 0;
+  std::atomic<std::size_t> sent_messages_ = 0;
+  std::atomic<bool> stopping_ = false;
+};
+
+namespace task_graph {
+
+// Remote execution node. Executes leaf registered under id in a worker
+// process (see remote_registry) with parameters of this node and forwards
+// its result to Then as a task on the task runner. Works as a branch of
+// all like any other node, so fan-outs can spread over machines.
+// R is the result type of the leaf. Requests may fail (see remote_executor),
+// so the node results in std::optional<R>, empty on failure, or in whether
+// the leaf has been executed for void R. Executor must outlive the node.
+template <class R>
+struct remote_leaf {
+  using result_type =
+      std::conditional_t<std::is_void_v<R>, bool, std::optional<R>>;
+
+  template <class... Args>
+  static constexpr auto result_pack = type_pack<result_type>{};
+
+  remote_leaf(remote_executor* const executor, const remote_leaf_id id)
+      : executor_{executor}, id_{id} {
+    assert(executor_ != nullptr);
+  }
+
+  template <class TaskRunner, class Then, class... Args>
+  void execute(TaskRunner* const tr, Then then, Args&&... args) & {
+    assert(tr != nullptr);
+    std::vector<char> bytes;
+    bytes.reserve((0 + ... + sizeof(std::decay_t<Args>)));
+    (..., base::detail::append_bytes(&bytes,
+                                     static_cast<std::decay_t<Args>>(args)));
+    executor_->call(
+        id_, std::move(bytes),
+        [tr, then = std::move(then)](const char* data,
+                                     std::size_t size) mutable {
+          if constexpr (std::is_void_v<R>) {
+            tr->run(std::move(then), data != nullptr && size == 0);
+          } else {
+            std::optional<R> result;
+            if (data != nullptr && size == sizeof(R)) {
+              result = base::detail::read_bytes<R>(&data);
+            }
+            tr->run(std::move(then), std::move(result));
+          }
+        });
+  }
+
+  template <class Then>
+  auto then(Then f);
+
+  remote_executor* executor_;
+  remote_leaf_id id_;
+};
+
+template <class R>
+struct is_exec_node<remote_leaf<R>> : std::true_type {};
+
+template <class R>
+template <class Then>
+auto remote_leaf<R>::then(Then f) {
+  return make_seq(std::move(*this), try_transform(std::move(f)));
+}
+
+template <class R>
+auto remote(remote_executor* const executor, const remote_leaf_id id) {
+  return remote_leaf<R>{executor, id};
+}
+
+}  // namespace task_graph
+
+}  // namespace base
+
+#endif  // _REMOTE_H_
@@ -0,0 +1,333 @@
+#include "remote.h"
+
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <memory>
+#include <optional>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "catch2/catch_all.hpp"
+#include "event.h"
+#include "task_graph.h"
+#include "task_runner.h"
+
+namespace tg = base::task_graph;
+
+namespace {
+
+constexpr base::remote_leaf_id twice_id = 1;
+constexpr base::remote_leaf_id square_id = 2;
+constexpr base::remote_leaf_id half_id = 3;
+constexpr base::remote_leaf_id sum_id = 4;
+constexpr base::remote_leaf_id echo_id = 5;
+
+// Bigger than socket buffers, so sending one blocks until the peer reads it.
+struct big_payload {
+  char data[512 * 1024];
+};
+
+std::string socket_path(int worker) {
+  return "/tmp/task_runner_remote_test_" + std::to_string(getpid()) + "_" +
+         std::to_string(worker);
+}
+
+// Starts worker processes, each serving a single client connection.
+std::vector<pid_t> start_workers(
+    std::vector<std::unique_ptr<base::unix_socket_listener>>& listeners) {
+  std::vector<pid_t> children;
+  for (auto& listener : listeners) {
+    const pid_t child = fork();
+    REQUIRE(child >= 0);
+    if (child == 0) {
+      {
+        base::remote_registry registry;
+        registry.add<int>(twice_id, [](int v) { return v * 2; });
+        registry.add<int>(square_id, [](int v) { return long{v} * v; });
+        registry.add<int>(half_id, [](int v) { return v / 2.0; });
+        registry.add<int, int>(sum_id, [](int a, int b) { return a + b; });
+        auto connection = listener->accept();
+        base::serve_remote(connection.get(), &registry);
+      }
+      _exit(0);
+    }
+    children.push_back(child);
+  }
+  return children;
+}
+
+void add_leaves(base::remote_registry* const registry) {
+  registry->add<int>(twice_id, [](int v) { return v * 2; });
+  registry->add<int, int>(sum_id, [](int a, int b) { return a + b; });
+  registry->add<big_payload>(echo_id,
+                             [](const big_payload& p) -> big_payload {
+                               return p;
+                             });
+}
+
+// Connected pair of transports within this process.
+std::pair<std::unique_ptr<base::transport>, std::unique_ptr<base::transport>>
+make_transport_pair() {
+  int fds[2];
+  REQUIRE(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+  return {std::make_unique<base::unix_socket_transport>(fds[0]),
+          std::make_unique<base::unix_socket_transport>(fds[1])};
+}
+
+template <class... Args>
+std::vector<char> serialize(const Args&... args) {
+  std::vector<char> bytes;
+  (..., base::detail::append_bytes(&bytes, args));
+  return bytes;
+}
+
+// Executes leaf and waits for its result, nullopt if the request has failed.
+std::optional<std::vector<char>> call_sync(base::remote_executor* executor,
+                                           const base::remote_leaf_id leaf,
+                                           std::vector<char> args) {
+  std::optional<std::vector<char>> result;
+  base::manual_event done;
+  executor->call(leaf, std::move(args),
+                 [&](const char* data, std::size_t size) {
+                   if (data != nullptr) {
+                     result.emplace(data, data + size);
+                   }
+                   done.notify();
+                 });
+  done.wait();
+  return result;
+}
+
+void wait_workers(const std::vector<pid_t>& children) {
+  for (auto child : children) {
+    int status = 0;
+    REQUIRE(waitpid(child, &status, 0) == child);
+    REQUIRE(WIFEXITED(status));
+    REQUIRE(WEXITSTATUS(status) == 0);
+  }
+}
+
+}  // namespace
+
+TEST_CASE("remote_test", "[remote]") {
+  constexpr int worker_count = 2;
+  std::vector<std::unique_ptr<base::unix_socket_listener>> listeners;
+  for (int i = 0; i < worker_count; ++i) {
+    listeners.push_back(
+        std::make_unique<base::unix_socket_listener>(socket_path(i)));
+  }
+  const auto children = start_workers(listeners);
+
+  {
+    // Readers of the executor post to the task runner, so it must outlive
+    // the executor.
+    base::simple_task_runner tr;
+    std::vector<std::unique_ptr<base::transport>> transports;
+    for (int i = 0; i < worker_count; ++i) {
+      transports.push_back(
+          base::unix_socket_transport::connect(socket_path(i)));
+    }
+    base::remote_executor executor{std::move(transports), {/*max_batch=*/8}};
+
+    SECTION("Branches of all are executed remotely") {
+      auto node = tg::when_all(tg::remote<int>(&executor, twice_id),
+                               tg::remote<long>(&executor, square_id),
+                               tg::remote<double>(&executor, half_id))
+                      .then([](std::optional<int> twice,
+                               std::optional<long> square,
+                               std::optional<double> half) {
+                        return *twice + *square + *half;
+                      });
+      double result = 0;
+      tg::sync_execute(&tr, &node, [&](double v) { result = v; }, 7);
+      REQUIRE(result == 14 + 49 + 3.5);
+    }
+
+    SECTION("Several parameters") {
+      auto node = tg::remote<int>(&executor, sum_id);
+      std::optional<int> result;
+      tg::sync_execute(
+          &tr, &node, [&](std::optional<int> v) { result = v; }, 40, 2);
+      REQUIRE(result == 42);
+    }
+
+    SECTION("Concurrent requests are batched") {
+      constexpr int total = 1000;
+      std::atomic<long> sum = 0;
+      std::atomic<int> done = 0;
+      base::manual_event finished;
+      for (int i = 1; i <= total; ++i) {
+        std::vector<char> args;
+        base::detail::append_bytes(&args, i);
+        executor.call(twice_id, std::move(args),
+                      [&](const char* data, std::size_t size) {
+                        // Catch2 assertions aren't thread safe, wrong sizes
+                        // show up in the sum.
+                        if (size == sizeof(int)) {
+                          sum += base::detail::read_bytes<int>(&data);
+                        }
+                        if (++done == total) {
+                          finished.notify();
+                        }
+                      });
+      }
+      finished.wait();
+      REQUIRE(sum == static_cast<long>(total) * (total + 1));
+      REQUIRE(executor.sent_message_count() < total);
+    }
+  }
+
+  wait_workers(children);
+}
+
+TEST_CASE("remote_failure_test", "[remote]") {
+  base::simple_task_runner tr;
+  base::remote_registry registry;
+  add_leaves(&registry);
+
+  SECTION("Bad requests are rejected") {
+    auto [client, server] = make_transport_pair();
+    std::size_t rejected = 0;
+    std::thread worker{[&, server = server.get()] {
+      rejected = base::serve_remote(server, &registry);
+    }};
+    {
+      std::vector<std::unique_ptr<base::transport>> workers;
+      workers.push_back(std::move(client));
+      base::remote_executor executor{std::move(workers)};
+      // Unknown leaf.
+      REQUIRE_FALSE(call_sync(&executor, 99, serialize(1)));
+      // Wrong parameters.
+      REQUIRE_FALSE(call_sync(&executor, twice_id, serialize(1, 2)));
+      // The connection is still fine.
+      auto node = tg::remote<int>(&executor, sum_id);
+      std::optional<int> result;
+      tg::sync_execute(
+          &tr, &node, [&](std::optional<int> v) { result = v; }, 40, 2);
+      REQUIRE(result == 42);
+      auto unknown = tg::remote<int>(&executor, 99);
+      tg::sync_execute(&tr, &unknown,
+                       [&](std::optional<int> v) { result = v; }, 1);
+      REQUIRE_FALSE(result);
+    }
+    worker.join();
+    REQUIRE(rejected == 3);
+  }
+
+  SECTION("Malformed requests close the connection") {
+    auto [client, server] = make_transport_pair();
+    std::size_t rejected = 1;
+    std::thread worker{[&, server = server.get()] {
+      rejected = base::serve_remote(server, &registry);
+    }};
+    // Count promises a request that isn't there.
+    const auto message = serialize(std::uint32_t{1}, std::uint64_t{0});
+    client->send(message.data(), message.size());
+    std::vector<char> response;
+    REQUIRE_FALSE(client->receive(&response));
+    worker.join();
+    REQUIRE(rejected == 0);
+  }
+
+  SECTION("Requests of a failed worker go to other ones") {
+    auto [failing_client, failing_server] = make_transport_pair();
+    auto [client, server] = make_transport_pair();
+    // Takes the first batch and dies without answering.
+    std::thread failing{[server = failing_server.get()] {
+      std::vector<char> message;
+      server->receive(&message);
+      server->close();
+    }};
+    std::thread worker{[&, server = server.get()] {
+      base::serve_remote(server, &registry);
+    }};
+    {
+      std::vector<std::unique_ptr<base::transport>> workers;
+      workers.push_back(std::move(failing_client));
+      workers.push_back(std::move(client));
+      base::remote_executor executor{std::move(workers)};
+      constexpr int total = 100;
+      std::atomic<long> sum = 0;
+      std::atomic<int> failed = 0;
+      std::atomic<int> done = 0;
+      base::manual_event finished;
+      for (int i = 1; i <= total; ++i) {
+        executor.call(twice_id, serialize(i),
+                      [&](const char* data, std::size_t size) {
+                        if (data != nullptr && size == sizeof(int)) {
+                          sum += base::detail::read_bytes<int>(&data);
+                        } else {
+                          ++failed;
+                        }
+                        if (++done == total) {
+                          finished.notify();
+                        }
+                      });
+      }
+      finished.wait();
+      REQUIRE(failed == 0);
+      REQUIRE(sum == static_cast<long>(total) * (total + 1));
+    }
+    failing.join();
+    worker.join();
+  }
+
+  SECTION("Big requests and responses don't block each other") {
+    auto [client, server] = make_transport_pair();
+    std::thread worker{[&, server = server.get()] {
+      base::serve_remote(server, &registry);
+    }};
+    {
+      std::vector<std::unique_ptr<base::transport>> workers;
+      workers.push_back(std::move(client));
+      // The reader gets responses while the next requests are being sent.
+      base::remote_executor executor{std::move(workers),
+                                     {/*max_batch=*/2, /*max_in_flight=*/2}};
+      constexpr int total = 16;
+      std::atomic<int> echoed = 0;
+      std::atomic<int> done = 0;
+      base::manual_event finished;
+      for (int i = 0; i < total; ++i) {
+        std::vector<char> args(sizeof(big_payload), static_cast<char>(i));
+        executor.call(echo_id, std::move(args),
+                      [&, i](const char* data, std::size_t size) {
+                        if (data != nullptr && size == sizeof(big_payload) &&
+                            data[0] == static_cast<char>(i) &&
+                            data[size - 1] == static_cast<char>(i)) {
+                          ++echoed;
+                        }
+                        if (++done == total) {
+                          finished.notify();
+                        }
+                      });
+      }
+      finished.wait();
+      REQUIRE(echoed == total);
+    }
+    worker.join();
+  }
+
+  SECTION("Requests fail once no worker is left") {
+    auto [client, server] = make_transport_pair();
+    std::vector<std::unique_ptr<base::transport>> workers;
+    workers.push_back(std::move(client));
+    base::remote_executor executor{std::move(workers)};
+    // Answers a request nobody has sent.
+    const auto garbage = serialize(std::uint32_t{1}, std::uint64_t{12345},
+                                   std::uint32_t{0});
+    std::thread failing{[&, server = server.get()] {
+      std::vector<char> message;
+      server->receive(&message);
+      server->send(garbage.data(), garbage.size());
+    }};
+    REQUIRE_FALSE(call_sync(&executor, twice_id, serialize(1)));
+    failing.join();
+    // New requests fail right away.
+    REQUIRE_FALSE(call_sync(&executor, twice_id, serialize(2)));
+  }
+}
@@ -0,0 +1,285 @@
+#include "sharded_task_system.h"
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+#include "cache_line.h"
+#include "task_system.h"
+
+namespace base {
+
+namespace detail {
+
+namespace {
+
+// Bounded lock-free ring with a single producer and a single consumer. Each
+// side caches the position of the other one, so it touches the other side's
+// cache line only when the ring looks full (or empty).
+template <class T>
+class spsc_ring {
+ public:
+  explicit spsc_ring(const std::size_t capacity)
+      : mask_{round_up(capacity) - 1},
+        slots_{std::make_unique<T[]>(mask_ + 1)} {}
+
+  // Producer side.
+  bool try_push(const T& value) {
+    const std::size_t tail = tail_.load(std::memory_order_relaxed);
+    if (tail - cached_head_ > mask_) {
+      cached_head_ = head_.load(std::memory_order_acquire);
+      if (tail - cached_head_ > mask_) {
+        return false;
+      }
+    }
+    slots_[tail & mask_] = value;
+    tail_.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Consumer side.
+  bool try_pop(T* const value) {
+    const std::size_t head = head_.load(std::memory_order_relaxed);
+    if (head == cached_tail_) {
+      cached_tail_ = tail_.load(std::memory_order_acquire);
+      if (head == cached_tail_) {
+        return false;
+      }
+    }
+    *value = slots_[head & mask_];
+    head_.store(head + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Consumer side.
+  bool empty() const {
+    return head_.load(std::memory_order_relaxed) ==
+           tail_.load(std::memory_order_acquire);
+  }
+
+ private:
+  static std::size_t round_up(const std::size_t capacity) {
+    std::size_t result = 1;
+    while (result < capacity) {
+      result *= 2;
+    }
+    return result;
+  }
+
+  const std::size_t mask_;
+  const std::unique_ptr<T[]> slots_;
+  alignas(cache_line_size) std::atomic<std::size_t> head_ = 0;
+  std::size_t cached_tail_ = 0;
+  alignas(cache_line_size) std::atomic<std::size_t> tail_ = 0;
+  std::size_t cached_head_ = 0;
+};
+
+void pin_to_core(std::thread& thread, const std::size_t core) {
+#ifdef __linux__
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(core % CPU_SETSIZE, &set);
+  // Failure (e.g. a restricted cpuset) only costs locality.
+  pthread_setaffinity_np(thread.native_handle(), sizeof(set), &set);
+#else
+  static_cast<void>(thread);
+  static_cast<void>(core);
+#endif
+}
+
+}  // namespace
+
+}  // namespace detail
+
+struct sharded_task_system::shard {
+  shard(const std::size_t shard_count, const std::size_t mailbox_capacity) {
+    for (std::size_t i = 0; i < shard_count; ++i) {
+      mailboxes.push_back(
+          std::make_unique<detail::spsc_ring<task_context>>(mailbox_capacity));
+    }
+  }
+
+  // Tasks of the shard itself, touched by its thread only.
+  std::deque<task_context> local;
+  // Incoming mailboxes indexed by the sending shard.
+  std::vector<std::unique_ptr<detail::spsc_ring<task_context>>> mailboxes;
+
+  // Tasks of foreign threads and of full mailboxes.
+  std::mutex inbox_mtx;
+  std::deque<task_context> inbox;
+  std::atomic<bool> inbox_empty = true;
+
+  std::mutex sleep_mtx;
+  std::condition_variable sleep_cv;
+  std::atomic<bool> sleeping = false;
+
+  std::thread thread;
+};
+
+thread_local const sharded_task_system* sharded_task_system::current_ =
+    nullptr;
+
+thread_local std::size_t sharded_task_system::current_index_ = no_worker;
+
+sharded_task_system::sharded_task_system(const options& opts)
+    : poll_batch_{opts.poll_batch} {
+  const std::size_t count = std::min(
+      opts.shard_count != 0 ? opts.shard_count
+                            : std::max<std::size_t>(
+                                  simple_task_system::thread_count, 1),
+      max_shard_count);
+  assert(poll_batch_ > 0);
+  for (std::size_t i = 0; i < count; ++i) {
+    shards_.push_back(std::make_unique<shard>(count, opts.mailbox_capacity));
+  }
+  // Shards are complete before any of them starts sending.
+  for (std::size_t i = 0; i < count; ++i) {
+    shards_[i]->thread = std::thread{[this, i] { shard_loop(i); }};
+    if (opts.pin_threads) {
+      detail::pin_to_core(shards_[i]->thread, i);
+    }
+  }
+}
+
+sharded_task_system::~sharded_task_system() {
+  stopping_ = true;
+  for (auto& s : shards_) {
+    wake(*s);
+  }
+  for (auto& s : shards_) {
+    s->thread.join();
+  }
+}
+
+void sharded_task_system::run(const task_type f, void* const args,
+                              const task_type) {
+  if (running_in_this_thread()) {
+    ++queued_;
+    ++pending_;
+    shards_[current_index_]->local.push_back({f, args});
+    return;
+  }
+  post(*shards_[next_shard_++ % shards_.size()], {f, args});
+}
+
+void sharded_task_system::run_on(const std::size_t shard, const task_type f,
+                                 void* const args, const task_type drop) {
+  assert(shard < shards_.size());
+  if (running_in_this_thread() && current_index_ == shard) {
+    run(f, args, drop);
+    return;
+  }
+  post(*shards_[shard], {f, args});
+}
+
+void sharded_task_system::post(shard& target, const task_context& task) {
+  ++queued_;
+  ++pending_;
+  if (!running_in_this_thread() ||
+      !target.mailboxes[current_index_]->try_push(task)) {
+    {
+      std::unique_lock guard{target.inbox_mtx};
+      target.inbox.push_back(task);
+    }
+    target.inbox_empty = false;
+  }
+  wake(target);
+}
+
+void sharded_task_system::wake(shard& target) {
+  // Pairs with the fence in shard_loop(): either the shard sees the task
+  // before sleeping or this sees it sleeping.
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (target.sleeping.load(std::memory_order_relaxed)) {
+    std::unique_lock guard{target.sleep_mtx};
+    target.sleep_cv.notify_one();
+  }
+}
+
+bool sharded_task_system::collect(shard& s) {
+  bool result = false;
+  task_context task;
+  for (auto& mailbox : s.mailboxes) {
+    for (std::size_t i = 0; i < poll_batch_ && mailbox->try_pop(&task); ++i) {
+      s.local.push_back(task);
+      result = true;
+    }
+  }
+  if (!s.inbox_empty.load()) {
+    std::unique_lock guard{s.inbox_mtx};
+    s.local.insert(s.local.end(), s.inbox.begin(), s.inbox.end());
+    result |= !s.inbox.empty();
+    s.inbox.clear();
+    s.inbox_empty = true;
+  }
+  return result;
+}
+
+bool sharded_task_system::has_incoming(shard& s) const {
+  return !s.inbox_empty.load(std::memory_order_relaxed) ||
+         std::any_of(s.mailboxes.begin(), s.mailboxes.end(),
+                     [](const auto& mailbox) { return !mailbox->empty(); });
+}
+
+bool sharded_task_system::run_local(shard& s, const std::size_t limit) {
+  std::size_t executed = 0;
+  while (executed < limit && !s.local.empty()) {
+    const task_context task = s.local.front();
+    s.local.pop_front();
+    --queued_;
+    task.func(task.args);
+    --pending_;
+    ++executed;
+  }
+  return executed != 0;
+}
+
+bool sharded_task_system::run_pending_task() {
+  if (!running_in_this_thread()) {
+    return false;
+  }
+  auto& s = *shards_[current_index_];
+  if (s.local.empty()) {
+    collect(s);
+  }
+  return run_local(s, 1);
+}
+
+void sharded_task_system::shard_loop(const std::size_t index) {
+  current_ = this;
+  current_index_ = index;
+  auto& s = *shards_[index];
+  for (;;) {
+    const bool collected = collect(s);
+    if (run_local(s, poll_batch_) || collected) {
+      continue;
+    }
+    if (stopping_ && pending_ == 0) {
+      break;
+    }
+
+    std::unique_lock guard{s.sleep_mtx};
+    s.sleeping = true;
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (!has_incoming(s)) {
+      if (stopping_) {
+        // Tasks still running on other shards may send something here.
+        s.sleep_cv.wait_for(guard, std::chrono::milliseconds{1});
+      } else {
+        s.sleep_cv.wait(guard);
+      }
+    }
+    s.sleeping = false;
+  }
+}
+
+}  // namespace base
@@ -0,0 +1,119 @@
+#ifndef _SHARDED_TASK_SYSTEM_H_
+#define _SHARDED_TASK_SYSTEM_H_
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+namespace base {
+
+// Thread-per-core task system: every shard is a single worker (pinned to its
+// core where the platform allows) with a run queue of its own. There is no
+// queue shared by all workers. Tasks submitted by a shard stay on it, other
+// shards are reached explicitly with run_on(). Shards talk through lock-free
+// SPSC mailboxes, one for every ordered pair of shards, which receivers poll
+// in batches between their own tasks.
+// Threads not belonging to the task system submit through a locked inbox of
+// the shard, which also takes tasks of a full mailbox. So tasks sent from one
+// shard to another are executed in order only until a mailbox overflows.
+// Idle shards sleep until a task is sent to them.
+// Shards never steal work from each other, so the application is responsible
+// for spreading it.
+class sharded_task_system {
+ public:
+  using task_type = void (*)(void*);
+
+  // Upper bound of shard count.
+  static constexpr std::size_t max_shard_count = 64;
+  // Workers are shards, indexed by [0, shard_count()).
+  static constexpr std::size_t max_worker_count = max_shard_count;
+  static constexpr std::size_t no_worker = static_cast<std::size_t>(-1);
+
+  struct options {
+    // Zero means one shard per hardware thread.
+    std::size_t shard_count = 0;
+    // Capacity of a mailbox between two shards.
+    std::size_t mailbox_capacity = 1024;
+    // Maximal number of tasks a shard takes from a mailbox or runs from its
+    // own queue at once before looking elsewhere.
+    std::size_t poll_batch = 32;
+    // Whether shard threads are pinned to cores.
+    bool pin_threads = true;
+  };
+
+ public:
+  sharded_task_system() : sharded_task_system{options{}} {}
+  explicit sharded_task_system(const options& opts);
+  ~sharded_task_system();
+
+  sharded_task_system(const sharded_task_system&) = delete;
+  sharded_task_system& operator=(const sharded_task_system&) = delete;
+
+  // Queues f(args) on the calling shard. Threads not belonging to the task
+  // system spread their tasks round-robin.
+  void run(task_type f, void* args, task_type drop = nullptr);
+
+  // Queues are unbounded, so tasks are never rejected.
+  bool try_run(const task_type f, void* const args,
+               const task_type drop = nullptr) {
+    run(f, args, drop);
+    return true;
+  }
+
+  // Queues f(args) on the shard.
+  void run_on(std::size_t shard, task_type f, void* args,
+              task_type drop = nullptr);
+
+  // Executes a task queued for the calling shard, if it is one.
+  bool run_pending_task();
+
+  // Number of tasks queued on all shards.
+  std::size_t queue_size() const { return queued_.load(); }
+
+  // Tasks are never discarded.
+  bool discards_tasks() const { return false; }
+
+  std::size_t shard_count() const { return shards_.size(); }
+
+  bool running_in_this_thread() const { return current_ == this; }
+
+  // Index of the calling shard, or no_worker.
+  std::size_t current_worker_index() const {
+    return running_in_this_thread() ? current_index_ : no_worker;
+  }
+
+ private:
+  struct task_context {
+    task_type func = nullptr;
+    void* args = nullptr;
+  };
+
+  struct shard;
+
+  void post(shard& target, const task_context& task);
+  void wake(shard& target);
+  // Moves tasks sent to the shard into its local queue.
+  bool collect(shard& s);
+  bool has_incoming(shard& s) const;
+  bool run_local(shard& s, std::size_t limit);
+  void shard_loop(std::size_t index);
+
+ private:
+  static thread_local const sharded_task_system* current_;
+  static thread_local std::size_t current_index_;
+
+  const std::size_t poll_batch_;
+  std::vector<std::unique_ptr<shard>> shards_;
+  std::atomic<std::size_t> next_shard_ = 0;
+  // Tasks submitted but not yet started.
+  std::atomic<std::size_t> queued_ = 0;
+  // Tasks submitted but not yet finished. Shards stop when it drops to zero
+  // after the destruction has begun.
+  std::atomic<std::size_t> pending_ = 0;
+  std::atomic<bool> stopping_ = false;
+};
+
+}  // namespace base
+
+#endif  // _SHARDED_TASK_SYSTEM_H_
@@ -0,0 +1,164 @@
+#include "sharded_task_system.h"
+
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "catch2/catch_all.hpp"
+#include "event.h"
+#include "task_graph.h"
+#include "task_graph_profile.h"
+#include "task_runner.h"
+
+namespace tg = base::task_graph;
+
+namespace {
+
+using sharded_task_runner = base::task_runner_base<base::sharded_task_system>;
+
+constexpr std::size_t shard_count = 4;
+
+base::sharded_task_system::options test_options() {
+  base::sharded_task_system::options opts;
+  opts.shard_count = shard_count;
+  // Tiny mailboxes make them overflow.
+  opts.mailbox_capacity = 4;
+  return opts;
+}
+
+}  // namespace
+
+TEST_CASE("sharded_task_system_test", "[sharded_task_system]") {
+  sharded_task_runner tr{test_options()};
+  REQUIRE(tr.shard_count() == shard_count);
+
+  SECTION("Tasks stay on their shard") {
+    std::atomic<bool> same_shard = true;
+    std::atomic<int> finished = 0;
+    base::manual_event done;
+    for (std::size_t shard = 0; shard < shard_count; ++shard) {
+      tr.run_on(shard, [&, shard] {
+        same_shard = same_shard && tr.current_worker_index() == shard;
+        tr.run([&, shard] {
+          same_shard = same_shard && tr.current_worker_index() == shard;
+          if (++finished == shard_count) {
+            done.notify();
+          }
+        });
+      });
+    }
+    done.wait();
+    REQUIRE(same_shard);
+    REQUIRE_FALSE(tr.running_in_this_thread());
+  }
+
+  SECTION("Shards exchange messages") {
+    // Every shard sends a message to every shard, including itself, many
+    // times. Counters are shard-local, so they need no synchronization
+    // besides the messages themselves.
+    constexpr int rounds = 1000;
+    std::vector<long> received(shard_count);
+    std::atomic<bool> right_shard = true;
+    std::atomic<int> finished = 0;
+    const int total = rounds * shard_count * shard_count;
+    base::manual_event done;
+    for (std::size_t from = 0; from < shard_count; ++from) {
+      tr.run_on(from, [&] {
+        for (int i = 0; i < rounds; ++i) {
+          for (std::size_t to = 0; to < shard_count; ++to) {
+            tr.run_on(to, [&, to] {
+              right_shard = right_shard && tr.current_worker_index() == to;
+              ++received[to];
+              if (++finished == total) {
+                done.notify();
+              }
+            });
+          }
+        }
+      });
+    }
+    done.wait();
+    REQUIRE(right_shard);
+    for (auto count : received) {
+      REQUIRE(count == rounds * static_cast<long>(shard_count));
+    }
+  }
+}
+
+TEST_CASE("sharded_task_system_distribute_test", "[sharded_task_system]") {
+  sharded_task_runner tr{test_options()};
+  std::mutex mtx;
+  std::set<std::size_t> shards;
+  auto record = [&] {
+    std::unique_lock guard{mtx};
+    shards.insert(tr.current_worker_index());
+  };
+
+  SECTION("Round-robin") {
+    auto node = tg::distribute(tg::round_robin{},
+                               tg::when_all(
+                                   [&](int val) {
+                                     record();
+                                     return val;
+                                   },
+                                   [&](int val) {
+                                     record();
+                                     return val * 2;
+                                   },
+                                   [&](int val) {
+                                     record();
+                                     return val * 3;
+                                   },
+                                   [&](int val) {
+                                     record();
+                                     return val * 4;
+                                   }))
+                    .then([](int a, int b, int c, int d) {
+                      return a + b + c + d;
+                    });
+    int result = 0;
+    tg::sync_execute(&tr, &node, [&result](int val) { result = val; }, 1);
+    REQUIRE(result == 10);
+    REQUIRE(shards.size() == shard_count);
+  }
+
+  SECTION("By key") {
+    // Both branches have the same key, so they meet on one shard.
+    auto node = tg::distribute(
+        tg::by_key{[](std::size_t, int val) { return val; }},
+        tg::when_all([&](int) { record(); }, [&](int) { record(); }));
+    tg::sync_execute(&tr, &node, [] {}, 42);
+    REQUIRE(shards.size() == 1);
+    REQUIRE(*shards.begin() == std::hash<int>{}(42) % shard_count);
+  }
+
+  SECTION("Instrumented") {
+    tg::graph_profile profile;
+    auto times = [&](int k) {
+      return [&record, k](int val) {
+        record();
+        return val * k;
+      };
+    };
+    auto node = tg::instrument(
+        tg::distribute(tg::round_robin{},
+                       tg::when_all(times(1), times(2), times(3), times(4)))
+            .then([](int a, int b, int c, int d) { return a + b + c + d; }),
+        &profile);
+    int result = 0;
+    tg::sync_execute(&tr, &node, [&result](int val) { result = val; }, 1);
+    REQUIRE(result == 10);
+    REQUIRE(shards.size() == shard_count);
+
+    std::map<std::string, const tg::node_stats*> stats;
+    profile.for_each(
+        [&stats](const tg::node_stats& s) { stats[s.path] = &s; });
+    REQUIRE(stats["0.0"]->kind == "distributed");
+    REQUIRE(stats["0.0"]->exec_time.count() == 1);
+    // Every branch waited in the queue of its shard.
+    REQUIRE(stats["0.0"]->queue_wait.count() == shard_count);
+  }
+}
@@ -0,0 +1,370 @@
+#include "shm_task_system.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <new>
+#include <stdexcept>
+#include <system_error>
+
+#include "cache_line.h"
+
+namespace base {
+
+namespace detail {
+
+namespace {
+
+constexpr std::uint64_t shm_magic = 0x7461736b71756575;  // "taskqueu"
+
+enum shm_state : std::uint32_t {
+  shm_initializing = 0,
+  shm_ready = 1,
+};
+
+[[noreturn]] void throw_errno(const char* const what) {
+  throw std::system_error{errno, std::generic_category(), what};
+}
+
+// Sleeps while *addr == expected. Wakeups may be spurious.
+void futex_wait(std::atomic<std::uint32_t>* const addr,
+                const std::uint32_t expected) {
+#ifdef __linux__
+  // Futexes in shared memory must not be process private.
+  syscall(SYS_futex, reinterpret_cast<std::uint32_t*>(addr), FUTEX_WAIT,
+          expected, nullptr, nullptr, 0);
+#else
+  if (addr->load() == expected) {
+    std::this_thread::sleep_for(std::chrono::microseconds{100});
+  }
+#endif
+}
+
+void futex_wake(std::atomic<std::uint32_t>* const addr, const int count) {
+#ifdef __linux__
+  syscall(SYS_futex, reinterpret_cast<std::uint32_t*>(addr), FUTEX_WAKE,
+          count, nullptr, nullptr, 0);
+#else
+  static_cast<void>(addr);
+  static_cast<void>(count);
+#endif
+}
+
+}  // namespace
+
+// Event counter threads can sleep on until it changes.
+struct shm_event {
+  void notify(const int count) {
+    seq.fetch_add(1);
+    if (waiters.load() > 0) {
+      futex_wake(&seq, count);
+    }
+  }
+
+  std::atomic<std::uint32_t> seq = 0;
+  std::atomic<std::uint32_t> waiters = 0;
+};
+
+// Slot of the ring (Vyukov's bounded MPMC queue). Payload follows it.
+struct shm_slot {
+  // Equals position of the slot for the next push into it, position plus one
+  // when it is published for the pop.
+  std::atomic<std::uint64_t> seq;
+  shm_task_system::task_id id;
+  std::uint32_t size;
+
+  char* payload() { return reinterpret_cast<char*>(this + 1); }
+};
+
+struct shm_queue_header {
+  std::uint64_t magic;
+  std::atomic<std::uint32_t> state;
+  std::uint32_t capacity;
+  std::uint32_t slot_stride;
+  std::uint32_t max_payload_size;
+
+  alignas(cache_line_size) std::atomic<std::uint64_t> head;
+  alignas(cache_line_size) std::atomic<std::uint64_t> tail;
+  // Signalled on every push and on stop.
+  alignas(cache_line_size) shm_event items;
+  // Signalled on every pop.
+  alignas(cache_line_size) shm_event space;
+
+  shm_slot* slot(const std::uint64_t pos) {
+    auto* const slots = reinterpret_cast<char*>(this) + slots_offset();
+    return reinterpret_cast<shm_slot*>(slots +
+                                       (pos & (capacity - 1)) * slot_stride);
+  }
+
+  static constexpr std::size_t slots_offset() {
+    return (sizeof(shm_queue_header) + cache_line_size - 1) /
+           cache_line_size * cache_line_size;
+  }
+};
+
+static_assert(std::atomic<std::uint64_t>::is_always_lock_free &&
+                  std::atomic<std::uint32_t>::is_always_lock_free,
+              "Atomics in shared memory must be address free");
+
+}  // namespace detail
+
+namespace {
+
+std::size_t round_up(const std::size_t value, const std::size_t align) {
+  return (value + align - 1) / align * align;
+}
+
+std::size_t round_up_pow2(const std::size_t value) {
+  std::size_t result = 1;
+  while (result < value) {
+    result *= 2;
+  }
+  return result;
+}
+
+}  // namespace
+
+shm_task_system::shm_task_system(const std::string& name,
+                                 const options& opts) {
+  using detail::shm_queue_header;
+  const std::size_t capacity = round_up_pow2(opts.capacity);
+  const std::size_t stride =
+      round_up(sizeof(detail::shm_slot) + opts.max_payload_size,
+               detail::cache_line_size);
+  mapped_size_ = shm_queue_header::slots_offset() + capacity * stride;
+  // Attaching process gives up on segments whose creator never finishes
+  // initializing them.
+  const auto deadline = std::chrono::steady_clock::now() + opts.attach_timeout;
+
+  bool created = true;
+  int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+  if (fd < 0 && errno == EEXIST) {
+    created = false;
+    fd = shm_open(name.c_str(), O_RDWR, 0600);
+  }
+  if (fd < 0) {
+    detail::throw_errno("shm_open");
+  }
+
+  if (created) {
+    if (ftruncate(fd, static_cast<off_t>(mapped_size_)) != 0) {
+      const int err = errno;
+      close(fd);
+      shm_unlink(name.c_str());
+      throw std::system_error{err, std::generic_category(), "ftruncate"};
+    }
+  } else {
+    // Creator might not have sized the segment yet.
+    struct stat st {};
+    for (;;) {
+      if (fstat(fd, &st) != 0) {
+        const int err = errno;
+        close(fd);
+        throw std::system_error{err, std::generic_category(), "fstat"};
+      }
+      if (st.st_size != 0) {
+        break;
+      }
+      if (std::chrono::steady_clock::now() >= deadline) {
+        close(fd);
+        throw std::system_error{ETIMEDOUT, std::generic_category(),
+                                "shm_task_system: segment isn't sized"};
+      }
+      std::this_thread::sleep_for(std::chrono::milliseconds{1});
+    }
+    if (static_cast<std::size_t>(st.st_size) != mapped_size_) {
+      close(fd);
+      throw std::system_error{EINVAL, std::generic_category(),
+                              "shm_task_system: segment size mismatch"};
+    }
+  }
+
+  void* const addr =
+      mmap(nullptr, mapped_size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  const int err = errno;
+  close(fd);
+  if (addr == MAP_FAILED) {
+    throw std::system_error{err, std::generic_category(), "mmap"};
+  }
+
+  if (created) {
+    // Fresh segment is zero filled, so state reads as initializing.
+    header_ = new (addr) shm_queue_header{};
+    header_->magic = detail::shm_magic;
+    header_->capacity = static_cast<std::uint32_t>(capacity);
+    header_->slot_stride = static_cast<std::uint32_t>(stride);
+    header_->max_payload_size =
+        static_cast<std::uint32_t>(stride - sizeof(detail::shm_slot));
+    for (std::uint64_t i = 0; i < header_->capacity; ++i) {
+      new (header_->slot(i)) detail::shm_slot{{i}, 0, 0};
+    }
+    header_->state.store(detail::shm_ready, std::memory_order_release);
+  } else {
+    auto* const header = static_cast<shm_queue_header*>(addr);
+    while (header->state.load(std::memory_order_acquire) !=
+           detail::shm_ready) {
+      if (std::chrono::steady_clock::now() >= deadline) {
+        munmap(addr, mapped_size_);
+        throw std::system_error{ETIMEDOUT, std::generic_category(),
+                                "shm_task_system: segment isn't initialized"};
+      }
+      std::this_thread::sleep_for(std::chrono::milliseconds{1});
+    }
+    // Size alone doesn't tell segments of other layouts (or other programs)
+    // apart.
+    if (header->magic != detail::shm_magic || header->capacity != capacity ||
+        header->slot_stride != stride ||
+        header->max_payload_size != stride - sizeof(detail::shm_slot)) {
+      munmap(addr, mapped_size_);
+      throw std::system_error{EINVAL, std::generic_category(),
+                              "shm_task_system: segment layout mismatch"};
+    }
+    header_ = header;
+  }
+}
+
+shm_task_system::~shm_task_system() {
+  stopping_.store(true);
+  // Wake all sleeping workers; workers of other processes just go back to
+  // sleep.
+  header_->items.seq.fetch_add(1);
+  detail::futex_wake(&header_->items.seq, INT_MAX);
+  for (auto& t : workers_) {
+    t.join();
+  }
+  munmap(header_, mapped_size_);
+}
+
+void shm_task_system::remove(const std::string& name) {
+  if (shm_unlink(name.c_str()) != 0 && errno != ENOENT) {
+    detail::throw_errno("shm_unlink");
+  }
+}
+
+void shm_task_system::serve(const std::size_t thread_count) {
+  for (std::size_t i = 0; i < thread_count; ++i) {
+    workers_.emplace_back([this] { worker_loop(); });
+  }
+}
+
+std::size_t shm_task_system::queue_size() const {
+  const auto tail = header_->tail.load();
+  const auto head = header_->head.load();
+  return tail > head ? static_cast<std::size_t>(tail - head) : 0;
+}
+
+std::size_t shm_task_system::max_payload_size() const {
+  return header_->max_payload_size;
+}
+
+void shm_task_system::check_payload_size(const std::size_t size) const {
+  if (size > header_->max_payload_size) {
+    throw std::length_error{"shm_task_system: payload of " +
+                            std::to_string(size) + " bytes exceeds " +
+                            std::to_string(header_->max_payload_size)};
+  }
+}
+
+bool shm_task_system::try_run_bytes(const task_id id, const void* const payload,
+                                    const std::size_t size) {
+  assert(size <= header_->max_payload_size);
+  auto pos = header_->tail.load(std::memory_order_relaxed);
+  for (;;) {
+    auto* const slot = header_->slot(pos);
+    const auto seq = slot->seq.load(std::memory_order_acquire);
+    const auto diff =
+        static_cast<std::int64_t>(seq) - static_cast<std::int64_t>(pos);
+    if (diff == 0) {
+      if (header_->tail.compare_exchange_weak(pos, pos + 1,
+                                              std::memory_order_relaxed)) {
+        slot->id = id;
+        slot->size = static_cast<std::uint32_t>(size);
+        std::memcpy(slot->payload(), payload, size);
+        slot->seq.store(pos + 1, std::memory_order_release);
+        header_->items.notify(1);
+        return true;
+      }
+    } else if (diff < 0) {
+      return false;
+    } else {
+      pos = header_->tail.load(std::memory_order_relaxed);
+    }
+  }
+}
+
+void shm_task_system::run_bytes(const task_id id, const void* const payload,
+                                const std::size_t size) {
+  auto& space = header_->space;
+  for (;;) {
+    const auto seq = space.seq.load();
+    if (try_run_bytes(id, payload, size)) {
+      return;
+    }
+    space.waiters.fetch_add(1);
+    detail::futex_wait(&space.seq, seq);
+    space.waiters.fetch_sub(1);
+  }
+}
+
+bool shm_task_system::try_pop(task_id* const id, void* const payload,
+                              std::size_t* const size) {
+  auto pos = header_->head.load(std::memory_order_relaxed);
+  for (;;) {
+    auto* const slot = header_->slot(pos);
+    const auto seq = slot->seq.load(std::memory_order_acquire);
+    const auto diff =
+        static_cast<std::int64_t>(seq) - static_cast<std::int64_t>(pos + 1);
+    if (diff == 0) {
+      if (header_->head.compare_exchange_weak(pos, pos + 1,
+                                              std::memory_order_relaxed)) {
+        *id = slot->id;
+        *size = slot->size;
+        std::memcpy(payload, slot->payload(), slot->size);
+        slot->seq.store(pos + header_->capacity, std::memory_order_release);
+        header_->space.notify(1);
+        return true;
+      }
+    } else if (diff < 0) {
+      return false;
+    } else {
+      pos = header_->head.load(std::memory_order_relaxed);
+    }
+  }
+}
+
+void shm_task_system::worker_loop() {
+  std::vector<char> payload(header_->max_payload_size);
+  auto& items = header_->items;
+  while (!stopping_.load()) {
+    const auto seq = items.seq.load();
+    task_id id = 0;
+    std::size_t size = 0;
+    if (!try_pop(&id, payload.data(), &size)) {
+      items.waiters.fetch_add(1);
+      if (!stopping_.load()) {
+        detail::futex_wait(&items.seq, seq);
+      }
+      items.waiters.fetch_sub(1);
+      continue;
+    }
+    // Descriptors come from other processes, which may disagree on ids.
+    auto it = handlers_.find(id);
+    if (it == handlers_.end() || it->second.size != size) {
+      dropped_.fetch_add(1);
+      continue;
+    }
+    it->second.call(payload.data());
+  }
+}
+
+}  // namespace base
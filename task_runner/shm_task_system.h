@@ -0,0 +1,145 @@
+#ifndef _SHM_TASK_SYSTEM_H_
+#define _SHM_TASK_SYSTEM_H_
+
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+namespace base {
+
+namespace detail {
+
+struct shm_queue_header;
+
+}  // namespace detail
+
+// Task system shared by several processes of one host. Its queue lives in a
+// POSIX shared memory segment, so processes can submit tasks to one
+// host-sized pool of workers instead of each oversubscribing the box with a
+// pool of its own. Any process attached to the segment may submit tasks and
+// any may serve them (see serve()).
+// Pointers mean nothing in other processes, so tasks are descriptors: a task
+// type id and a trivially copyable payload. Any serving process may get any
+// task, so all of them register handlers for all task types (see
+// register_task()), and ids must mean the same in all processes.
+// Queue is a lock-free bounded ring; idle workers and submitters waiting for
+// space sleep on futexes in the segment.
+// Notice: a process dying in the middle of submission leaves its slot
+// unpublished, which stalls the queue at that slot.
+class shm_task_system {
+ public:
+  using task_id = std::uint32_t;
+
+  struct options {
+    // Number of slots in the ring, rounded up to a power of two.
+    std::size_t capacity = 1024;
+    // Largest payload a task may carry. It may come out bigger, see
+    // max_payload_size().
+    std::size_t max_payload_size = 64;
+    // How long attaching process waits for the creator to initialize the
+    // segment.
+    std::chrono::milliseconds attach_timeout{1000};
+  };
+
+ public:
+  // Creates the segment with the name (e.g. "/my_pool") or attaches to the
+  // existing one, which must have been created with the same capacity and
+  // max_payload_size.
+  // Throws std::system_error if the segment can't be created or mapped, if
+  // the segment being attached to isn't initialized within attach_timeout
+  // (e.g. its creator has died) or if its layout doesn't match options.
+  shm_task_system(const std::string& name, const options& opts);
+  explicit shm_task_system(const std::string& name)
+      : shm_task_system{name, options{}} {}
+  ~shm_task_system();
+
+  shm_task_system(const shm_task_system&) = delete;
+  shm_task_system& operator=(const shm_task_system&) = delete;
+
+  // Removes the segment name. Attached processes keep working with it.
+  static void remove(const std::string& name);
+
+  // Makes tasks of type id run handler(payload) in this process.
+  // Must be called before serve().
+  // Throws std::length_error if T doesn't fit max_payload_size().
+  template <class T>
+  void register_task(const task_id id, void (*const handler)(const T&)) {
+    static_assert(std::is_trivially_copyable_v<T>,
+                  "Task payloads are copied between processes bytewise");
+    assert(workers_.empty());
+    assert(handler != nullptr);
+    check_payload_size(sizeof(T));
+    handlers_[id] = handler_entry{
+        [handler](const void* const payload) {
+          T value;
+          std::memcpy(&value, payload, sizeof(T));
+          handler(value);
+        },
+        sizeof(T)};
+  }
+
+  // Queues task of type id. Waits for space if the queue is full.
+  // Throws std::length_error if T doesn't fit max_payload_size().
+  template <class T>
+  void run(const task_id id, const T& payload) {
+    static_assert(std::is_trivially_copyable_v<T>);
+    check_payload_size(sizeof(T));
+    run_bytes(id, &payload, sizeof(T));
+  }
+
+  // Queues task of type id unless the queue is full.
+  // Throws std::length_error if T doesn't fit max_payload_size().
+  template <class T>
+  bool try_run(const task_id id, const T& payload) {
+    static_assert(std::is_trivially_copyable_v<T>);
+    check_payload_size(sizeof(T));
+    return try_run_bytes(id, &payload, sizeof(T));
+  }
+
+  // Starts thread_count workers in this process executing tasks from the
+  // shared queue. Workers stop on destruction.
+  void serve(std::size_t thread_count);
+
+  // Number of tasks in the queue.
+  std::size_t queue_size() const;
+
+  // Largest payload tasks of the segment may carry.
+  std::size_t max_payload_size() const;
+
+  // Number of tasks workers of this process have dropped, since there was
+  // no handler for their id or their payload size didn't match the handler.
+  // Usually means processes disagree on task ids.
+  std::size_t dropped_count() const { return dropped_.load(); }
+
+ private:
+  struct handler_entry {
+    std::function<void(const void*)> call;
+    std::size_t size = 0;
+  };
+
+  void check_payload_size(std::size_t size) const;
+  void run_bytes(task_id id, const void* payload, std::size_t size);
+  bool try_run_bytes(task_id id, const void* payload, std::size_t size);
+  bool try_pop(task_id* id, void* payload, std::size_t* size);
+  void worker_loop();
+
+ private:
+  detail::shm_queue_header* header_ = nullptr;
+  std::size_t mapped_size_ = 0;
+  std::unordered_map<task_id, handler_entry> handlers_;
+  std::atomic<bool> stopping_ = false;
+  std::atomic<std::size_t> dropped_ = 0;
+  std::vector<std::thread> workers_;
+};
+
+}  // namespace base
+
+#endif  // _SHM_TASK_SYSTEM_H_
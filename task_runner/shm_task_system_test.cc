@@ -0,0 +1,217 @@
+#include "shm_task_system.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <thread>
+
+#include "catch2/catch_all.hpp"
+
+namespace {
+
+struct add_task {
+  int value;
+};
+
+// Sums are kept in anonymous shared memory, so processes serving tasks can
+// report to the test.
+struct shared_counters {
+  std::atomic<long> sum;
+  std::atomic<int> executed;
+};
+
+shared_counters* counters = nullptr;
+
+void add(const add_task& task) {
+  counters->sum += task.value;
+  ++counters->executed;
+}
+
+constexpr base::shm_task_system::task_id add_id = 1;
+
+std::string segment_name() {
+  return "/task_runner_test_" + std::to_string(getpid());
+}
+
+bool wait_for(int executed) {
+  const auto deadline =
+      std::chrono::steady_clock::now() + std::chrono::seconds{30};
+  while (counters->executed < executed) {
+    if (std::chrono::steady_clock::now() > deadline) {
+      return false;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds{1});
+  }
+  return true;
+}
+
+}  // namespace
+
+TEST_CASE("shm_task_system_test", "[shm_task_system]") {
+  void* const mem = mmap(nullptr, sizeof(shared_counters),
+                         PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS,
+                         -1, 0);
+  REQUIRE(mem != MAP_FAILED);
+  counters = new (mem) shared_counters{};
+  const auto name = segment_name();
+  base::shm_task_system::remove(name);
+  constexpr int total = 2000;
+
+  SECTION("Tasks submitted by other processes are served") {
+    // Small queue makes submitters wait for space.
+    base::shm_task_system system{name, {/*capacity=*/16}};
+    const pid_t child = fork();
+    REQUIRE(child >= 0);
+    if (child == 0) {
+      base::shm_task_system submitter{name, {/*capacity=*/16}};
+      for (int i = 1; i <= total; ++i) {
+        submitter.run(add_id, add_task{i});
+      }
+      _exit(0);
+    }
+    system.register_task(add_id, add);
+    system.serve(2);
+    REQUIRE(wait_for(total));
+    REQUIRE(counters->sum == static_cast<long>(total) * (total + 1) / 2);
+    int status = 0;
+    REQUIRE(waitpid(child, &status, 0) == child);
+    REQUIRE(WIFEXITED(status));
+  }
+
+  SECTION("Several processes share one pool") {
+    base::shm_task_system system{name};
+    pid_t children[2];
+    for (auto& child : children) {
+      child = fork();
+      REQUIRE(child >= 0);
+      if (child == 0) {
+        {
+          base::shm_task_system worker{name};
+          worker.register_task(add_id, add);
+          worker.serve(1);
+          wait_for(total);
+        }
+        _exit(0);
+      }
+    }
+    for (int i = 1; i <= total; ++i) {
+      system.run(add_id, add_task{i});
+    }
+    for (auto child : children) {
+      int status = 0;
+      REQUIRE(waitpid(child, &status, 0) == child);
+      REQUIRE(WIFEXITED(status));
+    }
+    REQUIRE(counters->executed == total);
+    REQUIRE(counters->sum == static_cast<long>(total) * (total + 1) / 2);
+  }
+
+  SECTION("try_run fails on full queue") {
+    base::shm_task_system system{name, {/*capacity=*/4}};
+    for (int i = 0; i < 4; ++i) {
+      REQUIRE(system.try_run(add_id, add_task{i}));
+    }
+    REQUIRE_FALSE(system.try_run(add_id, add_task{4}));
+    REQUIRE(system.queue_size() == 4);
+  }
+
+  SECTION("Payloads must fit the limit") {
+    struct big_task {
+      char data[256];
+    };
+    base::shm_task_system system{name, {/*capacity=*/4,
+                                        /*max_payload_size=*/8}};
+    base::shm_task_system attached{name, {/*capacity=*/4,
+                                          /*max_payload_size=*/8}};
+    REQUIRE(attached.max_payload_size() == system.max_payload_size());
+    REQUIRE(attached.max_payload_size() < sizeof(big_task));
+    REQUIRE_THROWS_AS(
+        attached.register_task(add_id, +[](const big_task&) {}),
+        std::length_error);
+    REQUIRE_THROWS_AS(attached.run(add_id, big_task{}), std::length_error);
+    REQUIRE_THROWS_AS(attached.try_run(add_id, big_task{}),
+                      std::length_error);
+    REQUIRE(system.queue_size() == 0);
+  }
+
+  SECTION("Attaching checks the layout") {
+    base::shm_task_system system{name, {/*capacity=*/4,
+                                        /*max_payload_size=*/8}};
+    const auto attach = [&](const std::size_t capacity,
+                            const std::size_t max_payload_size) {
+      base::shm_task_system attached{name, {capacity, max_payload_size}};
+    };
+    REQUIRE_THROWS_AS(attach(8, 8), std::system_error);
+    REQUIRE_THROWS_AS(attach(4, 1024), std::system_error);
+  }
+
+  SECTION("Attaching gives up on segments never initialized") {
+    const auto make_stale = [&](const off_t size) {
+      const int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+      REQUIRE(fd >= 0);
+      REQUIRE(ftruncate(fd, size) == 0);
+      close(fd);
+    };
+    const auto attach = [&] {
+      try {
+        base::shm_task_system attached{
+            name, {/*capacity=*/4, /*max_payload_size=*/8,
+                   /*attach_timeout=*/std::chrono::milliseconds{10}}};
+      } catch (const std::system_error& e) {
+        return e.code().value();
+      }
+      return 0;
+    };
+
+    off_t size = 0;
+    {
+      base::shm_task_system system{name, {/*capacity=*/4,
+                                          /*max_payload_size=*/8}};
+      const int fd = shm_open(name.c_str(), O_RDONLY, 0600);
+      REQUIRE(fd >= 0);
+      struct stat st {};
+      REQUIRE(fstat(fd, &st) == 0);
+      close(fd);
+      size = st.st_size;
+    }
+    base::shm_task_system::remove(name);
+
+    // Creator died before sizing the segment.
+    make_stale(0);
+    REQUIRE(attach() == ETIMEDOUT);
+    base::shm_task_system::remove(name);
+
+    // Creator died before initializing the header.
+    make_stale(size);
+    REQUIRE(attach() == ETIMEDOUT);
+  }
+
+  SECTION("Unknown tasks are dropped") {
+    struct other_task {
+      int value;
+      int extra;
+    };
+    base::shm_task_system system{name};
+    system.register_task(add_id, add);
+    // Unknown id, then known id with a wrong payload.
+    system.run(add_id + 1, add_task{1});
+    system.run(add_id, other_task{2, 3});
+    system.run(add_id, add_task{4});
+    system.serve(1);
+    REQUIRE(wait_for(1));
+    REQUIRE(system.dropped_count() == 2);
+    REQUIRE(counters->sum == 4);
+  }
+
+  base::shm_task_system::remove(name);
+  munmap(mem, sizeof(shared_counters));
+}
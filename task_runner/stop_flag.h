@@ -0,0 +1,43 @@
+#ifndef _STOP_FLAG_H_
+#define _STOP_FLAG_H_
+
+#include <atomic>
+
+namespace base {
+
+// Flag telling work done for a race (see task_graph::when_any) that its
+// result isn't needed anymore. Like the tenant, task runners pass the flag of
+// the thread posting a task on to the task (see task_runner_base), so every
+// task of a racer's subtree sees the flag of that racer.
+
+namespace detail {
+
+inline thread_local const std::atomic<bool>* current_stop_flag = nullptr;
+
+}  // namespace detail
+
+// Stop flag of the race the calling thread works for, nullptr outside races.
+inline const std::atomic<bool>* current_stop_flag() {
+  return detail::current_stop_flag;
+}
+
+// Makes flag current for the calling thread while alive.
+class scoped_stop_flag {
+ public:
+  explicit scoped_stop_flag(const std::atomic<bool>* const flag)
+      : previous_{detail::current_stop_flag} {
+    detail::current_stop_flag = flag;
+  }
+
+  ~scoped_stop_flag() { detail::current_stop_flag = previous_; }
+
+  scoped_stop_flag(const scoped_stop_flag&) = delete;
+  scoped_stop_flag& operator=(const scoped_stop_flag&) = delete;
+
+ private:
+  const std::atomic<bool>* const previous_;
+};
+
+}  // namespace base
+
+#endif  // _STOP_FLAG_H_
@@ -0,0 +1,158 @@
+#ifndef _STRAND_H_
+#define _STRAND_H_
+
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <functional>
+#include <thread>
+#include <tuple>
+#include <utility>
+
+#include "unique_function.h"
+
+namespace base {
+
+// Serial executor on top of a task runner: tasks posted to a strand run one
+// at a time in FIFO order, on whatever workers of the task runner, so state
+// touched only from tasks of one strand needs no locks.
+// Submission never blocks: tasks go to a lock-free MPSC queue, and the
+// submitter finding the strand idle schedules a drain on the task runner.
+// The drain executes up to max_batch tasks, then yields its worker by
+// rescheduling itself if there are more.
+// Strand is a task runner itself, so on(&strand, node) executes a subtree
+// serialized with everything else on the strand.
+// Task runner must outlive the strand.
+template <class TaskRunner>
+class strand {
+ public:
+  explicit strand(TaskRunner* const tr, const std::size_t max_batch = 64)
+      : tr_{tr}, max_batch_{max_batch}, head_{&stub_}, tail_{&stub_} {
+    assert(tr_ != nullptr);
+    assert(max_batch_ > 0);
+  }
+
+  // Waits for posted tasks to finish.
+  ~strand() {
+    while (size_.load() != 0) {
+      std::this_thread::yield();
+    }
+  }
+
+  strand(const strand&) = delete;
+  strand& operator=(const strand&) = delete;
+
+  template <class F, class... Args>
+  void run(F&& f, Args&&... args) {
+    auto* const n = new node{};
+    if constexpr (sizeof...(Args) == 0) {
+      n->f = std::forward<F>(f);
+    } else {
+      n->f = [f = std::forward<F>(f),
+              args = std::make_tuple(std::forward<Args>(args)...)]() mutable {
+        std::apply(std::move(f), std::move(args));
+      };
+    }
+    push(n);
+    if (size_.fetch_add(1) == 0) {
+      schedule();
+    }
+  }
+
+  // Whether calling thread executes tasks of this strand right now.
+  bool running_in_this_thread() const { return current_ == this; }
+
+  std::size_t current_worker_index() const {
+    return tr_->current_worker_index();
+  }
+
+  std::size_t max_worker_count() const { return tr_->max_worker_count(); }
+
+ private:
+  struct node {
+    std::atomic<node*> next = nullptr;
+    unique_function<void()> f;
+  };
+
+  // Vyukov's intrusive MPSC queue: producers swing tail_, the single
+  // consumer walks from head_. stub_ keeps the queue never empty.
+  void push(node* const n) {
+    n->next.store(nullptr, std::memory_order_relaxed);
+    node* const prev = tail_.exchange(n, std::memory_order_acq_rel);
+    prev->next.store(n, std::memory_order_release);
+  }
+
+  // Takes the oldest node. Must only be called when size_ says there is one.
+  node* pop() {
+    for (;;) {
+      node* head = head_;
+      node* next = head->next.load(std::memory_order_acquire);
+      if (head == &stub_) {
+        if (next == nullptr) {
+          // Producer has swung tail_ but hasn't linked its node yet.
+          std::this_thread::yield();
+          continue;
+        }
+        head_ = next;
+        head = next;
+        next = next->next.load(std::memory_order_acquire);
+      }
+      if (next != nullptr) {
+        head_ = next;
+        return head;
+      }
+      if (head != tail_.load(std::memory_order_acquire)) {
+        // Producer of the next node is in the middle of push().
+        std::this_thread::yield();
+        continue;
+      }
+      // head is the last node: put stub_ behind it to be able to take it.
+      push(&stub_);
+      next = head->next.load(std::memory_order_acquire);
+      if (next != nullptr) {
+        head_ = next;
+        return head;
+      }
+      std::this_thread::yield();
+    }
+  }
+
+  void schedule() {
+    tr_->run([this] { drain(); });
+  }
+
+  void drain() {
+    const strand* const previous = current_;
+    current_ = this;
+    for (std::size_t i = 0; i < max_batch_; ++i) {
+      node* const n = pop();
+      n->f();
+      delete n;
+      if (size_.fetch_sub(1) == 1) {
+        current_ = previous;
+        return;
+      }
+    }
+    current_ = previous;
+    // Let other tasks of the task runner go.
+    schedule();
+  }
+
+ private:
+  // Strand whose tasks the calling thread executes.
+  static inline thread_local const strand* current_ = nullptr;
+
+  TaskRunner* const tr_;
+  const std::size_t max_batch_;
+  // Tasks posted but not yet finished, the one making it non-zero schedules
+  // the drain.
+  std::atomic<std::size_t> size_ = 0;
+  node stub_;
+  // Owned by the drain.
+  node* head_;
+  std::atomic<node*> tail_;
+};
+
+}  // namespace base
+
+#endif  // _STRAND_H_
@@ -0,0 +1,92 @@
+#include "strand.h"
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "catch2/catch_all.hpp"
+#include "event.h"
+#include "task_graph.h"
+#include "task_runner.h"
+
+namespace tg = base::task_graph;
+
+TEST_CASE("strand_test", "[strand]") {
+  base::simple_task_runner tr;
+
+  SECTION("Tasks run one at a time in FIFO order") {
+    base::strand<base::simple_task_runner> s{&tr, /*max_batch=*/4};
+    constexpr int total = 10000;
+    std::vector<int> order;
+    std::atomic<bool> running = false;
+    bool overlapped = false;
+    base::manual_event done;
+    for (int i = 0; i < total; ++i) {
+      s.run(
+          [&](int val) {
+            overlapped |= running.exchange(true);
+            order.push_back(val);
+            running = false;
+            if (val == total - 1) {
+              done.notify();
+            }
+          },
+          i);
+    }
+    done.wait();
+    REQUIRE_FALSE(overlapped);
+    REQUIRE(order.size() == total);
+    for (int i = 0; i < total; ++i) {
+      REQUIRE(order[i] == i);
+    }
+  }
+
+  SECTION("Concurrent submitters don't lose tasks") {
+    base::strand<base::simple_task_runner> s{&tr};
+    constexpr int submitters = 4;
+    constexpr int per_submitter = 5000;
+    // Guarded by the strand only.
+    long sum = 0;
+    int executed = 0;
+    base::manual_event done;
+    std::vector<std::thread> threads;
+    for (int t = 0; t < submitters; ++t) {
+      threads.emplace_back([&] {
+        for (int i = 1; i <= per_submitter; ++i) {
+          s.run([&, i] {
+            sum += i;
+            if (++executed == submitters * per_submitter) {
+              done.notify();
+            }
+          });
+        }
+      });
+    }
+    for (auto& t : threads) {
+      t.join();
+    }
+    done.wait();
+    REQUIRE(sum == submitters * (per_submitter * (per_submitter + 1L) / 2));
+  }
+
+  SECTION("Subtrees execute on the strand") {
+    base::strand<base::simple_task_runner> s{&tr};
+    // Branches touch the vector without a lock.
+    std::vector<int> v;
+    bool on_strand = false;
+    auto node = tg::when_all(
+        tg::on(&s,
+               [&](int val) {
+                 on_strand = s.running_in_this_thread();
+                 v.push_back(val);
+               }),
+        tg::on(&s, [&](int val) { v.push_back(val * 2); }),
+        tg::on(&s, [&](int val) { v.push_back(val * 3); }));
+    tg::sync_execute(&tr, &node, [] {}, 1);
+    std::sort(v.begin(), v.end());
+    REQUIRE(v == std::vector<int>{1, 2, 3});
+    REQUIRE(on_strand);
+    REQUIRE_FALSE(s.running_in_this_thread());
+  }
+}
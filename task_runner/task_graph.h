@@ -1,48 +1,105 @@
 #ifndef _TASK_GRAPH_H_
 #define _TASK_GRAPH_H_
 
+#include <algorithm>
+#include <array>
 #include <atomic>
 #include <cassert>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
 #include <functional>
 #include <future>
+#include <memory>
+#include <mutex>
+#include <new>
 #include <optional>
+#include <stdexcept>
+#include <tuple>
 #include <type_traits>
+#include <utility>
+#include <variant>
+#include <vector>
 
+#include "blocking.h"
+#include "cache_line.h"
+#include "concurrent_cache.h"
 #include "event.h"
 #include "meta/type_pack.h"
+#include "stop_flag.h"
+#include "tenant.h"
+#include "timer.h"
+#include "unique_function.h"
+#include "versioned_cell.h"
 
 namespace base::task_graph {
 
 template <class Tree, class... Args>
 constexpr auto graph_result_pack = Tree::template result_pack<Args...>;
 
+template <class F, class... Args>
+struct memo_leaf;
+
+// Calls f for every direct subnode of the node. Nodes having subnodes provide
+// their own overloads.
+template <class Node, class F>
+void for_each_child(Node&, F&&) {}
+
 // ==================== leaf ====================
 
+namespace detail {
+
+// Invokes f with provided arguments if it is possible, otherwise invokes it
+// with copies of them. Lets invocables taking parameters by value or by rvalue
+// reference to be used with arguments borrowed by const reference.
+template <class F, class... Args>
+decltype(auto) invoke_leaf(F& f, Args&&... args) {
+  if constexpr (std::is_invocable_v<F&, Args&&...>) {
+    return std::invoke(f, std::forward<Args>(args)...);
+  } else {
+    return std::invoke(f, std::decay_t<Args>(args)...);
+  }
+}
+
+template <class F, class... Args>
+using leaf_result_t =
+    decltype(invoke_leaf(std::declval<F&>(), std::declval<Args>()...));
+
+}  // namespace detail
+
 // Simplest execution node. Calls provided invocable on its execution and
 // forwards result to Then.
+// Parameters are forwarded to the invocable, so it receives moved values along
+// seq chains and borrowed ones inside all.
 template <class F>
 struct leaf : F {
   template <class... Args>
   static constexpr auto result_pack =
-      std::conditional_t<std::is_void_v<std::invoke_result_t<F, Args...>>,
+      std::conditional_t<std::is_void_v<detail::leaf_result_t<F, Args...>>,
                          tp::empty_pack,
-                         type_pack<std::invoke_result_t<F, Args...>>>{};
+                         type_pack<detail::leaf_result_t<F, Args...>>>{};
 
   leaf(F f) : F{std::move(f)} {}
 
   template <class TaskRunner, class Then, class... Args>
-  void execute(TaskRunner* const tr, Then then, Args... args) & {
+  void execute(TaskRunner* const tr, Then then, Args&&... args) & {
     assert(tr != nullptr);
+    auto& f = static_cast<F&>(*this);
     if constexpr (tp::empty(result_pack<Args...>)) {
-      std::invoke(*this, std::move(args)...);
+      detail::invoke_leaf(f, std::forward<Args>(args)...);
       std::invoke(then);
     } else {
-      std::invoke(then, std::invoke(*this, std::move(args)...));
+      std::invoke(then, detail::invoke_leaf(f, std::forward<Args>(args)...));
     }
   }
 
   template <class Then>
   auto then(Then f);
+
+  template <class... Args>
+  auto memoize(std::size_t capacity);
 };
 
 template <class F>
@@ -50,11 +107,174 @@ auto make_leaf(F f) {
   return leaf{std::move(f)};
 }
 
+// ==================== memo_leaf ====================
+
+// Memoizing execution node. Works like leaf, but results of F are cached by
+// arguments of types Args... in a cache shared between all executions and all
+// copies of the node. Concurrent executions with equal arguments are
+// deduplicated: only one of them invokes F, the others are resumed with its
+// result as continuations on the task runner.
+template <class F, class... Args>
+struct memo_leaf : F {
+  using key_type = std::tuple<std::decay_t<Args>...>;
+  using value_type =
+      std::decay_t<std::invoke_result_t<F&, const std::decay_t<Args>&...>>;
+  using cache_type = concurrent_lru_cache<key_type, value_type, tuple_hash>;
+
+  static_assert(!std::is_void_v<value_type>,
+                "There is nothing to memoize for void invocables");
+
+  template <class... Ts>
+  static constexpr auto result_pack = type_pack_v<value_type>;
+
+  memo_leaf(F f, std::size_t capacity)
+      : F{std::move(f)}, cache_{std::make_shared<cache_type>(capacity)} {}
+
+  template <class TaskRunner, class Then, class... Ts>
+  void execute(TaskRunner* const tr, Then then, Ts&&... args) & {
+    assert(tr != nullptr);
+    static_assert(sizeof...(Ts) == sizeof...(Args));
+    cache_->get_or_compute(
+        tr, key_type{std::forward<Ts>(args)...},
+        [this](const key_type& key) {
+          return std::apply(static_cast<F&>(*this), key);
+        },
+        std::move(then));
+  }
+
+  template <class Then>
+  auto then(Then f);
+
+  std::shared_ptr<cache_type> cache_;
+};
+
+template <class... Args, class F>
+auto make_memo_leaf(F f, std::size_t capacity) {
+  return memo_leaf<F, Args...>{std::move(f), capacity};
+}
+
+// ==================== batched_leaf ====================
+
+// When batched_leaf dispatches collected executions.
+struct batch_options {
+  // Batch is dispatched as soon as it has this many inputs.
+  std::size_t max_size = 64;
+  // Otherwise it is dispatched after this delay since its first input.
+  std::chrono::steady_clock::duration window = std::chrono::milliseconds{1};
+};
+
+// Coalescing execution node. Takes a single parameter of type In, but F is
+// invoked with a batch of inputs (const std::vector<In>&) collected from
+// concurrent executions of the node and all its copies, and returns a
+// std::vector of results in the same order. Results are fanned back to
+// every execution's Then as separate tasks on its task runner.
+// Batch is dispatched when it gets full (by the execution filling it) or when
+// the window since its first input expires (by a task on the task runner of
+// that first execution), whatever happens first.
+// Turns per-item overhead into per-batch one for vectorized math or for
+// syscalls taking many items.
+template <class F, class In>
+struct batched_leaf {
+  using results_type = std::invoke_result_t<F&, const std::vector<In>&>;
+  using value_type = typename results_type::value_type;
+
+  template <class... Args>
+  static constexpr auto result_pack = type_pack_v<value_type>;
+
+  batched_leaf(F f, const batch_options& opts)
+      : state_{std::make_shared<state_type>(std::move(f), opts)} {
+    assert(opts.max_size > 0);
+    assert(opts.max_size == 1 || opts.window.count() > 0);
+  }
+
+  template <class TaskRunner, class Then, class Arg>
+  void execute(TaskRunner* const tr, Then then, Arg&& arg) & {
+    assert(tr != nullptr);
+    unique_function<void(value_type)> resume =
+        [tr, then = std::move(then)](value_type result) mutable {
+          tr->run(std::move(then), std::move(result));
+        };
+
+    std::unique_lock guard{state_->mtx};
+    state_->inputs.emplace_back(std::forward<Arg>(arg));
+    state_->waiters.push_back(std::move(resume));
+    if (state_->inputs.size() >= state_->opts.max_size) {
+      auto batch = state_->take();
+      guard.unlock();
+      dispatch(*state_, std::move(batch));
+      return;
+    }
+    if (state_->inputs.size() == 1) {
+      timer_thread::shared().post_after(
+          state_->opts.window,
+          [tr, state = state_, generation = state_->generation] {
+            std::unique_lock guard{state->mtx};
+            if (state->generation != generation) {
+              // Dispatched by size, the execution that has armed the timer
+              // (and its task runner) may be gone.
+              return;
+            }
+            // The batch holds the execution that has armed the timer, so its
+            // task runner is alive till the batch is dispatched.
+            auto batch = state->take();
+            guard.unlock();
+            tr->run([state, batch = std::move(batch)]() mutable {
+              dispatch(*state, std::move(batch));
+            });
+          });
+    }
+  }
+
+  template <class Then>
+  auto then(Then f);
+
+ private:
+  struct batch_type {
+    std::vector<In> inputs;
+    std::vector<unique_function<void(value_type)>> waiters;
+  };
+
+  struct state_type {
+    state_type(F f, const batch_options& opts) : f{std::move(f)}, opts{opts} {}
+
+    // Takes collected batch and starts the next one.
+    batch_type take() {
+      ++generation;
+      return batch_type{std::move(inputs), std::move(waiters)};
+    }
+
+    F f;
+    const batch_options opts;
+    std::mutex mtx;
+    std::vector<In> inputs;
+    std::vector<unique_function<void(value_type)>> waiters;
+    // Number of batches taken so far. Tells timers whether their batch has
+    // been dispatched already.
+    std::uint64_t generation = 0;
+  };
+
+  static void dispatch(state_type& state, batch_type batch) {
+    auto results = std::invoke(state.f, std::as_const(batch.inputs));
+    assert(results.size() == batch.waiters.size());
+    for (std::size_t i = 0; i < batch.waiters.size(); ++i) {
+      batch.waiters[i](std::move(results[i]));
+    }
+  }
+
+  std::shared_ptr<state_type> state_;
+};
+
+template <class In, class F>
+auto make_batched_leaf(F f, const batch_options& opts = {}) {
+  return batched_leaf<F, In>{std::move(f), opts};
+}
+
 // ==================== seq ====================
 
 // Continuation execution node. Executes second subnode right after first one.
 // On execution first subnode will use provided parameters.
-// Second subnode is executed with first subnode's result.
+// Second subnode is executed with first subnode's result, which is forwarded
+// without copies.
 // Results are represented by results of second subnode execution.
 template <class A, class B>
 struct seq : A, B {
@@ -68,15 +288,16 @@ struct seq : A, B {
   seq(A&& a, B&& b) : A{std::move(a)}, B{std::move(b)} {}
 
   template <class TaskRunner, class Then, class... Args>
-  void execute(TaskRunner* const tr, Then then, Args... args) & {
+  void execute(TaskRunner* const tr, Then then, Args&&... args) & {
     assert(tr != nullptr);
     A::execute(
         tr,
         [tr, f = static_cast<B*>(this),
-         then = std::move(then)](auto... a_args) mutable {
-          f->execute(tr, std::move(then), std::move(a_args)...);
+         then = std::move(then)](auto&&... a_args) mutable {
+          f->execute(tr, std::move(then),
+                     std::forward<decltype(a_args)>(a_args)...);
         },
-        std::move(args)...);
+        std::forward<Args>(args)...);
   }
 
   template <class Then>
@@ -88,38 +309,339 @@ auto make_seq(A a, B b) {
   return seq{std::move(a), std::move(b)};
 }
 
+template <class A, class B, class F>
+void for_each_child(seq<A, B>& node, F&& f) {
+  std::invoke(f, static_cast<A&>(node));
+  std::invoke(f, static_cast<B&>(node));
+}
+
 // ==================== all ====================
 
 namespace detail {
 
-template <std::size_t n, std::size_t... is, std::size_t nxt,
-          std::size_t... rest>
-constexpr auto iota(std::index_sequence<is...>,
-                    std::index_sequence<nxt, rest...>) {
-  if constexpr (sizeof...(rest) == 0) {
-    return std::index_sequence<is..., n>{};
+using base::detail::cache_line_size;
+
+// Upper bound of the memory join state of all may spend on padding result
+// slots of its branches to cache lines.
+inline constexpr std::size_t max_padded_results_size = 4096;
+
+// Storage for a single result of all's subnode. It is filled exactly once by
+// the subnode and consumed exactly once by the join, so unlike std::optional
+// it doesn't need to track whether it holds a value.
+template <class T>
+class result_slot {
+ public:
+  template <class U>
+  void emplace(U&& value) {
+    new (&storage_) T(std::forward<U>(value));
+  }
+
+  T& get() { return *std::launder(reinterpret_cast<T*>(&storage_)); }
+
+  void destroy() { get().~T(); }
+
+ private:
+  alignas(T) unsigned char storage_[sizeof(T)];
+};
+
+template <std::size_t I, class T, std::size_t Align>
+struct indexed_result_slot {
+  alignas(std::max(Align, alignof(T))) result_slot<T> slot;
+};
+
+template <class IS, class Aligns, class... Ts>
+struct result_slots;
+
+// Flat replacement of std::tuple<result_slot<Ts>...>. Slot lookup is a
+// single overload resolution (see slot_at()), so wide fan-outs don't pay for
+// the recursive instantiations of std::tuple and std::get.
+template <std::size_t... Is, std::size_t... Aligns, class... Ts>
+struct result_slots<std::index_sequence<Is...>, std::index_sequence<Aligns...>,
+                    Ts...> : indexed_result_slot<Is, Ts, Aligns>... {};
+
+template <std::size_t I, class T, std::size_t Align>
+result_slot<T>& slot_at(indexed_result_slot<I, T, Align>& slot) {
+  return slot.slot;
+}
+
+template <class... Ts>
+constexpr std::size_t results_size(type_pack<Ts...>) {
+  return (std::size_t{0} + ... + sizeof(Ts));
+}
+
+// Alignment of every result slot of all. Results of one branch are written by
+// one core, so they are packed together and only the first of them may start
+// a new cache line. Branches with results of at least a cache line get lines
+// of their own. Tiny ones do as well, unless the fan-out is so wide that
+// padding would exceed max_padded_results_size: then a few neighbouring
+// branches share a line.
+template <std::size_t ResultCount, std::size_t BranchCount>
+constexpr std::array<std::size_t, ResultCount> result_aligns(
+    const std::array<std::size_t, BranchCount>& starts,
+    const std::array<std::size_t, BranchCount>& counts,
+    const std::array<std::size_t, BranchCount>& sizes) {
+  std::array<std::size_t, ResultCount> aligns{};
+  std::size_t padded = 0;
+  for (std::size_t b = 0; b < BranchCount; ++b) {
+    padded += counts[b] != 0 ? 1 : 0;
+  }
+  const std::size_t per_line =
+      std::max<std::size_t>(1, (padded * cache_line_size +
+                                max_padded_results_size - 1) /
+                                   max_padded_results_size);
+  std::size_t in_line = 0;
+  bool after_big = false;
+  for (std::size_t b = 0; b < BranchCount; ++b) {
+    for (std::size_t i = 0; i < counts[b]; ++i) {
+      aligns[starts[b] + i] = 1;
+    }
+    if (counts[b] == 0) {
+      continue;
+    }
+    const bool big = sizes[b] >= cache_line_size;
+    if (big || after_big) {
+      in_line = 0;
+    }
+    if (in_line == 0) {
+      aligns[starts[b]] = cache_line_size;
+    }
+    in_line = big ? 0 : (in_line + 1) % per_line;
+    after_big = big;
+  }
+  return aligns;
+}
+
+// Part of all's join state visible to its subnodes. Knows nothing about types
+// of the whole node, so per-subnode code doesn't get instantiated (and
+// mangled) with them: it keeps compile time of wide fan-outs linear.
+struct join_counter {
+  using finish_type = void (*)(join_counter*);
+
+  join_counter(const int count, const finish_type finish)
+      : left{count}, finish{finish} {}
+
+  // Called by every subnode when it is done. The last one finishes the join.
+  void arrive() {
+    if (left.fetch_sub(1) == 1) {
+      finish(this);
+    }
+  }
+
+  alignas(cache_line_size) std::atomic<int> left;
+  const finish_type finish;
+};
+
+// Continuation of all's subnode. Stores its results to the slots of the join
+// state and arrives at the join.
+template <class... Slots>
+struct branch_then {
+  template <class... Results>
+  void operator()(Results&&... results) {
+    static_assert(sizeof...(Results) == sizeof...(Slots));
+    emplace(std::index_sequence_for<Slots...>{},
+            std::forward<Results>(results)...);
+    join->arrive();
+  }
+
+  template <std::size_t... Is, class... Results>
+  void emplace(std::index_sequence<Is...>, Results&&... results) {
+    (..., static_cast<Slots*>(slots[Is])->emplace(
+              std::forward<Results>(results)));
+  }
+
+  join_counter* join;
+  // Plain array instead of std::tuple keeps per-subnode instantiations cheap.
+  void* slots[sizeof...(Slots) + 1];
+};
+
+// Task executing one subnode of all with parameters borrowed from the join
+// state.
+template <class TaskRunner, class F, class ArgsTuple, class Then>
+struct branch_task {
+  void operator()() {
+    call(std::make_index_sequence<std::tuple_size_v<ArgsTuple>>{});
+  }
+
+  template <std::size_t... Is>
+  void call(std::index_sequence<Is...>) {
+    f->execute(tr, std::move(then), std::get<Is>(*args)...);
+  }
+
+  TaskRunner* tr;
+  F* f;
+  const ArgsTuple* args;
+  Then then;
+};
+
+// Cost of a single task all spends on its cheap subnodes, see cost_hint().
+// Large enough to amortize scheduling, small enough to keep load balanced.
+inline constexpr std::chrono::nanoseconds coarsening_grain =
+    std::chrono::microseconds{20};
+
+// Whether T carries an estimate of its cost. Specialized for exact node
+// types, so nodes deriving from hinted ones don't inherit their hints.
+template <class T>
+struct has_cost_hint : std::false_type {};
+
+template <class T>
+constexpr bool has_cost_hint_v = has_cost_hint<T>::value;
+
+// Expected execution time of node, unknown costs count as infinite.
+template <class Node>
+std::chrono::nanoseconds cost_hint(const Node& node) {
+  if constexpr (has_cost_hint_v<Node>) {
+    return node.cost();
   } else {
-    return iota<n + nxt>(std::index_sequence<is..., n>{},
-                         std::index_sequence<rest...>{});
+    return std::chrono::nanoseconds::max();
   }
 }
 
-static_assert(
-    std::is_same_v<decltype(iota<0>({}, std::index_sequence<3, 6, 9, 1>{})),
-                   std::index_sequence<0, 3, 9, 18>>);
+// Task runner wrappers living only till the node they are passed to calls
+// Then (see profiled) specialize it to expose the task runner they wrap.
+template <class TaskRunner>
+struct runner_unwrapper {
+  static TaskRunner* get(TaskRunner* const tr) { return tr; }
+};
+
+// Task runner that may be used after the node tr is passed to has called
+// Then, e.g. by losers of any.
+template <class TaskRunner>
+auto* underlying_runner(TaskRunner* const tr) {
+  return runner_unwrapper<TaskRunner>::get(tr);
+}
+
+// Task runner branches of all are executed on. Placement proxies (see
+// distributed) replace it with the one they wrap.
+template <class TaskRunner>
+TaskRunner* branch_runner(TaskRunner* const tr) {
+  return tr;
+}
+
+// Schedules the task executing a branch of all.
+template <class TaskRunner, class ArgsTuple, class Task>
+void post_branch(TaskRunner* const tr, std::size_t, const ArgsTuple&,
+                 Task&& task) {
+  tr->run(std::forward<Task>(task));
+}
+
+// Task runner of distributed: tells all where to put its branches.
+template <class TaskRunner, class Policy>
+struct shard_placement {
+  TaskRunner* base;
+  const Policy* policy;
+};
+
+template <class TaskRunner, class Policy>
+TaskRunner* branch_runner(shard_placement<TaskRunner, Policy>* const tr) {
+  return tr->base;
+}
+
+template <class TaskRunner, class Policy, class ArgsTuple, class Task>
+void post_branch(shard_placement<TaskRunner, Policy>* const tr,
+                 const std::size_t branch, const ArgsTuple& args,
+                 Task&& task) {
+  auto* const base = tr->base;
+  const std::size_t shard_count = base->shard_count();
+  const std::size_t shard = std::apply(
+      [&](const auto&... args) {
+        return tr->policy->shard(branch, shard_count,
+                                 base->current_worker_index(), args...);
+      },
+      args);
+  assert(shard < shard_count);
+  base->run_on(shard, std::forward<Task>(task));
+}
+
+// Task runner of critical_path: tells all to post its costliest branches
+// first.
+template <class TaskRunner>
+struct longest_first {
+  TaskRunner* base;
+};
+
+template <class T>
+struct is_longest_first : std::false_type {};
+
+template <class TaskRunner>
+struct is_longest_first<longest_first<TaskRunner>> : std::true_type {};
+
+template <class T>
+constexpr bool longest_first_v = is_longest_first<T>::value;
+
+template <class TaskRunner>
+TaskRunner* branch_runner(longest_first<TaskRunner>* const tr) {
+  return tr->base;
+}
+
+template <class TaskRunner, class ArgsTuple, class Task>
+void post_branch(longest_first<TaskRunner>* const tr, std::size_t,
+                 const ArgsTuple&, Task&& task) {
+  tr->base->run(std::forward<Task>(task));
+}
+
+// Consecutive branches of all executed by a single task.
+struct branch_group {
+  std::size_t first;
+  std::size_t last;
+  std::chrono::nanoseconds cost;
+};
+
+// Subnode at position I of a node deriving from its subnodes (all, any, ...),
+// gives subnodes of the same type (e.g. any_node) distinct types.
+template <std::size_t I, class Node>
+struct numbered : Node {
+  explicit numbered(Node node) : Node{std::move(node)} {}
+};
+
+template <std::size_t I, class Node, class F>
+void for_each_child(numbered<I, Node>& node, F&& f) {
+  for_each_child(static_cast<Node&>(node), std::forward<F>(f));
+}
+
+// Strips numbering, so code executing numbered subnodes of the same type is
+// instantiated once.
+template <class Node>
+Node* unnumbered(Node* const node) {
+  return node;
+}
+
+template <std::size_t I, class Node>
+Node* unnumbered(numbered<I, Node>* const node) {
+  return node;
+}
+
+template <class Then, class ArgsTuple, class Slots>
+struct join_state : join_counter {
+  template <class T, class A>
+  join_state(const int count, const finish_type finish, T&& then, A&& args)
+      : join_counter{count, finish},
+        then{std::forward<T>(then)},
+        args{std::forward<A>(args)} {}
+
+  alignas(cache_line_size) Then then;
+  ArgsTuple args;
+  Slots result;
+};
 
 }  // namespace detail
 
 // Branching execution node. Execute its subnodes in parallel using provided
 // task runner.
-// On execution every subnode would take provided parameters by copy.
+// On execution provided parameters are stored once in the join state and
+// every subnode borrows them by const reference, so wide fan-outs don't copy
+// big inputs per branch. Subnodes must not touch parameters after they have
+// finished.
 // Results are represented as a concatenated results of its subnodes.
 template <class... Fs>
 struct all : Fs... {
   static_assert(sizeof...(Fs) > 0);
 
+  template <class T>
+  using borrowed_t = const std::decay_t<T>&;
+
   template <class... Args>
-  static constexpr auto result_pack = (... + graph_result_pack<Fs, Args...>);
+  static constexpr auto result_pack =
+      tp::concat(graph_result_pack<Fs, borrowed_t<Args>...>...);
 
   all(Fs... fs) : Fs{std::move(fs)}... {}
 
@@ -127,90 +649,204 @@ struct all : Fs... {
   void execute(TaskRunner* const tr, Then&& then, Args&&... args) & {
     assert(tr != nullptr);
 
-    constexpr auto result_types = result_pack<Args...>;
-    if constexpr (tp::empty(result_types)) {
-      struct state_type {
-        std::atomic<int> left;
-        std::decay_t<Then> then;
-      };
-      auto* state = new state_type{sizeof...(Fs), std::move(then)};
-      (..., tr->run(
-                [tr, state, f = static_cast<Fs*>(this)](auto... args) {
-                  f->execute(
-                      tr,
-                      [state] {
-                        if (state->left.fetch_sub(1) == 1) {
-                          std::invoke(state->then);
-                          delete state;
-                        }
-                      },
-                      std::move(args)...);
-                },
-                args...));
-    } else {
-      // Number of resulting arguments for every Fs...
-      // Example: <1, 3, 3, 0>
-      constexpr auto arg_nums =
-          std::index_sequence<tp::size(graph_result_pack<Fs, Args...>)...>{};
-
-      // Positions of first resulting arguments for every Fs...
-      // Example: <0, 1, 4, 7>
-      constexpr auto arg_start_poses = detail::iota<0>({}, arg_nums);
-
-      // Index sequences for resulting arguments for every Fs...
-      // Example: <<0>, <0, 1, 2>, <0, 1, 2>, <>>
-      constexpr auto arg_indexes =
-          type_pack_v<decltype(std::make_index_sequence<tp::size(
-                                   graph_result_pack<Fs, Args...>)>{})...>;
+    // Positions of first resulting arguments for every Fs...
+    // Example: numbers of results <1, 3, 3, 0> give positions <0, 1, 4, 7>
+    constexpr auto start_poses = tp::exclusive_scan(
+        std::index_sequence<tp::size(branch_pack<Fs, Args...>)...>{});
 
-      execute_impl(tr, std::forward<Then>(then), arg_start_poses, arg_indexes,
-                   result_types, std::forward<Args>(args)...);
-    }
+    constexpr auto result_types = result_pack<Args...>;
+    execute_impl(tr, std::forward<Then>(then), start_poses, result_types,
+                 std::make_index_sequence<tp::size(result_types)>{},
+                 std::forward<Args>(args)...);
   }
 
   template <class Then>
   auto then(Then f);
 
  private:
+  // Resulting arguments of subnode F.
+  template <class F, class... Args>
+  static constexpr auto branch_pack =
+      graph_result_pack<F, borrowed_t<Args>...>;
+
   template <class TaskRunner, class Then, std::size_t... start_poses,
-            class... IS, class... ResultTypes, class... Args>
+            class... ResultTypes, std::size_t... Rs, class... Args>
   void execute_impl(TaskRunner* const tr, Then&& then,
-                    std::index_sequence<start_poses...>, type_pack<IS...>,
-                    type_pack<ResultTypes...>, Args&&... args) {
-    struct state_type {
-      std::atomic<int> left;
-      std::decay_t<Then> then;
-      std::tuple<std::optional<ResultTypes>...> result;
+                    std::index_sequence<start_poses...>,
+                    type_pack<ResultTypes...>, std::index_sequence<Rs...>,
+                    Args&&... args) {
+    // Slots of different branches don't share cache lines, so subnodes
+    // finishing on different cores don't fight for them (see
+    // detail::result_aligns()).
+    constexpr auto aligns = detail::result_aligns<sizeof...(ResultTypes)>(
+        std::array<std::size_t, sizeof...(Fs)>{start_poses...},
+        std::array<std::size_t, sizeof...(Fs)>{
+            tp::size(branch_pack<Fs, Args...>)...},
+        std::array<std::size_t, sizeof...(Fs)>{
+            detail::results_size(branch_pack<Fs, Args...>)...});
+    using slots_type =
+        detail::result_slots<std::index_sequence_for<ResultTypes...>,
+                             std::index_sequence<aligns[Rs]...>,
+                             ResultTypes...>;
+    using state_type =
+        detail::join_state<std::decay_t<Then>,
+                           std::tuple<std::decay_t<Args>...>, slots_type>;
+
+    auto* state = new state_type{
+        sizeof...(Fs),
+        &finish<state_type, sizeof...(ResultTypes)>,
+        std::forward<Then>(then),
+        std::forward_as_tuple(std::forward<Args>(args)...)};
+
+    if constexpr ((... || detail::has_cost_hint_v<Fs>)) {
+      execute_coarsened<start_poses...>(tr, state, type_pack<Args...>{});
+    } else {
+      // Type erased pointers to result slots in order of results. Lets
+      // per-subnode code be instantiated without the whole state type.
+      void* const slots[] = {
+          static_cast<void*>(&detail::slot_at<Rs>(state->result))...,
+          nullptr};
+
+      std::size_t branch = 0;
+      (..., execute_one(tr, branch++, state, &state->args,
+                        detail::unnumbered(static_cast<Fs*>(this)),
+                        slots + start_poses, branch_pack<Fs, Args...>,
+                        std::make_index_sequence<
+                            tp::size(branch_pack<Fs, Args...>)>{}));
+    }
+  }
+
+  // Posts consecutive cheap subnodes as a single task executing them one by
+  // one, until their total cost reaches the grain. Costly subnodes and ones
+  // without hints get tasks of their own. Under critical_path the costliest
+  // groups go first.
+  template <std::size_t... start_poses, class TaskRunner, class State,
+            class... Args>
+  void execute_coarsened(TaskRunner* const tr, State* const state,
+                         type_pack<Args...>) {
+    auto* const branch_tr = detail::branch_runner(tr);
+    using branch_runner_type = std::remove_pointer_t<decltype(branch_tr)>;
+    using branch_type = void (*)(all*, branch_runner_type*, State*);
+    static constexpr branch_type branches[] = {
+        &execute_branch<Fs, start_poses, branch_runner_type, State,
+                        Args...>...};
+    const std::chrono::nanoseconds costs[] = {
+        detail::cost_hint(static_cast<const Fs&>(*this))...};
+
+    detail::branch_group groups[sizeof...(Fs)];
+    std::size_t group_count = 0;
+    const auto add_group = [&](const std::size_t first, const std::size_t last,
+                               const std::chrono::nanoseconds cost) {
+      groups[group_count++] = {first, last, cost};
     };
-    auto* state = new state_type{sizeof...(Fs), std::forward<Then>(then), {}};
 
-    (..., execute_one<start_poses>(tr, state, static_cast<Fs*>(this), IS{},
-                                   args...));
+    std::size_t first = 0;
+    std::chrono::nanoseconds group_cost{0};
+    for (std::size_t i = 0; i < sizeof...(Fs); ++i) {
+      if (costs[i] >= detail::coarsening_grain) {
+        if (first < i) {
+          add_group(first, i, group_cost);
+        }
+        add_group(i, i + 1, costs[i]);
+        first = i + 1;
+        group_cost = std::chrono::nanoseconds{0};
+        continue;
+      }
+      group_cost += costs[i];
+      if (group_cost >= detail::coarsening_grain) {
+        add_group(first, i + 1, group_cost);
+        first = i + 1;
+        group_cost = std::chrono::nanoseconds{0};
+      }
+    }
+    if (first < sizeof...(Fs)) {
+      add_group(first, sizeof...(Fs), group_cost);
+    }
+
+    if constexpr (detail::longest_first_v<TaskRunner>) {
+      // Ties keep declaration order.
+      std::sort(groups, groups + group_count,
+                [](const detail::branch_group& a,
+                   const detail::branch_group& b) {
+                  return a.cost != b.cost ? a.cost > b.cost : a.first < b.first;
+                });
+    }
+
+    for (std::size_t g = 0; g < group_count; ++g) {
+      const detail::branch_group group = groups[g];
+      detail::post_branch(tr, group.first, state->args,
+                          [this, branch_tr, state, group] {
+                            for (std::size_t i = group.first; i < group.last;
+                                 ++i) {
+                              branches[i](this, branch_tr, state);
+                            }
+                          });
+    }
+  }
+
+  template <class F, std::size_t start_pos, class TaskRunner, class State,
+            class... Args>
+  static void execute_branch(all* const self, TaskRunner* const tr,
+                             State* const state) {
+    constexpr auto results = branch_pack<F, Args...>;
+    execute_branch_impl<start_pos>(
+        tr, state, static_cast<F*>(self), results,
+        std::make_index_sequence<tp::size(results)>{});
   }
 
   template <std::size_t start_pos, class TaskRunner, class State, class F,
-            std::size_t... Is, class... Args>
-  void execute_one(TaskRunner* const tr, State* const state, F* const f,
-                   std::index_sequence<Is...>, Args&&... args) {
-    tr->run(
-        [tr, state, f](auto... args) {
+            class... Ts, std::size_t... Is>
+  static void execute_branch_impl(TaskRunner* const tr, State* const state,
+                                  F* const f, type_pack<Ts...>,
+                                  std::index_sequence<Is...>) {
+    using then_type = detail::branch_then<detail::result_slot<Ts>...>;
+    std::apply(
+        [&](const auto&... args) {
           f->execute(
               tr,
-              [state](auto&&... results) {
-                (..., std::get<start_pos + Is>(state->result)
-                          .emplace(std::forward<decltype(results)>(results)));
-                if (state->left.fetch_sub(1) == 1) {
-                  std::apply(
-                      [then = std::move(state->then)](auto&&... val) mutable {
-                        std::invoke(then, std::move(*val)...);
-                      },
-                      std::move(state->result));
-                  delete state;
-                }
-              },
-              std::move(args)...);
+              then_type{state,
+                        {static_cast<void*>(&detail::slot_at<start_pos + Is>(
+                             state->result))...,
+                         nullptr}},
+              args...);
         },
-        std::move(args)...);
+        std::as_const(state->args));
+  }
+
+  template <class TaskRunner, class ArgsTuple, class F, class... Ts,
+            std::size_t... Is>
+  static void execute_one(TaskRunner* const tr, const std::size_t branch,
+                          detail::join_counter* const join,
+                          const ArgsTuple* const args, F* const f,
+                          void* const* const slots, type_pack<Ts...>,
+                          std::index_sequence<Is...>) {
+    using then_type = detail::branch_then<detail::result_slot<Ts>...>;
+    auto* const branch_tr = detail::branch_runner(tr);
+    using branch_runner_type = std::remove_pointer_t<decltype(branch_tr)>;
+    detail::post_branch(
+        tr, branch, *args,
+        detail::branch_task<branch_runner_type, F, ArgsTuple, then_type>{
+            branch_tr,
+            f,
+            args,
+            then_type{join, {slots[Is]..., nullptr}},
+        });
+  }
+
+  template <class State, std::size_t result_count>
+  static void finish(detail::join_counter* const join) {
+    finish_impl(static_cast<State*>(join),
+                std::make_index_sequence<result_count>{});
+  }
+
+  template <class State, std::size_t... Rs>
+  static void finish_impl(State* const state, std::index_sequence<Rs...>) {
+    // Results are passed as rvalue references, so they are moved at most once
+    // more: into parameters of then.
+    std::invoke(state->then,
+                std::move(detail::slot_at<Rs>(state->result).get())...);
+    (..., detail::slot_at<Rs>(state->result).destroy());
+    delete state;
   }
 };
 
@@ -219,68 +855,1717 @@ auto make_all(Fs... fs) {
   return all{std::move(fs)...};
 }
 
-template <class T, class = void>
-struct is_exec_node : std::false_type {};
+template <class... Fs, class F>
+void for_each_child(all<Fs...>& node, F&& f) {
+  (..., std::invoke(f, static_cast<Fs&>(node)));
+}
 
-template <class F>
-struct is_exec_node<leaf<F>> : std::true_type {};
+// ==================== distributed ====================
 
-template <class A, class B>
-struct is_exec_node<seq<A, B>> : std::true_type {};
+// Placement of all's branches spreading them over shards in turn, starting
+// after the shard of the caller.
+struct round_robin {
+  template <class... Args>
+  std::size_t shard(const std::size_t branch, const std::size_t shard_count,
+                    const std::size_t current, const Args&...) const {
+    const std::size_t first = current < shard_count ? current + 1 : 0;
+    return (first + branch) % shard_count;
+  }
+};
 
-template <class... Fs>
-struct is_exec_node<all<Fs...>> : std::true_type {};
+// Placement of all's branches by hash of key(branch, args...), so branches
+// working on the same data meet on the same shard.
+template <class Key>
+struct by_key {
+  template <class... Args>
+  std::size_t shard(const std::size_t branch, const std::size_t shard_count,
+                    std::size_t, const Args&... args) const {
+    const auto k = std::invoke(key, branch, args...);
+    return std::hash<std::decay_t<decltype(k)>>{}(k) % shard_count;
+  }
+
+  Key key;
+};
+
+template <class Key>
+by_key(Key) -> by_key<Key>;
+
+namespace detail {
 
 template <class T>
-constexpr bool is_exec_node_v = is_exec_node<T>::value;
+struct is_all : std::false_type {};
 
-template <class F>
-auto try_transform(F f) {
-  if constexpr (is_exec_node_v<std::decay_t<F>>) {
-    return f;
-  } else {
-    return make_leaf(std::move(f));
+template <class... Fs>
+struct is_all<all<Fs...>> : std::true_type {};
+
+}  // namespace detail
+
+// Placement execution node for task runners of sharded_task_system. Branches
+// of its subnode, which must be all, are executed on shards chosen by Policy
+// (round_robin or by_key) instead of the calling one. The subtrees of the
+// branches stay on their shards.
+template <class Policy, class Node>
+struct distributed : Node {
+  // Only all knows the placement proxy, other nodes would try to run tasks on
+  // it.
+  static_assert(detail::is_all<Node>::value,
+                "Subnode of distributed must be all");
+
+  template <class... Args>
+  static constexpr auto result_pack = graph_result_pack<Node, Args...>;
+
+  distributed(Policy policy, Node node)
+      : Node{std::move(node)}, policy_{std::move(policy)} {}
+
+  template <class TaskRunner, class Then, class... Args>
+  void execute(TaskRunner* const tr, Then then, Args&&... args) & {
+    assert(tr != nullptr);
+    // all uses it only while scheduling its branches.
+    detail::shard_placement<TaskRunner, Policy> placement{tr, &policy_};
+    Node::execute(&placement, std::move(then), std::forward<Args>(args)...);
   }
+
+  template <class Then>
+  auto then(Then f);
+
+  Policy policy_;
 };
 
-template <class F>
-template <class Then>
-auto leaf<F>::then(Then f) {
-  return make_seq(std::move(*this), try_transform(std::move(f)));
+template <class Policy, class Node, class F>
+void for_each_child(distributed<Policy, Node>& node, F&& f) {
+  std::invoke(f, static_cast<Node&>(node));
 }
 
-template <class A, class B>
-template <class Then>
-auto seq<A, B>::then(Then f) {
-  return make_seq(std::move(*this), try_transform(std::move(f)));
-}
+// ==================== cell_reader ====================
 
-template <class... Fs>
-template <class Then>
-auto all<Fs...>::then(Then f) {
-  return make_seq(std::move(*this), try_transform(std::move(f)));
-}
+// Source execution node. Ignores provided parameters and forwards current
+// value of the cell to Then.
+// Cell must outlive the node.
+template <class T>
+struct cell_reader {
+  template <class... Args>
+  static constexpr auto result_pack = type_pack_v<T>;
 
-template <class... Fs>
-auto when_all(Fs... fs) {
-  return make_all(try_transform(std::move(fs))...);
+  explicit cell_reader(const versioned_cell<T>* const cell) : cell_{cell} {
+    assert(cell_ != nullptr);
+  }
+
+  template <class TaskRunner, class Then, class... Args>
+  void execute(TaskRunner* const tr, Then then, Args&&...) & {
+    assert(tr != nullptr);
+    std::invoke(then, cell_->get());
+  }
+
+  template <class Then>
+  auto then(Then f);
+
+  const versioned_cell<T>* cell_;
+};
+
+template <class T>
+auto read_cell(const versioned_cell<T>& cell) {
+  return cell_reader<T>{&cell};
 }
 
-template <class TaskRunner, class ExecTree, class Then, class... Args>
-void sync_execute(TaskRunner* tr, ExecTree* tree, Then then, Args... args) {
-  assert(tr != nullptr);
-  assert(tree != nullptr);
-  base::manual_event finish_event;
+// ==================== incremental ====================
+
+namespace detail {
+
+template <class T>
+struct is_cell_reader : std::false_type {};
+
+template <class T>
+struct is_cell_reader<cell_reader<T>> : std::true_type {};
+
+// Numbered readers (e.g. several ones under when_all) are readers too.
+template <std::size_t I, class Node>
+struct is_cell_reader<numbered<I, Node>> : is_cell_reader<Node> {};
+
+// Nodes hiding their subtree from for_each_child (see any_node) enumerate
+// its cells themselves.
+template <class Node, class F, class = void>
+struct enumerates_cells : std::false_type {};
+
+template <class Node, class F>
+struct enumerates_cells<
+    Node, F,
+    std::void_t<decltype(std::declval<Node&>().for_each_cell(
+        std::declval<F&>()))>> : std::true_type {};
+
+template <class Node, class F>
+void for_each_cell(Node& node, F& f) {
+  if constexpr (is_cell_reader<Node>::value) {
+    std::invoke(f, *node.cell_);
+  } else if constexpr (enumerates_cells<Node, F>::value) {
+    node.for_each_cell(f);
+  } else {
+    for_each_child(node, [&f](auto& child) { for_each_cell(child, f); });
+  }
+}
+
+}  // namespace detail
+
+// Caching execution node. Remembers results of the last execution of its
+// subnode together with versions of all cells read inside the subnode
+// (see cell_reader). On execution subnode is executed only if some of those
+// cells has changed since then, otherwise cached results are forwarded to
+// Then right away.
+// Wrapping independent branches of a big tree lets re-execution schedule only
+// branches affected by changed cells.
+// Subnode must not depend on parameters: its inputs are cells only.
+template <class Node>
+struct incremental : Node {
+  template <class... Args>
+  static constexpr auto result_pack = graph_result_pack<Node>;
+
+  explicit incremental(Node node)
+      : Node{std::move(node)}, state_{std::make_shared<state_type>()} {
+    auto collect = [this](const versioned_cell_base& cell) {
+      cells_.push_back(&cell);
+    };
+    detail::for_each_cell(static_cast<Node&>(*this), collect);
+  }
+
+  template <class TaskRunner, class Then, class... Args>
+  void execute(TaskRunner* const tr, Then then, Args&&...) & {
+    assert(tr != nullptr);
+    static_assert(sizeof...(Args) == 0,
+                  "Incremental nodes take their inputs from cells only");
+
+    std::vector<std::uint64_t> versions;
+    versions.reserve(cells_.size());
+    for (auto* cell : cells_) {
+      versions.push_back(cell->version());
+    }
+
+    {
+      std::unique_lock guard{state_->mtx};
+      if (state_->result && state_->versions == versions) {
+        auto result = *state_->result;
+        guard.unlock();
+        std::apply(then, std::move(result));
+        return;
+      }
+    }
+
+    Node::execute(tr,
+                  [state = state_, versions = std::move(versions),
+                   then = std::move(then)](auto&&... results) mutable {
+                    {
+                      std::unique_lock guard{state->mtx};
+                      state->result.emplace(results...);
+                      state->versions = std::move(versions);
+                    }
+                    std::invoke(then,
+                                std::forward<decltype(results)>(results)...);
+                  });
+  }
+
+  template <class Then>
+  auto then(Then f);
+
+ private:
+  template <class... Ts>
+  static auto make_result_tuple(type_pack<Ts...>)
+      -> std::tuple<std::decay_t<Ts>...>;
+
+  struct state_type {
+    std::mutex mtx;
+    std::vector<std::uint64_t> versions;
+    std::optional<decltype(make_result_tuple(graph_result_pack<Node>))>
+        result;
+  };
+
+  std::vector<const versioned_cell_base*> cells_;
+  std::shared_ptr<state_type> state_;
+};
+
+template <class Node>
+auto make_incremental(Node node) {
+  return incremental<Node>{std::move(node)};
+}
+
+template <class Node, class F>
+void for_each_child(incremental<Node>& node, F&& f) {
+  std::invoke(f, static_cast<Node&>(node));
+}
+
+// ==================== on_runner ====================
+
+namespace detail {
+
+template <class TaskRunner, class = void>
+struct knows_current_thread : std::false_type {};
+
+template <class TaskRunner>
+struct knows_current_thread<
+    TaskRunner,
+    std::void_t<decltype(std::declval<const TaskRunner&>()
+                             .running_in_this_thread())>> : std::true_type {};
+
+template <class TaskRunner, class = void>
+struct runs_pending_tasks : std::false_type {};
+
+template <class TaskRunner>
+struct runs_pending_tasks<
+    TaskRunner,
+    std::void_t<decltype(std::declval<TaskRunner&>().run_pending_task())>>
+    : std::true_type {};
+
+// Whether calling thread already executes tasks of tr. Task runners unable to
+// tell it are never considered current.
+template <class TaskRunner>
+bool running_in(const TaskRunner* const tr) {
+  if constexpr (knows_current_thread<TaskRunner>::value) {
+    return tr->running_in_this_thread();
+  } else {
+    return false;
+  }
+}
+
+template <class TaskRunner, class = void>
+struct knows_discarding : std::false_type {};
+
+template <class TaskRunner>
+struct knows_discarding<
+    TaskRunner,
+    std::void_t<decltype(std::declval<const TaskRunner&>().discards_tasks())>>
+    : std::true_type {};
+
+// Rejects task runners that may discard tasks (see
+// overflow_policy::drop_oldest): a discarded task of a graph never reaches its
+// join, so the execution would never finish.
+template <class TaskRunner>
+void check_keeps_tasks(const TaskRunner* const tr) {
+  if constexpr (knows_discarding<TaskRunner>::value) {
+    if (tr->discards_tasks()) {
+      throw std::invalid_argument{"graphs can't run on a discarding runner"};
+    }
+  }
+}
+
+}  // namespace detail
+
+// Executor switching node. Executes its subnode on the other task runner (the
+// whole subtree uses it) and hops back to the original task runner to run
+// Then. Hops are skipped when calling thread already belongs to the required
+// task runner.
+// Lets isolate e.g. blocking work in a small dedicated pool.
+// Runner must outlive the node and must not discard tasks, otherwise
+// std::invalid_argument is thrown on construction.
+template <class Runner, class Node>
+struct on_runner : Node {
+  template <class... Args>
+  static constexpr auto result_pack = graph_result_pack<Node, Args...>;
+
+  on_runner(Runner* const runner, Node node)
+      : Node{std::move(node)}, runner_{runner} {
+    assert(runner_ != nullptr);
+    detail::check_keeps_tasks(runner_);
+  }
+
+  template <class TaskRunner, class Then, class... Args>
+  void execute(TaskRunner* const tr, Then then, Args&&... args) & {
+    assert(tr != nullptr);
+    auto back = [tr, then = std::move(then)](auto&&... results) mutable {
+      if (detail::running_in(tr)) {
+        std::invoke(then, std::forward<decltype(results)>(results)...);
+      } else {
+        tr->run(std::move(then), std::forward<decltype(results)>(results)...);
+      }
+    };
+
+    if (detail::running_in(runner_)) {
+      Node::execute(runner_, std::move(back), std::forward<Args>(args)...);
+    } else {
+      runner_->run(
+          [this, back = std::move(back)](auto&&... args) mutable {
+            Node::execute(runner_, std::move(back),
+                          std::forward<decltype(args)>(args)...);
+          },
+          std::forward<Args>(args)...);
+    }
+  }
+
+  template <class Then>
+  auto then(Then f);
+
+  Runner* runner_;
+};
+
+template <class Runner, class Node, class F>
+void for_each_child(on_runner<Runner, Node>& node, F&& f) {
+  std::invoke(f, static_cast<Node&>(node));
+}
+
+// ==================== concurrency_limiter ====================
+
+// Admission control node. At most limit executions of its subnode are in
+// flight at any moment (the limit is shared by all copies of the node), the
+// rest wait in a FIFO queue without occupying workers. When a running
+// execution finishes, the oldest waiting one is scheduled to its task runner.
+// Lets bound the load a subtree puts on some scarce resource (connections,
+// memory) without blocking workers.
+// Waiting executions keep copies of their parameters.
+template <class Node>
+struct concurrency_limiter : Node {
+  template <class... Args>
+  static constexpr auto result_pack = graph_result_pack<Node, Args...>;
+
+  concurrency_limiter(const std::size_t limit, Node node)
+      : Node{std::move(node)}, state_{std::make_shared<state_type>(limit)} {
+    assert(limit > 0);
+  }
+
+  template <class TaskRunner, class Then, class... Args>
+  void execute(TaskRunner* const tr, Then then, Args&&... args) & {
+    assert(tr != nullptr);
+    {
+      std::unique_lock guard{state_->mtx};
+      if (state_->in_flight == state_->limit) {
+        state_->pending.emplace_back(
+            [this, tr, then = std::move(then),
+             args = std::make_tuple(std::decay_t<Args>(
+                 std::forward<Args>(args))...)]() mutable {
+              std::apply(
+                  [&](auto&... args) {
+                    tr->run(
+                        [this, tr, then = std::move(then)](
+                            auto&&... args) mutable {
+                          start(tr, std::move(then),
+                                std::forward<decltype(args)>(args)...);
+                        },
+                        std::move(args)...);
+                  },
+                  args);
+            });
+        return;
+      }
+      ++state_->in_flight;
+    }
+    start(tr, std::move(then), std::forward<Args>(args)...);
+  }
+
+  template <class Then>
+  auto then(Then f);
+
+ private:
+  struct state_type {
+    explicit state_type(const std::size_t limit) : limit{limit} {}
+
+    std::mutex mtx;
+    const std::size_t limit;
+    std::size_t in_flight = 0;
+    // Every pending closure schedules one waiting execution.
+    std::deque<unique_function<void()>> pending;
+  };
+
+  template <class TaskRunner, class Then, class... Args>
+  void start(TaskRunner* const tr, Then then, Args&&... args) {
+    Node::execute(tr,
+                  [state = state_, then = std::move(then)](
+                      auto&&... results) mutable {
+                    release(*state);
+                    std::invoke(then,
+                                std::forward<decltype(results)>(results)...);
+                  },
+                  std::forward<Args>(args)...);
+  }
+
+  // Hands the slot of finished execution over to the oldest waiting one.
+  static void release(state_type& state) {
+    unique_function<void()> next;
+    {
+      std::unique_lock guard{state.mtx};
+      if (state.pending.empty()) {
+        --state.in_flight;
+        return;
+      }
+      next = std::move(state.pending.front());
+      state.pending.pop_front();
+    }
+    next();
+  }
+
+  std::shared_ptr<state_type> state_;
+};
+
+template <class Node, class F>
+void for_each_child(concurrency_limiter<Node>& node, F&& f) {
+  std::invoke(f, static_cast<Node&>(node));
+}
+
+// ==================== any ====================
+
+namespace detail {
+
+// Number of races of a node (see any, hedged) with executions still running.
+// Destruction blocks until they are done, so losers finishing after Then
+// never outlive the node. Copies start empty.
+class race_counter {
+ public:
+  race_counter() = default;
+  race_counter(const race_counter&) {}
+  race_counter& operator=(const race_counter&) { return *this; }
+
+  ~race_counter() {
+    std::unique_lock guard{mtx_};
+    cv_.wait(guard, [this] { return count_ == 0; });
+  }
+
+  void add() {
+    std::unique_lock guard{mtx_};
+    ++count_;
+  }
+
+  // The node may be gone as soon as the lock is released.
+  void remove() {
+    std::unique_lock guard{mtx_};
+    if (--count_ == 0) {
+      cv_.notify_all();
+    }
+  }
+
+ private:
+  std::mutex mtx_;
+  std::condition_variable cv_;
+  int count_ = 0;
+};
+
+// Join state of racing executions. The first finished one takes Then, the
+// last one deletes the state.
+template <class Then, class ArgsTuple>
+struct race_state {
+  template <class T, class A>
+  race_state(race_counter* const races, const int count, T&& then, A&& args)
+      : races{races},
+        left{count},
+        then{std::forward<T>(then)},
+        args{std::forward<A>(args)} {
+    races->add();
+  }
+
+  // Called by every started execution when it is done.
+  template <class... Results>
+  void arrive(Results&&... results) {
+    if (!finished.exchange(true)) {
+      // The execution the timer would start is not needed anymore.
+      const auto id = timer.load();
+      if (id != 0 && timer_thread::shared().cancel(id)) {
+        release();
+      }
+      std::invoke(then, std::forward<Results>(results)...);
+    }
+    release();
+  }
+
+  // Called for every execution instead of arrive() if it isn't started.
+  void release() {
+    if (left.fetch_sub(1) == 1) {
+      // The node may go away right after the race is removed.
+      auto* const r = races;
+      delete this;
+      r->remove();
+    }
+  }
+
+  race_counter* const races;
+  std::atomic<bool> finished = false;
+  std::atomic<int> left;
+  // Timer starting a late execution (see hedged), 0 if none.
+  std::atomic<timer_thread::timer_id> timer = 0;
+  Then then;
+  ArgsTuple args;
+};
+
+// Executes node f with parameters borrowed from the race state, unless the
+// race is already over.
+template <class TaskRunner, class F, class State>
+void run_racer(TaskRunner* const tr, F* const f, State* const state) {
+  if (state->finished.load()) {
+    state->release();
+    return;
+  }
+  scoped_stop_flag scope{&state->finished};
+  std::apply(
+      [&](const auto&... args) {
+        f->execute(
+            tr,
+            [state](auto&&... results) {
+              state->arrive(std::forward<decltype(results)>(results)...);
+            },
+            args...);
+      },
+      std::as_const(state->args));
+}
+
+}  // namespace detail
+
+// Whether the result of the race (when_any branch or hedge copy) calling
+// thread executes is not needed anymore, since a rival has finished first.
+// Long leaves may poll it to give up early, their results are discarded
+// anyway. Tasks posted by the racer's subtree carry its flag (see
+// task_runner_base), so the whole subtree sees it.
+inline bool stop_requested() {
+  const auto* const flag = current_stop_flag();
+  return flag != nullptr && flag->load(std::memory_order_relaxed);
+}
+
+// First-wins branching execution node. Executes its subnodes in parallel
+// like all, but forwards results of the first finished one to Then, so all
+// subnodes must have the same results.
+// Parameters are stored once in the join state and borrowed by subnodes.
+// Subnodes that haven't started by the time the first one finishes are
+// skipped, running ones see stop_requested(). The join state is released by
+// the last subnode, which may finish after Then, so destruction of the node
+// waits for such losers.
+template <class... Fs>
+struct any : Fs... {
+  static_assert(sizeof...(Fs) > 0);
+
+  template <class T>
+  using borrowed_t = const std::decay_t<T>&;
+
+  template <class... Args>
+  static constexpr auto result_pack = graph_result_pack<
+      std::tuple_element_t<0, std::tuple<Fs...>>, borrowed_t<Args>...>;
+
+  any(Fs... fs) : Fs{std::move(fs)}... {}
+
+  template <class TaskRunner, class Then, class... Args>
+  void execute(TaskRunner* const tr, Then then, Args&&... args) & {
+    assert(tr != nullptr);
+    static_assert((... && (graph_result_pack<Fs, borrowed_t<Args>...> ==
+                           result_pack<Args...>)),
+                  "Subnodes of any must have the same results");
+    using state_type =
+        detail::race_state<Then, std::tuple<std::decay_t<Args>...>>;
+    auto* const state = new state_type{
+        &races_, sizeof...(Fs), std::move(then),
+        std::forward_as_tuple(std::forward<Args>(args)...)};
+    // Racers may outlive Then, and so task runner wrappers bound to it.
+    auto* const base = detail::underlying_runner(tr);
+    (..., start(base, detail::unnumbered(static_cast<Fs*>(this)), state));
+  }
+
+  template <class Then>
+  auto then(Then f);
+
+ private:
+  template <class TaskRunner, class F, class State>
+  static void start(TaskRunner* const tr, F* const f, State* const state) {
+    tr->run([tr, f, state] { detail::run_racer(tr, f, state); });
+  }
+
+  detail::race_counter races_;
+};
+
+template <class... Fs>
+auto make_any(Fs... fs) {
+  return any{std::move(fs)...};
+}
+
+template <class... Fs, class F>
+void for_each_child(any<Fs...>& node, F&& f) {
+  (..., std::invoke(f, static_cast<Fs&>(node)));
+}
+
+// ==================== hedged ====================
+
+// Hedged execution node. Executes its subnode and, if it hasn't finished
+// within delay, starts a second execution of it with the same parameters on
+// the task runner. Results of whichever finishes first are forwarded to Then,
+// the other one sees stop_requested().
+// Cuts tail latency of subtrees that occasionally stall (cold caches, slow
+// replicas) at the cost of duplicated work for the slow executions only, so
+// delay usually sits about the 95th percentile of the subtree latency.
+// Parameters are copied to the join state for the second execution. The
+// timer of the second execution is cancelled once the first one finishes.
+// Like with any, the loser may finish after Then, and destruction of the node
+// waits for it.
+template <class Node>
+struct hedged : Node {
+  template <class T>
+  using borrowed_t = const std::decay_t<T>&;
+
+  template <class... Args>
+  static constexpr auto result_pack =
+      graph_result_pack<Node, borrowed_t<Args>...>;
+
+  hedged(Node node, const std::chrono::steady_clock::duration delay)
+      : Node{std::move(node)}, delay_{delay} {}
+
+  template <class TaskRunner, class Then, class... Args>
+  void execute(TaskRunner* const tr, Then then, Args&&... args) & {
+    assert(tr != nullptr);
+    using state_type =
+        detail::race_state<Then, std::tuple<std::decay_t<Args>...>>;
+    auto* const state =
+        new state_type{&races_, 2, std::move(then),
+                       std::forward_as_tuple(std::forward<Args>(args)...)};
+    auto* const node = static_cast<Node*>(this);
+    // Racers may outlive Then, and so task runner wrappers bound to it.
+    auto* const base = detail::underlying_runner(tr);
+    state->timer = timer_thread::shared().post_after(
+        delay_, [base, node, state] {
+          if (state->finished.load()) {
+            state->release();
+            return;
+          }
+          base->run(
+              [base, node, state] { detail::run_racer(base, node, state); });
+        });
+    detail::run_racer(base, node, state);
+  }
+
+  template <class Then>
+  auto then(Then f);
+
+  std::chrono::steady_clock::duration delay_;
+  detail::race_counter races_;
+};
+
+template <class Node, class F>
+void for_each_child(hedged<Node>& node, F&& f) {
+  std::invoke(f, static_cast<Node&>(node));
+}
+
+// ==================== each ====================
+
+namespace detail {
+
+template <class Then, class ArgsTuple>
+struct each_state : join_counter {
+  template <class T, class A>
+  each_state(const int count, const finish_type finish, T&& then, A&& args)
+      : join_counter{count, finish},
+        then{std::forward<T>(then)},
+        args{std::forward<A>(args)} {}
+
+  Then then;
+  ArgsTuple args;
+};
+
+}  // namespace detail
+
+// Streaming branching execution node. Executes its subnodes in parallel like
+// all, but instead of collecting their results passes results of every
+// subnode to sink(index, results...) as soon as it finishes, where index is
+// std::integral_constant of the subnode position. Then is called without
+// parameters after the last sink call.
+// Results aren't kept in the join state, so downstream work may start on the
+// first ones and memory holds only results being consumed at the moment.
+// Sink is called from workers finishing subnodes, possibly concurrently, so
+// it must synchronize shared data itself.
+// Parameters are stored once in the join state and borrowed by subnodes.
+template <class Sink, class... Fs>
+struct each : Fs... {
+  static_assert(sizeof...(Fs) > 0);
+
+  template <class... Args>
+  static constexpr auto result_pack = type_pack<>{};
+
+  each(Sink sink, Fs... fs) : Fs{std::move(fs)}..., sink_{std::move(sink)} {}
+
+  template <class TaskRunner, class Then, class... Args>
+  void execute(TaskRunner* const tr, Then then, Args&&... args) & {
+    assert(tr != nullptr);
+    using state_type =
+        detail::each_state<Then, std::tuple<std::decay_t<Args>...>>;
+    auto* const state = new state_type{
+        sizeof...(Fs), &finish<state_type>, std::move(then),
+        std::forward_as_tuple(std::forward<Args>(args)...)};
+    start_all(tr, state, std::index_sequence_for<Fs...>{});
+  }
+
+  template <class Then>
+  auto then(Then f);
+
+  Sink sink_;
+
+ private:
+  template <class TaskRunner, class State, std::size_t... Is>
+  void start_all(TaskRunner* const tr, State* const state,
+                 std::index_sequence<Is...>) {
+    (..., start<Is>(tr, static_cast<Fs*>(this), state));
+  }
+
+  template <std::size_t I, class TaskRunner, class F, class State>
+  void start(TaskRunner* const tr, F* const f, State* const state) {
+    tr->run([this, tr, f, state] {
+      std::apply(
+          [&](const auto&... args) {
+            f->execute(
+                tr,
+                [this, state](auto&&... results) {
+                  std::invoke(sink_, std::integral_constant<std::size_t, I>{},
+                              std::forward<decltype(results)>(results)...);
+                  state->arrive();
+                },
+                args...);
+          },
+          std::as_const(state->args));
+    });
+  }
+
+  template <class State>
+  static void finish(detail::join_counter* const join) {
+    auto* const state = static_cast<State*>(join);
+    std::invoke(state->then);
+    delete state;
+  }
+};
+
+template <class Sink, class... Fs, class F>
+void for_each_child(each<Sink, Fs...>& node, F&& f) {
+  (..., std::invoke(f, static_cast<Fs&>(node)));
+}
+
+// ==================== choice ====================
+
+namespace detail {
+
+// Single value holding results of choice's subnode: nothing, the result
+// itself or a tuple of them.
+template <class... Ts>
+struct branch_value {
+  using type = std::tuple<Ts...>;
+};
+
+template <>
+struct branch_value<> {
+  using type = std::monostate;
+};
+
+template <class T>
+struct branch_value<T> {
+  using type = T;
+};
+
+template <class Pack>
+struct pack_value;
+
+template <class... Ts>
+struct pack_value<type_pack<Ts...>> : branch_value<Ts...> {};
+
+template <class Pack>
+using pack_value_t = typename pack_value<Pack>::type;
+
+template <class P, class... Ps>
+constexpr bool same_packs(P p, Ps... ps) {
+  return (... && (ps == p));
+}
+
+template <class P, class... Ps>
+constexpr auto choice_result_pack(P p, Ps... ps) {
+  if constexpr (same_packs(p, ps...)) {
+    return p;
+  } else {
+    return type_pack_v<std::variant<pack_value_t<P>, pack_value_t<Ps>...>>;
+  }
+}
+
+}  // namespace detail
+
+// Runtime branching execution node. Selector is invoked with const references
+// to the parameters and returns index of the subnode to execute, only that
+// one is executed (with the parameters forwarded) and its results are
+// forwarded to Then.
+// If all subnodes have the same results, those are results of the node.
+// Otherwise it has a single std::variant result with an alternative per
+// subnode (in their order): std::monostate for subnodes without results, the
+// result itself for subnodes with one and std::tuple of them otherwise.
+// The subnode is picked from a table, so wide switches cost the same as
+// narrow ones. The last subnode is the default branch: it's executed for
+// selector results out of range of the subnodes (negative ones included), so
+// the node behaves the same at the root and nested inside a task.
+template <class Selector, class... Fs>
+struct choice : Fs... {
+  static_assert(sizeof...(Fs) > 0);
+
+  template <class... Args>
+  static constexpr auto result_pack =
+      detail::choice_result_pack(graph_result_pack<Fs, Args...>...);
+
+  choice(Selector selector, Fs... fs)
+      : Fs{std::move(fs)}..., selector_{std::move(selector)} {}
+
+  template <class TaskRunner, class Then, class... Args>
+  void execute(TaskRunner* const tr, Then then, Args&&... args) & {
+    assert(tr != nullptr);
+    execute_impl(tr, std::move(then), std::index_sequence_for<Fs...>{},
+                 std::forward<Args>(args)...);
+  }
+
+  template <class Then>
+  auto then(Then f);
+
+  Selector selector_;
+
+ private:
+  template <class TaskRunner, class Then, std::size_t... Is, class... Args>
+  void execute_impl(TaskRunner* const tr, Then then,
+                    std::index_sequence<Is...>, Args&&... args) {
+    using branch_type = void (*)(choice*, TaskRunner*, Then, Args&&...);
+    static constexpr branch_type branches[] = {
+        &execute_branch<Is, TaskRunner, Then, Args...>...};
+    const auto index = std::min(
+        static_cast<std::size_t>(
+            std::invoke(selector_, std::as_const(args)...)),
+        sizeof...(Fs) - 1);
+    branches[index](this, tr, std::move(then), std::forward<Args>(args)...);
+  }
+
+  template <std::size_t I, class TaskRunner, class Then, class... Args>
+  static void execute_branch(choice* const self, TaskRunner* const tr,
+                             Then then, Args&&... args) {
+    using F = std::tuple_element_t<I, std::tuple<Fs...>>;
+    auto* const f = static_cast<F*>(self);
+    if constexpr (detail::same_packs(graph_result_pack<Fs, Args...>...)) {
+      f->execute(tr, std::move(then), std::forward<Args>(args)...);
+    } else {
+      using result_type = subtype<decltype(tp::head(result_pack<Args...>))>;
+      f->execute(
+          tr,
+          [then = std::move(then)](auto&&... results) mutable {
+            std::invoke(then, result_type{std::in_place_index<I>,
+                                          std::forward<decltype(results)>(
+                                              results)...});
+          },
+          std::forward<Args>(args)...);
+    }
+  }
+};
+
+template <class Selector, class... Fs>
+auto make_choice(Selector selector, Fs... fs) {
+  return choice<Selector, Fs...>{std::move(selector), std::move(fs)...};
+}
+
+template <class Selector, class... Fs, class F>
+void for_each_child(choice<Selector, Fs...>& node, F&& f) {
+  (..., std::invoke(f, static_cast<Fs&>(node)));
+}
+
+// ==================== loop ====================
+
+// Looping execution node. Executes its body with the parameters, then with
+// results of the previous iteration until pred (invoked with const
+// references to them) returns true. Results of the last iteration are
+// forwarded to Then, so the body must produce values of the parameter types.
+// Iterations follow each other without hops and share one state allocated
+// per execution. Iterations finishing synchronously go on in a loop, not in
+// a recursion, so the stack doesn't grow with their number.
+template <class Pred, class Body>
+struct loop : Body {
+  template <class... Args>
+  static constexpr auto result_pack = type_pack_v<std::decay_t<Args>...>;
+
+  loop(Pred pred, Body body) : Body{std::move(body)}, pred_{std::move(pred)} {}
+
+  template <class TaskRunner, class Then, class... Args>
+  void execute(TaskRunner* const tr, Then then, Args&&... args) & {
+    assert(tr != nullptr);
+    static_assert(graph_result_pack<Body, std::decay_t<Args>...> ==
+                      result_pack<Args...>,
+                  "Body of loop must produce values of its parameter types");
+    using state_type = loop_state<TaskRunner, Then, std::decay_t<Args>...>;
+    auto* const state = new state_type{this, tr, std::move(then), std::nullopt};
+    state->values.emplace(std::forward<Args>(args)...);
+    iterate(state);
+  }
+
+  template <class Then>
+  auto then(Then f);
+
+  Pred pred_;
+
+ private:
+  // Handshake between an iteration and its continuation: whoever comes
+  // second starts the next iteration.
+  enum : int { running, returned, completed };
+
+  template <class TaskRunner, class Then, class... Ts>
+  struct loop_state {
+    loop* node;
+    TaskRunner* tr;
+    Then then;
+    // Parameters of the next iteration or the final results.
+    std::optional<std::tuple<Ts...>> values;
+    bool done = false;
+    std::atomic<int> phase = running;
+  };
+
+  template <class State>
+  static void iterate(State* const state) {
+    for (;;) {
+      if (state->done) {
+        std::apply(
+            [state](auto&... results) {
+              std::invoke(state->then, std::move(results)...);
+            },
+            *state->values);
+        delete state;
+        return;
+      }
+      auto values = std::move(*state->values);
+      state->values.reset();
+      state->phase.store(running);
+      std::apply(
+          [state](auto&... values) {
+            static_cast<Body*>(state->node)
+                ->execute(
+                    state->tr,
+                    [state](auto&&... results) {
+                      next(state, std::forward<decltype(results)>(results)...);
+                    },
+                    std::move(values)...);
+          },
+          values);
+      if (state->phase.exchange(returned) != completed) {
+        // Continuation will start the next iteration itself.
+        return;
+      }
+    }
+  }
+
+  template <class State, class... Results>
+  static void next(State* const state, Results&&... results) {
+    state->values.emplace(std::forward<Results>(results)...);
+    state->done = std::apply(
+        [state](const auto&... values) {
+          return static_cast<bool>(std::invoke(state->node->pred_, values...));
+        },
+        *state->values);
+    if (state->phase.exchange(completed) == returned) {
+      iterate(state);
+    }
+  }
+};
+
+template <class Pred, class Body, class F>
+void for_each_child(loop<Pred, Body>& node, F&& f) {
+  std::invoke(f, static_cast<Body&>(node));
+}
+
+// ==================== cost hints ====================
+
+// Execution node annotated with the expected execution time of its subnode.
+// all packs consecutive cheap subnodes into a single task until their total
+// cost reaches detail::coarsening_grain, so wide fan-outs of tiny leaves don't
+// pay for a task, its scheduling and the join per leaf. Subnodes costing more
+// than the grain, as well as ones without hints, still get tasks of their
+// own and spread over workers.
+template <class Node>
+struct cost_hinted : Node {
+  template <class... Args>
+  static constexpr auto result_pack = graph_result_pack<Node, Args...>;
+
+  cost_hinted(Node node, const std::chrono::nanoseconds cost)
+      : Node{std::move(node)}, cost_{cost} {}
+
+  template <class TaskRunner, class Then, class... Args>
+  void execute(TaskRunner* const tr, Then then, Args&&... args) & {
+    Node::execute(tr, std::move(then), std::forward<Args>(args)...);
+  }
+
+  std::chrono::nanoseconds cost() const { return cost_; }
+
+  template <class Then>
+  auto then(Then f);
+
+  std::chrono::nanoseconds cost_;
+};
+
+template <class Node, class F>
+void for_each_child(cost_hinted<Node>& node, F&& f) {
+  std::invoke(f, static_cast<Node&>(node));
+}
+
+// Execution node measuring time from the start of its subnode till its
+// results, and using the moving average as the cost hint (see cost_hinted).
+// Costs are unknown until the first execution finishes. Copies of the node
+// share the average. For asynchronous subnodes this is latency rather than
+// work, which only makes coarsening more conservative.
+template <class Node>
+struct cost_measured : Node {
+  template <class... Args>
+  static constexpr auto result_pack = graph_result_pack<Node, Args...>;
+
+  explicit cost_measured(Node node)
+      : Node{std::move(node)},
+        average_{std::make_shared<std::atomic<std::int64_t>>(-1)} {}
+
+  template <class TaskRunner, class Then, class... Args>
+  void execute(TaskRunner* const tr, Then then, Args&&... args) & {
+    Node::execute(
+        tr,
+        [average = average_.get(), start = std::chrono::steady_clock::now(),
+         then = std::move(then)](auto&&... results) mutable {
+          add_sample(average, std::chrono::steady_clock::now() - start);
+          std::invoke(then, std::forward<decltype(results)>(results)...);
+        },
+        std::forward<Args>(args)...);
+  }
+
+  std::chrono::nanoseconds cost() const {
+    const std::int64_t average = average_->load(std::memory_order_relaxed);
+    return average < 0 ? std::chrono::nanoseconds::max()
+                       : std::chrono::nanoseconds{average};
+  }
+
+  template <class Then>
+  auto then(Then f);
+
+ private:
+  static void add_sample(std::atomic<std::int64_t>* const average,
+                         const std::chrono::nanoseconds sample) {
+    // Concurrent samples may overwrite each other, the average is only a
+    // hint.
+    const std::int64_t old = average->load(std::memory_order_relaxed);
+    const std::int64_t ns = sample.count();
+    average->store(old < 0 ? ns : old + (ns - old) / 8,
+                   std::memory_order_relaxed);
+  }
+
+  // Exponential moving average in nanoseconds, negative when unknown. Shared
+  // since the node is copied (or moved) into its parents.
+  std::shared_ptr<std::atomic<std::int64_t>> average_;
+};
+
+template <class Node, class F>
+void for_each_child(cost_measured<Node>& node, F&& f) {
+  std::invoke(f, static_cast<Node&>(node));
+}
+
+namespace detail {
+
+template <class Node>
+struct has_cost_hint<cost_hinted<Node>> : std::true_type {};
+
+template <class Node>
+struct has_cost_hint<cost_measured<Node>> : std::true_type {};
+
+template <std::size_t I, class Node>
+struct has_cost_hint<numbered<I, Node>> : has_cost_hint<Node> {};
+
+// Whether every branch of all has a cost hint.
+template <class T>
+struct all_hinted : std::false_type {};
+
+template <class... Fs>
+struct all_hinted<all<Fs...>>
+    : std::bool_constant<(... && has_cost_hint_v<Fs>)> {};
+
+}  // namespace detail
+
+// ==================== critical_path ====================
+
+// Ordering execution node. Branches of its subnode, which must be all with
+// cost hints on its branches (see cost_hinted and cost_measured), are posted
+// costliest first rather than in declaration order. With FIFO queues of the
+// task systems that is the order they start in, so a dominant branch
+// declared last doesn't start last and stretch the whole fan-out.
+// Usually made by critical_path_first(), which hints every branch.
+template <class Node>
+struct critical_path : Node {
+  static_assert(detail::is_all<Node>::value,
+                "Subnode of critical_path must be all");
+  // Branches without hints would be posted in declaration order.
+  static_assert(detail::all_hinted<Node>::value,
+                "Branches of critical_path must have cost hints");
+
+  template <class... Args>
+  static constexpr auto result_pack = graph_result_pack<Node, Args...>;
+
+  explicit critical_path(Node node) : Node{std::move(node)} {}
+
+  template <class TaskRunner, class Then, class... Args>
+  void execute(TaskRunner* const tr, Then then, Args&&... args) & {
+    assert(tr != nullptr);
+    // all uses it only while scheduling its branches.
+    detail::longest_first<TaskRunner> order{tr};
+    Node::execute(&order, std::move(then), std::forward<Args>(args)...);
+  }
+
+  template <class Then>
+  auto then(Then f);
+};
+
+template <class Node, class F>
+void for_each_child(critical_path<Node>& node, F&& f) {
+  std::invoke(f, static_cast<Node&>(node));
+}
+
+template <class T, class = void>
+struct is_exec_node : std::false_type {};
+
+template <class F>
+struct is_exec_node<leaf<F>> : std::true_type {};
+
+template <class F, class... Args>
+struct is_exec_node<memo_leaf<F, Args...>> : std::true_type {};
+
+template <class F, class In>
+struct is_exec_node<batched_leaf<F, In>> : std::true_type {};
+
+template <class A, class B>
+struct is_exec_node<seq<A, B>> : std::true_type {};
+
+template <class... Fs>
+struct is_exec_node<all<Fs...>> : std::true_type {};
+
+template <class Policy, class Node>
+struct is_exec_node<distributed<Policy, Node>> : std::true_type {};
+
+template <class T>
+struct is_exec_node<cell_reader<T>> : std::true_type {};
+
+template <class Node>
+struct is_exec_node<incremental<Node>> : std::true_type {};
+
+template <class Runner, class Node>
+struct is_exec_node<on_runner<Runner, Node>> : std::true_type {};
+
+template <class Node>
+struct is_exec_node<concurrency_limiter<Node>> : std::true_type {};
+
+template <class... Fs>
+struct is_exec_node<any<Fs...>> : std::true_type {};
+
+template <class Node>
+struct is_exec_node<hedged<Node>> : std::true_type {};
+
+template <class Sink, class... Fs>
+struct is_exec_node<each<Sink, Fs...>> : std::true_type {};
+
+template <class Selector, class... Fs>
+struct is_exec_node<choice<Selector, Fs...>> : std::true_type {};
+
+template <class Pred, class Body>
+struct is_exec_node<loop<Pred, Body>> : std::true_type {};
+
+template <class Node>
+struct is_exec_node<cost_hinted<Node>> : std::true_type {};
+
+template <class Node>
+struct is_exec_node<cost_measured<Node>> : std::true_type {};
+
+template <class Node>
+struct is_exec_node<critical_path<Node>> : std::true_type {};
+
+template <class Sig, class TaskRunner>
+class any_node;
+
+template <class Sig, class TaskRunner>
+struct is_exec_node<any_node<Sig, TaskRunner>> : std::true_type {};
+
+template <class T>
+constexpr bool is_exec_node_v = is_exec_node<T>::value;
+
+template <class F>
+auto try_transform(F f) {
+  if constexpr (is_exec_node_v<std::decay_t<F>>) {
+    return f;
+  } else {
+    return make_leaf(std::move(f));
+  }
+};
+
+template <class F>
+template <class Then>
+auto leaf<F>::then(Then f) {
+  return make_seq(std::move(*this), try_transform(std::move(f)));
+}
+
+template <class F>
+template <class... Args>
+auto leaf<F>::memoize(std::size_t capacity) {
+  return make_memo_leaf<Args...>(std::move(static_cast<F&>(*this)), capacity);
+}
+
+template <class F, class... Args>
+template <class Then>
+auto memo_leaf<F, Args...>::then(Then f) {
+  return make_seq(std::move(*this), try_transform(std::move(f)));
+}
+
+template <class F, class In>
+template <class Then>
+auto batched_leaf<F, In>::then(Then f) {
+  return make_seq(std::move(*this), try_transform(std::move(f)));
+}
+
+template <class A, class B>
+template <class Then>
+auto seq<A, B>::then(Then f) {
+  return make_seq(std::move(*this), try_transform(std::move(f)));
+}
+
+template <class... Fs>
+template <class Then>
+auto all<Fs...>::then(Then f) {
+  return make_seq(std::move(*this), try_transform(std::move(f)));
+}
+
+template <class Policy, class Node>
+template <class Then>
+auto distributed<Policy, Node>::then(Then f) {
+  return make_seq(std::move(*this), try_transform(std::move(f)));
+}
+
+template <class T>
+template <class Then>
+auto cell_reader<T>::then(Then f) {
+  return make_seq(std::move(*this), try_transform(std::move(f)));
+}
+
+template <class Node>
+template <class Then>
+auto incremental<Node>::then(Then f) {
+  return make_seq(std::move(*this), try_transform(std::move(f)));
+}
+
+template <class Runner, class Node>
+template <class Then>
+auto on_runner<Runner, Node>::then(Then f) {
+  return make_seq(std::move(*this), try_transform(std::move(f)));
+}
+
+template <class Node>
+template <class Then>
+auto concurrency_limiter<Node>::then(Then f) {
+  return make_seq(std::move(*this), try_transform(std::move(f)));
+}
+
+template <class... Fs>
+template <class Then>
+auto any<Fs...>::then(Then f) {
+  return make_seq(std::move(*this), try_transform(std::move(f)));
+}
+
+template <class Node>
+template <class Then>
+auto hedged<Node>::then(Then f) {
+  return make_seq(std::move(*this), try_transform(std::move(f)));
+}
+
+template <class Sink, class... Fs>
+template <class Then>
+auto each<Sink, Fs...>::then(Then f) {
+  return make_seq(std::move(*this), try_transform(std::move(f)));
+}
+
+template <class Selector, class... Fs>
+template <class Then>
+auto choice<Selector, Fs...>::then(Then f) {
+  return make_seq(std::move(*this), try_transform(std::move(f)));
+}
+
+template <class Pred, class Body>
+template <class Then>
+auto loop<Pred, Body>::then(Then f) {
+  return make_seq(std::move(*this), try_transform(std::move(f)));
+}
+
+template <class Node>
+template <class Then>
+auto cost_hinted<Node>::then(Then f) {
+  return make_seq(std::move(*this), try_transform(std::move(f)));
+}
+
+template <class Node>
+template <class Then>
+auto cost_measured<Node>::then(Then f) {
+  return make_seq(std::move(*this), try_transform(std::move(f)));
+}
+
+template <class Node>
+template <class Then>
+auto critical_path<Node>::then(Then f) {
+  return make_seq(std::move(*this), try_transform(std::move(f)));
+}
+
+// ==================== any_node ====================
+
+namespace detail {
+
+template <class R>
+struct erased_then {
+  using type = unique_function<void(R)>;
+};
+
+template <>
+struct erased_then<void> {
+  using type = unique_function<void()>;
+};
+
+}  // namespace detail
+
+// Type erased execution node taking parameters Args... and resulting in R
+// (nothing for void), executed on TaskRunner. Holds any node (or invocable)
+// with such parameters and results, e.g.
+//
+//   tg::any_node<int(int), base::simple_task_runner> node =
+//       tg::when_all(f, g).then(h);
+//
+// Code of the wrapped subtree is instantiated once where the node is made,
+// users of the node see a single type. So erasing subtrees at module
+// boundaries keeps the number of instantiations (and binary size) of large
+// graphs in check, at the cost of an indirect call per execution and an
+// allocation for the type erased Then.
+// Small subtrees are kept inline, bigger ones on the heap. Move-only.
+template <class R, class... Args, class TaskRunner>
+class any_node<R(Args...), TaskRunner> {
+ public:
+  template <class... Ts>
+  static constexpr auto result_pack =
+      std::conditional_t<std::is_void_v<R>, type_pack<>, type_pack<R>>{};
+
+  template <class Node, class = std::enable_if_t<
+                            !std::is_same_v<std::decay_t<Node>, any_node>>>
+  any_node(Node node) {
+    emplace(try_transform(std::move(node)));
+  }
+
+  any_node(any_node&& other) noexcept : ops_{other.ops_} {
+    if (ops_ != nullptr) {
+      ops_->move(&other.storage_, &storage_);
+      other.ops_ = nullptr;
+    }
+  }
+
+  any_node& operator=(any_node&& other) noexcept {
+    if (this != &other) {
+      reset();
+      ops_ = other.ops_;
+      if (ops_ != nullptr) {
+        ops_->move(&other.storage_, &storage_);
+        other.ops_ = nullptr;
+      }
+    }
+    return *this;
+  }
+
+  ~any_node() { reset(); }
+
+  // Task runner wrappers (see profiled) are stripped, the wrapped subtree is
+  // compiled for TaskRunner only.
+  template <class Runner, class Then, class... Ts>
+  void execute(Runner* const tr, Then then, Ts&&... args) & {
+    assert(tr != nullptr);
+    assert(ops_ != nullptr);
+    TaskRunner* const base = detail::underlying_runner(tr);
+    ops_->execute(&storage_, base, then_type{std::move(then)},
+                  std::forward<Ts>(args)...);
+  }
+
+  // Calls f for every cell read inside the wrapped subtree, so incremental
+  // nodes see through the erasure.
+  template <class F>
+  void for_each_cell(F& f) {
+    assert(ops_ != nullptr);
+    ops_->for_each_cell(
+        &storage_,
+        [](void* const context, const versioned_cell_base& cell) {
+          std::invoke(*static_cast<F*>(context), cell);
+        },
+        &f);
+  }
+
+  template <class Then>
+  auto then(Then f) {
+    return make_seq(std::move(*this), try_transform(std::move(f)));
+  }
+
+ private:
+  using then_type = typename detail::erased_then<R>::type;
+  using cell_visitor = void (*)(void* context, const versioned_cell_base&);
+
+  struct ops {
+    void (*execute)(void* node, TaskRunner* tr, then_type&& then,
+                    Args... args);
+    void (*for_each_cell)(void* node, cell_visitor visit, void* context);
+    // Moves node from one storage to another and destroys the original.
+    void (*move)(void* from, void* to) noexcept;
+    void (*destroy)(void* node) noexcept;
+  };
+
+  static constexpr std::size_t inline_size = 6 * sizeof(void*);
+
+  template <class Node>
+  static constexpr bool is_inline =
+      sizeof(Node) <= inline_size &&
+      alignof(Node) <= alignof(std::max_align_t) &&
+      std::is_nothrow_move_constructible_v<Node>;
+
+  template <class Node>
+  static Node* get(void* const storage) {
+    if constexpr (is_inline<Node>) {
+      return std::launder(static_cast<Node*>(storage));
+    } else {
+      return *static_cast<Node**>(storage);
+    }
+  }
+
+  template <class Node>
+  static void execute_node(void* const node, TaskRunner* const tr,
+                           then_type&& then, Args... args) {
+    get<Node>(node)->execute(tr, std::move(then), std::forward<Args>(args)...);
+  }
+
+  template <class Node>
+  static void for_each_node_cell(void* const node, const cell_visitor visit,
+                                 void* const context) {
+    auto f = [visit, context](const versioned_cell_base& cell) {
+      visit(context, cell);
+    };
+    detail::for_each_cell(*get<Node>(node), f);
+  }
+
+  template <class Node>
+  static void move_node(void* const from, void* const to) noexcept {
+    if constexpr (is_inline<Node>) {
+      Node* const node = get<Node>(from);
+      new (to) Node(std::move(*node));
+      node->~Node();
+    } else {
+      *static_cast<Node**>(to) = get<Node>(from);
+    }
+  }
+
+  template <class Node>
+  static void destroy_node(void* const node) noexcept {
+    if constexpr (is_inline<Node>) {
+      get<Node>(node)->~Node();
+    } else {
+      delete get<Node>(node);
+    }
+  }
+
+  template <class Node>
+  static constexpr ops ops_for = {&execute_node<Node>,
+                                  &for_each_node_cell<Node>, &move_node<Node>,
+                                  &destroy_node<Node>};
+
+  template <class Node>
+  void emplace(Node node) {
+    if constexpr (is_inline<Node>) {
+      new (&storage_) Node(std::move(node));
+    } else {
+      *reinterpret_cast<Node**>(&storage_) = new Node(std::move(node));
+    }
+    ops_ = &ops_for<Node>;
+  }
+
+  void reset() {
+    if (ops_ != nullptr) {
+      ops_->destroy(&storage_);
+      ops_ = nullptr;
+    }
+  }
+
+ private:
+  alignas(std::max_align_t) unsigned char storage_[inline_size];
+  const ops* ops_ = nullptr;
+};
+
+namespace detail {
+
+template <class... Nodes, std::size_t... Is>
+constexpr bool distinct(type_pack<Nodes...> nodes,
+                        std::index_sequence<Is...>) {
+  return (... && (tp::find<Nodes>(nodes) == Is));
+}
+
+template <class Make, std::size_t... Is, class... Nodes>
+auto make_distinct_impl(Make& make, std::index_sequence<Is...> is,
+                        Nodes... nodes) {
+  if constexpr (distinct(type_pack_v<Nodes...>, is)) {
+    return make(std::move(nodes)...);
+  } else {
+    return make(numbered<Is, Nodes>{std::move(nodes)}...);
+  }
+}
+
+// Returns make(nodes...), numbering nodes if some of them have the same
+// type, since nodes with several subnodes derive from all of them.
+template <class Make, class... Nodes>
+auto make_distinct(Make make, Nodes... nodes) {
+  return make_distinct_impl(make, std::index_sequence_for<Nodes...>{},
+                            std::move(nodes)...);
+}
+
+}  // namespace detail
+
+template <class... Fs>
+auto when_all(Fs... fs) {
+  return detail::make_distinct(
+      [](auto... nodes) { return make_all(std::move(nodes)...); },
+      try_transform(std::move(fs))...);
+}
+
+// Executes branches of all on shards chosen by policy, see distributed.
+template <class Policy, class... Fs>
+auto distribute(Policy policy, all<Fs...> node) {
+  return distributed<Policy, all<Fs...>>{std::move(policy), std::move(node)};
+}
+
+// Executes node (or invocable) on runner, see on_runner.
+template <class Runner, class Node>
+auto on(Runner* const runner, Node node) {
+  auto tree = try_transform(std::move(node));
+  return on_runner<Runner, decltype(tree)>{runner, std::move(tree)};
+}
+
+// Lets at most limit executions of node (or invocable) run at once, see
+// concurrency_limiter.
+template <class Node>
+auto limit_concurrency(const std::size_t limit, Node node) {
+  auto tree = try_transform(std::move(node));
+  return concurrency_limiter<decltype(tree)>{limit, std::move(tree)};
+}
+
+// Forwards results of the first finished of nodes (or invocables), see any.
+template <class... Fs>
+auto when_any(Fs... fs) {
+  return detail::make_distinct(
+      [](auto... nodes) { return make_any(std::move(nodes)...); },
+      try_transform(std::move(fs))...);
+}
+
+// Starts a second execution of node (or invocable) if the first one takes
+// longer than delay, see hedged.
+template <class Node>
+auto hedge(Node node, const std::chrono::steady_clock::duration delay) {
+  auto tree = try_transform(std::move(node));
+  return hedged<decltype(tree)>{std::move(tree), delay};
+}
+
+// Passes results of every node (or invocable) to sink as soon as it
+// finishes, see each.
+template <class Sink, class... Fs>
+auto when_each(Sink sink, Fs... fs) {
+  return detail::make_distinct(
+      [&sink](auto... nodes) {
+        return each<Sink, decltype(nodes)...>{std::move(sink),
+                                              std::move(nodes)...};
+      },
+      try_transform(std::move(fs))...);
+}
+
+// Executes the node (or invocable) at index selector(args...), see choice.
+template <class Selector, class... Fs>
+auto switch_(Selector selector, Fs... fs) {
+  return detail::make_distinct(
+      [&selector](auto... nodes) {
+        return make_choice(std::move(selector), std::move(nodes)...);
+      },
+      try_transform(std::move(fs))...);
+}
+
+// Executes then_node if pred(args...) is true and else_node otherwise, see
+// choice.
+template <class Pred, class Then, class Else>
+auto if_(Pred pred, Then then_node, Else else_node) {
+  return switch_(
+      [pred = std::move(pred)](const auto&... args) mutable -> std::size_t {
+        return std::invoke(pred, args...) ? 0 : 1;
+      },
+      std::move(then_node), std::move(else_node));
+}
+
+// Executes body (node or invocable) until pred of its results is true, see
+// loop.
+template <class Pred, class Body>
+auto repeat_until(Pred pred, Body body) {
+  auto tree = try_transform(std::move(body));
+  return loop<Pred, decltype(tree)>{std::move(pred), std::move(tree)};
+}
+
+// Annotates node (or invocable) with its expected execution time, see
+// cost_hinted.
+template <class Node>
+auto with_cost(Node node, const std::chrono::nanoseconds cost) {
+  auto tree = try_transform(std::move(node));
+  return cost_hinted<decltype(tree)>{std::move(tree), cost};
+}
+
+// Estimates execution time of node (or invocable) from its past executions,
+// see cost_measured.
+template <class Node>
+auto measure_cost(Node node) {
+  auto tree = try_transform(std::move(node));
+  return cost_measured<decltype(tree)>{std::move(tree)};
+}
+
+namespace detail {
+
+template <class Node>
+auto with_measured_cost(Node node) {
+  if constexpr (has_cost_hint_v<Node>) {
+    return node;
+  } else {
+    return cost_measured<Node>{std::move(node)};
+  }
+}
+
+}  // namespace detail
+
+// Posts branches of node costliest first, see critical_path. Branches without
+// cost hints get measured ones, so the order follows execution times
+// recorded by past executions of node and its copies.
+template <class... Fs>
+auto critical_path_first(all<Fs...> node) {
+  auto tree = make_all(
+      detail::with_measured_cost(std::move(static_cast<Fs&>(node)))...);
+  return critical_path<decltype(tree)>{std::move(tree)};
+}
+
+// Executes tree with parameters args on tr and waits until then has been
+// called with its results. Every task of the execution must run, so
+// std::invalid_argument is thrown if tr may discard tasks (see
+// overflow_policy::drop_oldest).
+template <class TaskRunner, class ExecTree, class Then, class... Args>
+void sync_execute(TaskRunner* tr, ExecTree* tree, Then then, Args... args) {
+  assert(tr != nullptr);
+  assert(tree != nullptr);
+  detail::check_keeps_tasks(tr);
+  base::manual_event finish_event;
+  std::atomic<bool> finished = false;
   tree->execute(
       tr,
-      [&finish_event, &then](auto&&... args) {
+      [&finish_event, &finished, &then](auto&&... args) {
         then(std::forward<decltype(args)>(args)...);
+        finished.store(true);
         finish_event.notify();
       },
       std::move(args)...);
+  if constexpr (detail::runs_pending_tasks<TaskRunner>::value) {
+    // Nested sync_execute inside a task: tasks of the execution may be queued
+    // behind the calling one (e.g. on an inline task system), so the thread
+    // executes them instead of waiting for itself.
+    if (detail::running_in(tr)) {
+      while (!finished.load() && tr->run_pending_task()) {
+      }
+    }
+  }
+  // Nested sync_execute inside a task must not leave its task system short of
+  // a worker.
+  base::blocking_region blocking;
   finish_event.wait();
 }
 
+// Like sync_execute, but every task of the execution works for tenant, so
+// a fair task system (see fair_task_system) shares its workers between this
+// and executions of other tenants.
+template <class TaskRunner, class ExecTree, class Then, class... Args>
+void sync_execute_as(const tenant_id tenant, TaskRunner* tr, ExecTree* tree,
+                     Then then, Args... args) {
+  scoped_tenant scope{tenant};
+  sync_execute(tr, tree, std::move(then), std::move(args)...);
+}
+
 }  // namespace base::task_graph
 
 #endif  // _TASK_GRAPH_H_
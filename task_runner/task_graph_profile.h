@@ -0,0 +1,416 @@
+#ifndef _TASK_GRAPH_PROFILE_H_
+#define _TASK_GRAPH_PROFILE_H_
+
+#include <cassert>
+#include <chrono>
+#include <cstddef>
+#include <cstdio>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <type_traits>
+#include <utility>
+
+#include "histogram.h"
+#include "task_graph.h"
+
+namespace base::task_graph {
+
+// Statistics of a single node of an instrumented tree.
+struct node_stats {
+  // Position of the node in the tree, e.g. "0.1.3" is the fourth subnode of
+  // the second subnode of the root.
+  std::string path;
+  // Kind of the node ("leaf", "seq", "all", ...).
+  std::string kind;
+  // Time from the start of the node execution till its results are ready.
+  latency_histogram exec_time;
+  // Time tasks scheduled by the node itself (e.g. branches of all) spend in
+  // the task runner queue.
+  latency_histogram queue_wait;
+};
+
+// Owner of statistics of instrumented trees, see instrument().
+class graph_profile {
+ public:
+  node_stats* add(std::string path, std::string kind) {
+    std::unique_lock guard{mtx_};
+    auto& stats = nodes_.emplace_back();
+    stats.path = std::move(path);
+    stats.kind = std::move(kind);
+    return &stats;
+  }
+
+  // Calls f for statistics of every instrumented node.
+  template <class F>
+  void for_each(F&& f) const {
+    std::unique_lock guard{mtx_};
+    for (const auto& stats : nodes_) {
+      std::invoke(f, stats);
+    }
+  }
+
+ private:
+  mutable std::mutex mtx_;
+  // Deque keeps addresses of statistics stable.
+  std::deque<node_stats> nodes_;
+};
+
+namespace detail {
+
+template <class T>
+const char* node_kind(const T&) {
+  return "node";
+}
+
+template <class F>
+const char* node_kind(const leaf<F>&) {
+  return "leaf";
+}
+
+template <class F, class... Args>
+const char* node_kind(const memo_leaf<F, Args...>&) {
+  return "memo_leaf";
+}
+
+template <class F, class In>
+const char* node_kind(const batched_leaf<F, In>&) {
+  return "batched_leaf";
+}
+
+template <class A, class B>
+const char* node_kind(const seq<A, B>&) {
+  return "seq";
+}
+
+template <class... Fs>
+const char* node_kind(const all<Fs...>&) {
+  return "all";
+}
+
+template <class Policy, class Node>
+const char* node_kind(const distributed<Policy, Node>&) {
+  return "distributed";
+}
+
+template <class Node>
+const char* node_kind(const incremental<Node>&) {
+  return "incremental";
+}
+
+template <class Runner, class Node>
+const char* node_kind(const on_runner<Runner, Node>&) {
+  return "on_runner";
+}
+
+template <class Node>
+const char* node_kind(const concurrency_limiter<Node>&) {
+  return "concurrency_limiter";
+}
+
+template <class... Fs>
+const char* node_kind(const any<Fs...>&) {
+  return "any";
+}
+
+template <class Node>
+const char* node_kind(const hedged<Node>&) {
+  return "hedged";
+}
+
+template <class Sink, class... Fs>
+const char* node_kind(const each<Sink, Fs...>&) {
+  return "each";
+}
+
+template <class Selector, class... Fs>
+const char* node_kind(const choice<Selector, Fs...>&) {
+  return "choice";
+}
+
+template <class Pred, class Body>
+const char* node_kind(const loop<Pred, Body>&) {
+  return "loop";
+}
+
+template <class Node>
+const char* node_kind(const cost_hinted<Node>&) {
+  return "cost_hinted";
+}
+
+template <class Node>
+const char* node_kind(const cost_measured<Node>&) {
+  return "cost_measured";
+}
+
+template <class Node>
+const char* node_kind(const critical_path<Node>&) {
+  return "critical_path";
+}
+
+template <class Sig, class TaskRunner>
+const char* node_kind(const any_node<Sig, TaskRunner>&) {
+  return "any_node";
+}
+
+template <std::size_t I, class Node>
+const char* node_kind(const numbered<I, Node>& node) {
+  return node_kind(static_cast<const Node&>(node));
+}
+
+// Task runner measuring how long tasks wait in the queue of the underlying
+// one.
+template <class TaskRunner>
+class timed_runner {
+ public:
+  using clock = std::chrono::steady_clock;
+
+  timed_runner(TaskRunner* const base, node_stats* const stats)
+      : base_{base}, stats_{stats} {}
+
+  template <class F, class... Args>
+  void run(F&& f, Args&&... args) {
+    base_->run(timed(std::forward<F>(f)), std::forward<Args>(args)...);
+  }
+
+  // Sharding interface, so distributed works in instrumented trees. Only
+  // used if the underlying runner is sharded.
+  std::size_t shard_count() const { return base_->shard_count(); }
+
+  std::size_t current_worker_index() const {
+    return base_->current_worker_index();
+  }
+
+  template <class F, class... Args>
+  void run_on(const std::size_t shard, F&& f, Args&&... args) {
+    base_->run_on(shard, timed(std::forward<F>(f)),
+                  std::forward<Args>(args)...);
+  }
+
+  bool running_in_this_thread() const { return running_in(base_); }
+
+  TaskRunner* base() const { return base_; }
+
+ private:
+  template <class F>
+  auto timed(F&& f) const {
+    return [stats = stats_, scheduled = clock::now(),
+            f = std::forward<F>(f)](auto&&... args) mutable {
+      stats->queue_wait.record(clock::now() - scheduled);
+      std::invoke(std::move(f), std::forward<decltype(args)>(args)...);
+    };
+  }
+
+  TaskRunner* const base_;
+  node_stats* const stats_;
+};
+
+template <class TaskRunner>
+struct runner_unwrapper<timed_runner<TaskRunner>> {
+  static TaskRunner* get(timed_runner<TaskRunner>* const tr) {
+    return tr->base();
+  }
+};
+
+template <class T>
+struct is_leaf_node : std::false_type {};
+
+template <class F>
+struct is_leaf_node<leaf<F>> : std::true_type {};
+
+}  // namespace detail
+
+// Instrumenting execution node. Records execution time of its subnode and
+// time tasks scheduled by the subnode wait in the queue to the statistics.
+// Made by instrument().
+template <class Node>
+struct profiled : Node {
+  template <class... Args>
+  static constexpr auto result_pack = graph_result_pack<Node, Args...>;
+
+  profiled(Node node, node_stats* const stats)
+      : Node{std::move(node)}, stats_{stats} {
+    assert(stats_ != nullptr);
+  }
+
+  template <class TaskRunner, class Then, class... Args>
+  void execute(TaskRunner* const tr, Then then, Args&&... args) & {
+    assert(tr != nullptr);
+    using clock = std::chrono::steady_clock;
+    auto* const base = detail::underlying_runner(tr);
+    using base_type = std::remove_pointer_t<decltype(base)>;
+
+    if constexpr (detail::is_leaf_node<Node>::value) {
+      // Leaves never schedule anything.
+      Node::execute(
+          base,
+          [stats = stats_, start = clock::now(),
+           then = std::move(then)](auto&&... results) mutable {
+            stats->exec_time.record(clock::now() - start);
+            std::invoke(then, std::forward<decltype(results)>(results)...);
+          },
+          std::forward<Args>(args)...);
+    } else {
+      // Subtree may use the task runner until it calls Then, so the runner
+      // lives exactly that long.
+      auto* const timed = new detail::timed_runner<base_type>{base, stats_};
+      Node::execute(
+          timed,
+          [stats = stats_, timed, start = clock::now(),
+           then = std::move(then)](auto&&... results) mutable {
+            stats->exec_time.record(clock::now() - start);
+            delete timed;
+            std::invoke(then, std::forward<decltype(results)>(results)...);
+          },
+          std::forward<Args>(args)...);
+    }
+  }
+
+  template <class Then>
+  auto then(Then f);
+
+  const node_stats& stats() const { return *stats_; }
+
+  node_stats* stats_;
+};
+
+template <class Node, class F>
+void for_each_child(profiled<Node>& node, F&& f) {
+  for_each_child(static_cast<Node&>(node), std::forward<F>(f));
+}
+
+template <class Node>
+struct is_exec_node<profiled<Node>> : std::true_type {};
+
+namespace detail {
+
+// Instrumented cell readers still report their cells to incremental.
+template <class Node>
+struct is_cell_reader<profiled<Node>> : is_cell_reader<Node> {};
+
+// Instrumented nodes keep cost hints of the nodes they wrap (cost() is
+// inherited), so all still groups cheap branches.
+template <class Node>
+struct has_cost_hint<profiled<Node>> : has_cost_hint<Node> {};
+
+}  // namespace detail
+
+template <class Node>
+template <class Then>
+auto profiled<Node>::then(Then f) {
+  return make_seq(std::move(*this), try_transform(std::move(f)));
+}
+
+namespace detail {
+
+template <class Node>
+auto instrument_impl(Node node, graph_profile* profile, std::string path);
+
+template <class Node>
+auto instrument_children(Node node, graph_profile*, const std::string&) {
+  return node;
+}
+
+template <class A, class B>
+auto instrument_children(seq<A, B> node, graph_profile* const profile,
+                         const std::string& path) {
+  return make_seq(
+      instrument_impl(std::move(static_cast<A&>(node)), profile, path + ".0"),
+      instrument_impl(std::move(static_cast<B&>(node)), profile, path + ".1"));
+}
+
+template <std::size_t I, class Node>
+auto instrument_children(numbered<I, Node> node, graph_profile* const profile,
+                         const std::string& path) {
+  auto tree = instrument_children(std::move(static_cast<Node&>(node)), profile,
+                                  path);
+  return numbered<I, decltype(tree)>{std::move(tree)};
+}
+
+template <class... Fs, std::size_t... Is>
+auto instrument_all(all<Fs...> node, graph_profile* const profile,
+                    const std::string& path, std::index_sequence<Is...>) {
+  return make_all(instrument_impl(std::move(static_cast<Fs&>(node)), profile,
+                                  path + "." + std::to_string(Is))...);
+}
+
+template <class... Fs>
+auto instrument_children(all<Fs...> node, graph_profile* const profile,
+                         const std::string& path) {
+  return instrument_all(std::move(node), profile, path,
+                        std::index_sequence_for<Fs...>{});
+}
+
+template <class Node>
+auto instrument_impl(Node node, graph_profile* const profile,
+                     std::string path) {
+  const char* const kind = node_kind(node);
+  auto tree = instrument_children(std::move(node), profile, path);
+  auto* const stats = profile->add(std::move(path), kind);
+  return profiled<decltype(tree)>{std::move(tree), stats};
+}
+
+template <class Node>
+void append_dot(Node& node, const std::string& id, std::string* const out);
+
+template <class Node>
+void append_dot_node(const Node& node, const std::string& id,
+                     std::string* const out) {
+  *out += "  \"" + id + "\" [label=\"" + node_kind(node) + "\"];\n";
+}
+
+template <class Node>
+void append_dot_node(const profiled<Node>& node, const std::string& id,
+                     std::string* const out) {
+  const auto& stats = node.stats();
+  const auto us = [](latency_histogram::duration d) {
+    char buf[32];
+    std::snprintf(buf, sizeof(buf), "%.1f",
+                  static_cast<double>(d.count()) / 1000);
+    return std::string{buf};
+  };
+  *out += "  \"" + id + "\" [label=\"" + stats.kind + " " + stats.path +
+          "\\ncalls: " + std::to_string(stats.exec_time.count()) +
+          "\\np50: " + us(stats.exec_time.percentile(0.5)) +
+          " us, p99: " + us(stats.exec_time.percentile(0.99)) +
+          " us\\nqueue p99: " + us(stats.queue_wait.percentile(0.99)) +
+          " us\"];\n";
+}
+
+template <class Node>
+void append_dot(Node& node, const std::string& id, std::string* const out) {
+  append_dot_node(node, id, out);
+  std::size_t i = 0;
+  for_each_child(node, [&](auto& child) {
+    const auto child_id = id + "." + std::to_string(i++);
+    *out += "  \"" + id + "\" -> \"" + child_id + "\";\n";
+    append_dot(child, child_id, out);
+  });
+}
+
+}  // namespace detail
+
+// Wraps every node of leaf/seq/all tree (and other nodes as opaque subtrees)
+// into profiled, so it accumulates its latency histograms in profile.
+// Nodes are keyed by their position in the tree. Profile must outlive the
+// tree.
+template <class Node>
+auto instrument(Node node, graph_profile* const profile) {
+  assert(profile != nullptr);
+  return detail::instrument_impl(try_transform(std::move(node)), profile, "0");
+}
+
+// Graphviz DOT representation of the tree. Nodes of instrumented trees are
+// annotated with call counts and latency percentiles.
+template <class Node>
+std::string to_dot(Node& tree) {
+  std::string result = "digraph task_graph {\n  node [shape=box];\n";
+  detail::append_dot(tree, "0", &result);
+  result += "}\n";
+  return result;
+}
+
+}  // namespace base::task_graph
+
+#endif  // _TASK_GRAPH_PROFILE_H_
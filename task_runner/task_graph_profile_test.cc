@@ -0,0 +1,171 @@
+#include "task_graph_profile.h"
+
+#include <chrono>
+#include <map>
+#include <string>
+#include <thread>
+
+#include "catch2/catch_all.hpp"
+#include "task_runner.h"
+
+namespace tg = base::task_graph;
+
+TEST_CASE("task_graph_profile_test", "[task_graph_profile]") {
+  base::simple_task_runner tr;
+  tg::graph_profile profile;
+
+  auto node = tg::instrument(
+      tg::when_all(
+          [](int val) {
+            std::this_thread::sleep_for(std::chrono::milliseconds{2});
+            return val + 1;
+          },
+          [](int val) { return val * 2; })
+          .then([](int a, int b) { return a + b; }),
+      &profile);
+
+  constexpr int runs = 10;
+  for (int i = 0; i < runs; ++i) {
+    int result = 0;
+    tg::sync_execute(&tr, &node, [&result](int val) { result = val; }, 3);
+    REQUIRE(result == 10);
+  }
+
+  std::map<std::string, const tg::node_stats*> stats;
+  profile.for_each([&stats](const tg::node_stats& s) { stats[s.path] = &s; });
+
+  REQUIRE(stats.size() == 5);
+  REQUIRE(stats["0"]->kind == "seq");
+  REQUIRE(stats["0.0"]->kind == "all");
+  REQUIRE(stats["0.0.0"]->kind == "leaf");
+  REQUIRE(stats["0.0.1"]->kind == "leaf");
+  REQUIRE(stats["0.1"]->kind == "leaf");
+  for (auto& [path, s] : stats) {
+    REQUIRE(s->exec_time.count() == runs);
+  }
+  // Both branches of all were scheduled.
+  REQUIRE(stats["0.0"]->queue_wait.count() == 2 * runs);
+  // Slow branch is the bottleneck of the whole tree.
+  REQUIRE(stats["0.0.0"]->exec_time.percentile(0.5) >=
+          std::chrono::milliseconds{2});
+  REQUIRE(stats["0"]->exec_time.percentile(0.5) >=
+          stats["0.0.0"]->exec_time.percentile(0.5));
+
+  const auto dot = tg::to_dot(node);
+  REQUIRE(dot.find("digraph") == 0);
+  REQUIRE(dot.find("\"0.0\" -> \"0.0.1\"") != std::string::npos);
+  REQUIRE(dot.find("calls: 10") != std::string::npos);
+}
+
+TEST_CASE("task_graph_profile_race_test", "[task_graph_profile]") {
+  base::simple_task_runner tr;
+  tg::graph_profile profile;
+
+  // The slow racer keeps scheduling tasks after the race is over.
+  auto slow = tg::when_all([](int val) {
+                std::this_thread::sleep_for(std::chrono::milliseconds{5});
+                return val;
+              }).then(tg::when_all([](int val) { return val; }));
+  constexpr int runs = 10;
+  {
+    auto node = tg::instrument(
+        tg::when_any(std::move(slow), [](int val) { return val; }), &profile);
+    for (int i = 0; i < runs; ++i) {
+      int result = 0;
+      tg::sync_execute(&tr, &node, [&result](int val) { result = val; }, i);
+      REQUIRE(result == i);
+    }
+    // The node waits for the losers on destruction.
+  }
+
+  std::map<std::string, const tg::node_stats*> stats;
+  profile.for_each([&stats](const tg::node_stats& s) { stats[s.path] = &s; });
+  REQUIRE(stats["0"]->kind == "any");
+  REQUIRE(stats["0"]->exec_time.count() == runs);
+}
+
+TEST_CASE("task_graph_profile_any_node_test", "[task_graph_profile]") {
+  using int_node = tg::any_node<int(int), base::simple_task_runner>;
+  base::simple_task_runner tr;
+  tg::graph_profile profile;
+
+  int_node erased = tg::when_all([](int val) { return val + 1; },
+                                 [](int val) { return val * 2; })
+                        .then([](int a, int b) { return a + b; });
+  auto node = tg::instrument(
+      tg::when_all(std::move(erased), int_node{[](int val) { return val; }})
+          .then([](int a, int b) { return a + b; }),
+      &profile);
+
+  int result = 0;
+  tg::sync_execute(&tr, &node, [&result](int val) { result = val; }, 2);
+  REQUIRE(result == 9);
+
+  std::map<std::string, const tg::node_stats*> stats;
+  profile.for_each([&stats](const tg::node_stats& s) { stats[s.path] = &s; });
+  // Erased subtrees are opaque.
+  REQUIRE(stats.size() == 5);
+  REQUIRE(stats["0.0"]->kind == "all");
+  REQUIRE(stats["0.0.0"]->kind == "any_node");
+  REQUIRE(stats["0.0.1"]->kind == "any_node");
+  REQUIRE(stats["0.0.0"]->exec_time.count() == 1);
+}
+
+TEST_CASE("task_graph_profile_repeated_test", "[task_graph_profile]") {
+  base::simple_task_runner tr;
+  tg::graph_profile profile;
+
+  const auto make_branch = [] {
+    return tg::when_all([](int val) { return val; }).then([](int val) {
+      return val + 1;
+    });
+  };
+  // Branches of the same type are numbered, their subtrees are instrumented
+  // all the same.
+  auto node = tg::instrument(tg::when_all(make_branch(), make_branch()),
+                             &profile);
+
+  int result = 0;
+  tg::sync_execute(&tr, &node, [&result](int a, int b) { result = a + b; },
+                   2);
+  REQUIRE(result == 6);
+
+  std::map<std::string, const tg::node_stats*> stats;
+  profile.for_each([&stats](const tg::node_stats& s) { stats[s.path] = &s; });
+  REQUIRE(stats.size() == 9);
+  REQUIRE(stats["0.1"]->kind == "seq");
+  REQUIRE(stats["0.1.0"]->kind == "all");
+  REQUIRE(stats["0.1.0.0"]->kind == "leaf");
+  REQUIRE(stats["0.1.1"]->kind == "leaf");
+  REQUIRE(stats["0.1.0"]->exec_time.count() == 1);
+}
+
+TEST_CASE("task_graph_profile_incremental_test", "[task_graph_profile]") {
+  base::simple_task_runner tr;
+  tg::graph_profile profile;
+  base::versioned_cell<int> a{1};
+  base::versioned_cell<int> b{2};
+
+  auto node = tg::make_incremental(tg::instrument(
+      tg::when_all(tg::read_cell(a), tg::read_cell(b)).then([](int x, int y) {
+        return x + y;
+      }),
+      &profile));
+
+  int result = 0;
+  auto setter = [&result](int val) { result = val; };
+  tg::sync_execute(&tr, &node, setter);
+  REQUIRE(result == 3);
+  // Instrumented readers are still watched.
+  a.set(10);
+  tg::sync_execute(&tr, &node, setter);
+  REQUIRE(result == 12);
+}
+
+TEST_CASE("task_graph_to_dot_test", "[task_graph_profile]") {
+  auto node = tg::when_all([] {}, [] {}).then([] {});
+  const auto dot = tg::to_dot(node);
+  REQUIRE(dot.find("\"0\" [label=\"seq\"]") != std::string::npos);
+  REQUIRE(dot.find("\"0.0\" [label=\"all\"]") != std::string::npos);
+  REQUIRE(dot.find("\"0.0\" -> \"0.0.1\"") != std::string::npos);
+}
@@ -1,10 +1,25 @@
 #include "task_graph.h"
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
 #include <numeric>
 #include <set>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <variant>
+#include <vector>
 
 #include "catch2/catch_all.hpp"
 #include "event.h"
+#include "task_graph_profile.h"
 #include "task_runner.h"
 
 namespace tg = base::task_graph;
@@ -187,3 +202,969 @@ TEST_CASE("task_graph_eval_unite_test", "[task_graph]") {
   tg::sync_execute(&tr, &node, setter, 0);
   REQUIRE(result == 2 * simple_func(0));
 }
+
+TEST_CASE("task_graph_memo_leaf_test", "[task_graph]") {
+  base::simple_task_runner tr;
+  std::atomic<int> calls = 0;
+
+  auto node = tg::when_all(tg::make_memo_leaf<int>(
+                               [&calls](int val) {
+                                 ++calls;
+                                 return val * 2;
+                               },
+                               16),
+                           [](int val) { return val + 1; })
+                  .then([](int a, int b) { return a + b; });
+
+  int result;
+  auto setter = [&result](int val) { result = val; };
+
+  tg::sync_execute(&tr, &node, setter, 5);
+  REQUIRE(result == 5 * 2 + 5 + 1);
+  tg::sync_execute(&tr, &node, setter, 5);
+  REQUIRE(result == 5 * 2 + 5 + 1);
+  REQUIRE(calls == 1);
+
+  tg::sync_execute(&tr, &node, setter, 7);
+  REQUIRE(result == 7 * 2 + 7 + 1);
+  REQUIRE(calls == 2);
+}
+
+TEST_CASE("task_graph_memoize_test", "[task_graph]") {
+  base::simple_task_runner tr;
+  int calls = 0;
+
+  auto node = tg::leaf{[&calls](int a, int b) {
+                ++calls;
+                return a * b;
+              }}
+                  .memoize<int, int>(4)
+                  .then([](int val) { return val + 1; });
+
+  int result;
+  auto setter = [&result](int val) { result = val; };
+
+  for (int i = 0; i < 3; ++i) {
+    tg::sync_execute(&tr, &node, setter, 3, 4);
+    REQUIRE(result == 13);
+  }
+  REQUIRE(calls == 1);
+}
+
+TEST_CASE("task_graph_incremental_test", "[task_graph]") {
+  base::simple_task_runner tr;
+  base::versioned_cell<int> a{1};
+  base::versioned_cell<int> b{10};
+  std::atomic<int> a_calls = 0;
+  std::atomic<int> b_calls = 0;
+
+  auto node =
+      tg::make_incremental(
+          tg::when_all(tg::make_incremental(tg::read_cell(a).then([&](int v) {
+                         ++a_calls;
+                         return v * 2;
+                       })),
+                       tg::make_incremental(tg::read_cell(b).then([&](int v) {
+                         ++b_calls;
+                         return v * 3;
+                       })))
+              .then([](int x, int y) { return x + y; }));
+
+  int result;
+  auto setter = [&result](int val) { result = val; };
+
+  tg::sync_execute(&tr, &node, setter);
+  REQUIRE(result == 1 * 2 + 10 * 3);
+  REQUIRE(a_calls == 1);
+  REQUIRE(b_calls == 1);
+
+  // Nothing has changed: whole tree is skipped.
+  tg::sync_execute(&tr, &node, setter);
+  REQUIRE(result == 1 * 2 + 10 * 3);
+  REQUIRE(a_calls == 1);
+  REQUIRE(b_calls == 1);
+
+  // Only the branch reading changed cell is re-executed.
+  a.set(5);
+  tg::sync_execute(&tr, &node, setter);
+  REQUIRE(result == 5 * 2 + 10 * 3);
+  REQUIRE(a_calls == 2);
+  REQUIRE(b_calls == 1);
+
+  b.set(20);
+  tg::sync_execute(&tr, &node, setter);
+  REQUIRE(result == 5 * 2 + 20 * 3);
+  REQUIRE(a_calls == 2);
+  REQUIRE(b_calls == 2);
+}
+
+TEST_CASE("task_graph_incremental_numbered_test", "[task_graph]") {
+  base::simple_task_runner tr;
+  base::versioned_cell<int> a{1};
+  base::versioned_cell<int> b{2};
+  std::atomic<int> calls = 0;
+
+  // Readers of the same type are numbered by when_all.
+  auto node = tg::make_incremental(
+      tg::when_all(tg::read_cell(a), tg::read_cell(b)).then([&](int x, int y) {
+        ++calls;
+        return x + y;
+      }));
+
+  int result = 0;
+  auto setter = [&result](int val) { result = val; };
+  tg::sync_execute(&tr, &node, setter);
+  REQUIRE(result == 3);
+  REQUIRE(calls == 1);
+
+  a.set(10);
+  tg::sync_execute(&tr, &node, setter);
+  REQUIRE(result == 12);
+  REQUIRE(calls == 2);
+
+  b.set(20);
+  tg::sync_execute(&tr, &node, setter);
+  REQUIRE(result == 30);
+  REQUIRE(calls == 3);
+}
+
+TEST_CASE("task_graph_incremental_any_node_test", "[task_graph]") {
+  base::simple_task_runner tr;
+  base::versioned_cell<int> a{1};
+  base::versioned_cell<int> b{2};
+
+  // Cells are found through the erased subtree, also when it's numbered.
+  auto node = tg::make_incremental(
+      tg::when_all(tg::any_node<int(), base::simple_task_runner>{
+                       tg::read_cell(a).then([](int x) { return x * 2; })},
+                   tg::any_node<int(), base::simple_task_runner>{
+                       tg::read_cell(b)})
+          .then([](int x, int y) { return x + y; }));
+
+  int result = 0;
+  auto setter = [&result](int val) { result = val; };
+  tg::sync_execute(&tr, &node, setter);
+  REQUIRE(result == 4);
+
+  a.set(5);
+  tg::sync_execute(&tr, &node, setter);
+  REQUIRE(result == 12);
+
+  b.set(7);
+  tg::sync_execute(&tr, &node, setter);
+  REQUIRE(result == 17);
+}
+
+namespace {
+
+struct copy_counter {
+  copy_counter() = default;
+  copy_counter(const copy_counter& other) : copies{other.copies} {
+    ++*copies;
+  }
+  copy_counter(copy_counter&&) = default;
+
+  std::shared_ptr<std::atomic<int>> copies =
+      std::make_shared<std::atomic<int>>(0);
+};
+
+}  // namespace
+
+TEST_CASE("task_graph_all_broadcast_test", "[task_graph]") {
+  base::simple_task_runner tr;
+
+  auto node =
+      tg::when_all([](const copy_counter& c) { return *c.copies == 1; },
+                   [](const copy_counter& c) { return *c.copies == 1; },
+                   [](const copy_counter& c) { return *c.copies == 1; },
+                   [](const copy_counter& c) { return *c.copies == 1; })
+          .then([](auto... oks) { return (... && oks); });
+
+  copy_counter counter;
+  bool result = false;
+  tg::sync_execute(&tr, &node, [&result](bool val) { result = val; }, counter);
+  REQUIRE(result);
+  // The only copy is made by sync_execute, all branches share it.
+  REQUIRE(*counter.copies == 1);
+}
+
+TEST_CASE("task_graph_seq_moves_test", "[task_graph]") {
+  base::simple_task_runner tr;
+
+  auto node = tg::leaf{[] { return std::vector<int>(100, 1); }}
+                  .then([](std::vector<int>&& v) {
+                    v.push_back(1);
+                    return std::move(v);
+                  })
+                  .then([](std::vector<int>&& v) { return v.size(); });
+
+  std::size_t result = 0;
+  tg::sync_execute(&tr, &node, [&result](std::size_t val) { result = val; });
+  REQUIRE(result == 101);
+}
+
+TEST_CASE("task_graph_all_rvalue_branch_test", "[task_graph]") {
+  base::simple_task_runner tr;
+
+  // Branches taking parameters by rvalue reference get their own copies.
+  auto node =
+      tg::when_all([](std::vector<int>&& v) { return v.size(); },
+                   [](const std::vector<int>& v) { return v.size(); })
+          .then([](std::size_t a, std::size_t b) { return a + b; });
+
+  std::size_t result = 0;
+  tg::sync_execute(&tr, &node, [&result](std::size_t val) { result = val; },
+                   std::vector<int>(10));
+  REQUIRE(result == 20);
+}
+
+TEST_CASE("task_graph_all_result_layout_test", "[task_graph]") {
+  namespace detail = tg::detail;
+  constexpr std::size_t line = base::detail::cache_line_size;
+
+  // Results of one branch are packed, every branch starts a cache line.
+  constexpr auto aligns = detail::result_aligns<4, 3>(
+      {0, 2, 2}, {2, 0, 2}, {2 * sizeof(int), 0, 2 * sizeof(int)});
+  STATIC_REQUIRE(aligns[0] == line);
+  STATIC_REQUIRE(aligns[1] == 1);
+  STATIC_REQUIRE(aligns[2] == line);
+  STATIC_REQUIRE(aligns[3] == 1);
+
+  // Padding of very wide fan-outs of tiny results stays bounded: neighbouring
+  // branches share lines.
+  constexpr std::size_t wide = 2 * detail::max_padded_results_size / line;
+  constexpr auto wide_aligns = [] {
+    std::array<std::size_t, wide> starts{};
+    std::array<std::size_t, wide> counts{};
+    std::array<std::size_t, wide> sizes{};
+    for (std::size_t i = 0; i < wide; ++i) {
+      starts[i] = i;
+      counts[i] = 1;
+      sizes[i] = sizeof(int);
+    }
+    return detail::result_aligns<wide, wide>(starts, counts, sizes);
+  }();
+  STATIC_REQUIRE(wide_aligns[0] == line);
+  STATIC_REQUIRE(wide_aligns[1] == 1);
+  STATIC_REQUIRE(wide_aligns[2] == line);
+
+  // Big results get lines of their own, so do branches following them.
+  constexpr auto big_aligns =
+      detail::result_aligns<2, 2>({0, 1}, {1, 1}, {line, sizeof(int)});
+  STATIC_REQUIRE(big_aligns[0] == line);
+  STATIC_REQUIRE(big_aligns[1] == line);
+
+  base::simple_task_runner tr;
+  auto node = tg::when_all([](int val) { return val; },
+                           [](int val) { return std::array<int, 32>{val}; },
+                           [](int val) { return val + 1; })
+                  .then([](int a, const std::array<int, 32>& b, int c) {
+                    return a + b[0] + c;
+                  });
+
+  int result = 0;
+  tg::sync_execute(&tr, &node, [&result](int val) { result = val; }, 1);
+  REQUIRE(result == 4);
+}
+
+TEST_CASE("task_graph_on_runner_test", "[task_graph]") {
+  base::simple_task_runner tr;
+  base::simple_task_runner io_tr;
+
+  auto node = tg::on(&io_tr, [&] { return io_tr.running_in_this_thread(); })
+                  .then([&](bool on_io) {
+                    return on_io && tr.running_in_this_thread();
+                  });
+
+  bool result = false;
+  tg::sync_execute(&tr, &node, [&result](bool val) { result = val; });
+  REQUIRE(result);
+}
+
+TEST_CASE("task_graph_discarding_runner_test", "[task_graph]") {
+  // Graph tasks could be dropped from the full queue of tr and never reach
+  // their joins, so graphs refuse to run on it instead of hanging.
+  base::simple_task_runner tr{base::simple_task_system::options{
+      1, base::overflow_policy::drop_oldest}};
+  REQUIRE(tr.discards_tasks());
+
+  auto node = tg::when_all([](int val) { return val; },
+                           [](int val) { return val; });
+  bool called = false;
+  REQUIRE_THROWS_AS(tg::sync_execute(
+                        &tr, &node, [&called](int, int) { called = true; }, 1),
+                    std::invalid_argument);
+  REQUIRE_FALSE(called);
+
+  base::simple_task_runner keeping_tr;
+  REQUIRE_FALSE(keeping_tr.discards_tasks());
+  REQUIRE_THROWS_AS(tg::on(&tr, [] {}), std::invalid_argument);
+
+  // Fire-and-forget tasks are still accepted.
+  base::manual_event event;
+  tr.run([&event] { event.notify(); });
+  event.wait();
+}
+
+TEST_CASE("task_graph_on_runner_elision_test", "[task_graph]") {
+  base::simple_task_runner tr;
+
+  // Branches of all run on tr already, so there is nothing to hop for.
+  auto node = tg::when_all(
+      tg::leaf{[] { return std::this_thread::get_id(); }}.then(
+          tg::on(&tr, [](std::thread::id id) {
+            return id == std::this_thread::get_id();
+          })));
+
+  bool result = false;
+  tg::sync_execute(&tr, &node, [&result](bool val) { result = val; });
+  REQUIRE(result);
+}
+
+TEST_CASE("task_graph_nested_sync_execute_test", "[task_graph]") {
+  base::simple_task_runner tr;
+
+  // Every branch blocks its worker in a nested sync_execute on the same task
+  // runner. Spare workers keep the task runner going.
+  auto inner = tg::when_all([](int val) { return val * 2; });
+  auto nested = [&tr, &inner](int val) {
+    int result = 0;
+    tg::sync_execute(&tr, &inner, [&result](int res) { result = res; }, val);
+    return result;
+  };
+
+  std::vector<int> vals(base::simple_task_system::thread_count * 2);
+  std::iota(vals.begin(), vals.end(), 0);
+  auto node = tg::when_all([&](int val) {
+    int sum = 0;
+    for (int v : vals) {
+      sum += nested(v + val);
+    }
+    return sum;
+  });
+
+  int result = 0;
+  tg::sync_execute(&tr, &node, [&result](int val) { result = val; }, 1);
+  REQUIRE(result == std::accumulate(vals.begin(), vals.end(), 0,
+                                    [](int acc, int v) {
+                                      return acc + (v + 1) * 2;
+                                    }));
+}
+
+TEST_CASE("task_graph_limit_concurrency_test", "[task_graph]") {
+  base::simple_task_runner tr;
+  constexpr std::size_t limit = 2;
+  constexpr int total = 16;
+
+  // Leaves block inside blocking_region, so spare workers pick up more
+  // executions than the limit allows.
+  std::atomic<std::size_t> running = 0;
+  std::atomic<std::size_t> max_running = 0;
+  auto node = tg::limit_concurrency(limit, [&](int val) {
+    const auto now = ++running;
+    auto prev = max_running.load();
+    while (prev < now && !max_running.compare_exchange_weak(prev, now)) {
+    }
+    {
+      base::blocking_region blocking;
+      std::this_thread::sleep_for(std::chrono::milliseconds{2});
+    }
+    --running;
+    return val;
+  });
+
+  std::atomic<int> finished = 0;
+  std::atomic<int> sum = 0;
+  base::manual_event done;
+  for (int i = 0; i < total; ++i) {
+    tr.run([&, i] {
+      node.execute(
+          &tr,
+          [&](int val) {
+            sum += val;
+            if (++finished == total) {
+              done.notify();
+            }
+          },
+          i);
+    });
+  }
+  done.wait();
+
+  REQUIRE(sum == total * (total - 1) / 2);
+  REQUIRE(max_running <= limit);
+}
+
+TEST_CASE("task_graph_bounded_queue_test", "[task_graph]") {
+  // Branches posted from outside of the pool wait for space instead of being
+  // dropped, so the execution completes on the tiniest queue.
+  base::simple_task_runner tr{
+      base::simple_task_system::options{1, base::overflow_policy::block}};
+  auto node = tg::when_all([](int val) { return val + 1; },
+                           [](int val) { return val + 2; },
+                           [](int val) { return val + 3; })
+                  .then([](int a, int b, int c) { return a + b + c; });
+  for (int i = 0; i < 10; ++i) {
+    int result = 0;
+    tg::sync_execute(&tr, &node, [&result](int val) { result = val; }, i);
+    REQUIRE(result == 3 * i + 6);
+  }
+}
+
+TEST_CASE("task_graph_batched_leaf_test", "[task_graph]") {
+  base::simple_task_runner tr;
+
+  std::mutex mtx;
+  std::vector<std::size_t> batch_sizes;
+  auto twice = [&](const std::vector<int>& vals) {
+    {
+      std::unique_lock guard{mtx};
+      batch_sizes.push_back(vals.size());
+    }
+    std::vector<int> result;
+    for (int val : vals) {
+      result.push_back(val * 2);
+    }
+    return result;
+  };
+
+  SECTION("Full batches are dispatched at once") {
+    // Huge window: nothing but the batch size may trigger dispatch.
+    auto node = tg::make_batched_leaf<int>(
+        twice, {/*max_size=*/4, /*window=*/std::chrono::hours{1}});
+    constexpr int total = 16;
+    std::atomic<int> finished = 0;
+    std::atomic<int> sum = 0;
+    base::manual_event done;
+    for (int i = 0; i < total; ++i) {
+      tr.run([&, i] {
+        node.execute(
+            &tr,
+            [&](int val) {
+              sum += val;
+              if (++finished == total) {
+                done.notify();
+              }
+            },
+            i);
+      });
+    }
+    done.wait();
+
+    REQUIRE(sum == total * (total - 1));
+    REQUIRE(batch_sizes == std::vector<std::size_t>(total / 4, 4));
+  }
+
+  SECTION("Partial batch is dispatched after window") {
+    auto node = tg::make_batched_leaf<int>(
+                    twice, {/*max_size=*/100, std::chrono::milliseconds{5}})
+                    .then([](int val) { return val + 1; });
+    int result = 0;
+    tg::sync_execute(&tr, &node, [&result](int val) { result = val; }, 20);
+    REQUIRE(result == 41);
+    REQUIRE(batch_sizes == std::vector<std::size_t>{1});
+  }
+
+  SECTION("Timers of batches dispatched by size don't touch their runners") {
+    auto node = tg::make_batched_leaf<int>(
+        twice, {/*max_size=*/2, std::chrono::milliseconds{1}});
+    for (int i = 0; i < 20; ++i) {
+      // Timers armed by these executions fire after the runner is gone.
+      base::simple_task_runner local_tr;
+      auto pair = tg::when_all(node, node).then(
+          [](int a, int b) { return a + b; });
+      int result = 0;
+      tg::sync_execute(
+          &local_tr, &pair, [&result](int val) { result = val; }, i);
+      REQUIRE(result == 4 * i);
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds{20});
+  }
+}
+
+namespace {
+
+// Spins until the race is lost or a long timeout expires. Returns whether it
+// has been asked to stop.
+bool stall_until_stop_requested() {
+  // Occupied worker gets replaced by a spare one meanwhile.
+  base::blocking_region blocking;
+  const auto deadline =
+      std::chrono::steady_clock::now() + std::chrono::seconds{10};
+  while (!tg::stop_requested()) {
+    if (std::chrono::steady_clock::now() > deadline) {
+      return false;
+    }
+    std::this_thread::sleep_for(std::chrono::microseconds{100});
+  }
+  return true;
+}
+
+}  // namespace
+
+TEST_CASE("task_graph_when_any_test", "[task_graph]") {
+  base::simple_task_runner tr;
+  std::atomic<bool> stopped = false;
+
+  SECTION("Loser sees the stop request") {
+    {
+      auto node = tg::when_any(
+                      [&](int val) {
+                        stopped = stall_until_stop_requested();
+                        return -val;
+                      },
+                      [](int val) { return val * 2; })
+                      .then([](int val) { return val + 1; });
+
+      int result = 0;
+      tg::sync_execute(&tr, &node, [&result](int val) { result = val; }, 20);
+      REQUIRE(result == 41);
+      // The node waits for the loser on destruction.
+    }
+    REQUIRE(stopped);
+  }
+
+  SECTION("Later tasks of the loser see the stop request") {
+    {
+      // Leaves of when_all run in tasks posted by the racer.
+      auto node = tg::when_any(tg::when_all([&](int val) {
+                                 stopped = stall_until_stop_requested();
+                                 return -val;
+                               }),
+                               [](int val) { return val * 2; });
+
+      int result = 0;
+      tg::sync_execute(&tr, &node, [&result](int val) { result = val; }, 20);
+      REQUIRE(result == 40);
+    }
+    REQUIRE(stopped);
+  }
+}
+
+TEST_CASE("task_graph_hedge_test", "[task_graph]") {
+  base::simple_task_runner tr;
+  std::atomic<int> calls = 0;
+
+  SECTION("Stalled execution is hedged") {
+    {
+      auto node = tg::hedge(
+          [&](int val) {
+            if (calls++ == 0) {
+              stall_until_stop_requested();
+              return -val;
+            }
+            return val * 2;
+          },
+          std::chrono::milliseconds{1});
+
+      int result = 0;
+      tg::sync_execute(&tr, &node, [&result](int val) { result = val; }, 20);
+      REQUIRE(result == 40);
+    }
+    REQUIRE(calls == 2);
+  }
+
+  SECTION("Fast execution is not duplicated") {
+    {
+      auto node = tg::hedge(
+          [&](int val) {
+            ++calls;
+            return val * 2;
+          },
+          std::chrono::hours{1});
+
+      int result = 0;
+      tg::sync_execute(&tr, &node, [&result](int val) { result = val; }, 20);
+      REQUIRE(result == 40);
+      // The timer of the second execution is cancelled as the first one
+      // finishes, so destruction doesn't wait for it.
+    }
+    REQUIRE(calls == 1);
+  }
+}
+
+TEST_CASE("task_graph_if_test", "[task_graph]") {
+  base::simple_task_runner tr;
+
+  SECTION("Only the selected branch is executed") {
+    std::atomic<int> executed = 0;
+    auto node = tg::if_([](int val) { return val > 0; },
+                        [&](int val) {
+                          ++executed;
+                          return val * 2;
+                        },
+                        [&](int val) {
+                          ++executed;
+                          return -val;
+                        })
+                    .then([](int val) { return val + 1; });
+
+    int result = 0;
+    tg::sync_execute(&tr, &node, [&result](int val) { result = val; }, 20);
+    REQUIRE(result == 41);
+    tg::sync_execute(&tr, &node, [&result](int val) { result = val; }, -5);
+    REQUIRE(result == 6);
+    REQUIRE(executed == 2);
+  }
+
+  SECTION("Different results make a variant") {
+    auto node = tg::if_([](int val) { return val % 2 == 0; },
+                        [](int val) { return val / 2; },
+                        [](int val) { return std::to_string(val); });
+
+    std::variant<int, std::string> result;
+    auto save = [&result](std::variant<int, std::string> val) {
+      result = std::move(val);
+    };
+    tg::sync_execute(&tr, &node, save, 10);
+    REQUIRE(std::get<0>(result) == 5);
+    tg::sync_execute(&tr, &node, save, 7);
+    REQUIRE(std::get<1>(result) == "7");
+  }
+}
+
+TEST_CASE("task_graph_switch_test", "[task_graph]") {
+  base::simple_task_runner tr;
+  auto node = tg::switch_([](int val) { return val % 3; },
+                          [](int val) { return val; },
+                          tg::when_all([](int val) { return val * 2; }),
+                          [](int val) { return val * 3; });
+
+  std::vector<int> results;
+  for (int val : {3, 4, 5}) {
+    tg::sync_execute(
+        &tr, &node, [&results](int res) { results.push_back(res); }, val);
+  }
+  REQUIRE(results == std::vector<int>{3, 8, 15});
+}
+
+TEST_CASE("task_graph_switch_missing_branch_test", "[task_graph]") {
+  base::simple_task_runner tr;
+  auto node = tg::switch_([](int val) { return val; },
+                          [](int val) { return val; },
+                          [](int val) { return val * 2; });
+
+  SECTION("Root node executes the last branch") {
+    int result = 0;
+    tg::sync_execute(&tr, &node, [&result](int val) { result = val; }, 3);
+    REQUIRE(result == 6);
+    tg::sync_execute(&tr, &node, [&result](int val) { result = val; }, -1);
+    REQUIRE(result == -2);
+  }
+
+  SECTION("Nested node executes the last branch") {
+    auto nested = tg::when_all(std::move(node), [](int val) { return val; })
+                      .then([](int lhs, int rhs) { return lhs + rhs; });
+    int result = 0;
+    tg::sync_execute(&tr, &nested, [&result](int val) { result = val; }, 5);
+    REQUIRE(result == 15);
+    tg::sync_execute(&tr, &nested, [&result](int val) { result = val; }, -4);
+    REQUIRE(result == -12);
+  }
+}
+
+TEST_CASE("task_graph_repeat_until_test", "[task_graph]") {
+  base::simple_task_runner tr;
+
+  SECTION("Synchronous iterations don't grow the stack") {
+    auto node = tg::repeat_until([](int val) { return val >= 1000000; },
+                                 [](int val) { return val + 1; });
+    int result = 0;
+    tg::sync_execute(&tr, &node, [&result](int val) { result = val; }, 0);
+    REQUIRE(result == 1000000);
+  }
+
+  SECTION("Iterations may hop between tasks") {
+    std::atomic<int> iterations = 0;
+    auto node = tg::repeat_until([](int val, int) { return val >= 100; },
+                                 tg::when_all(
+                                     [&](int val, int step) {
+                                       ++iterations;
+                                       return val + step;
+                                     },
+                                     [](int, int step) { return step; }));
+    int result = 0;
+    tg::sync_execute(
+        &tr, &node, [&result](int val, int) { result = val; }, 0, 10);
+    REQUIRE(result == 100);
+    REQUIRE(iterations == 10);
+  }
+}
+
+namespace {
+
+// Counts tasks posted to the underlying task runner.
+struct counting_runner {
+  template <class F>
+  void run(F&& f) {
+    ++posted;
+    tr->run(std::forward<F>(f));
+  }
+
+  base::simple_task_runner* tr;
+  std::atomic<int> posted = 0;
+};
+
+}  // namespace
+
+TEST_CASE("task_graph_cost_hint_test", "[task_graph]") {
+  using namespace std::chrono_literals;
+  base::simple_task_runner tr;
+  counting_runner counter{&tr};
+
+  SECTION("Cheap subnodes share a task") {
+    auto node = tg::when_all(
+        tg::with_cost([](int val) { return val; }, 100ns),
+        tg::with_cost([](int val) { return val + 1; }, 100ns),
+        tg::with_cost([](int val) { return val + 2; }, 100ns),
+        tg::with_cost([](int) {}, 100ns),
+        tg::with_cost([](int val) { return val + 4; }, 100ns));
+    std::vector<int> results;
+    tg::sync_execute(
+        &counter, &node,
+        [&results](int a, int b, int c, int e) {
+          results = {a, b, c, e};
+        },
+        10);
+    REQUIRE(results == std::vector<int>{10, 11, 12, 14});
+    REQUIRE(counter.posted == 1);
+  }
+
+  SECTION("Costly and unknown subnodes get tasks of their own") {
+    auto node = tg::when_all(
+        tg::with_cost([](int val) { return val; }, 1us),
+        tg::with_cost([](int val) { return val + 1; }, 1us),
+        [](int val) { return val + 2; },
+        tg::with_cost([](int val) { return val + 3; }, 1ms),
+        tg::with_cost([](int val) { return val + 4; }, 1us));
+    std::vector<int> results;
+    tg::sync_execute(
+        &counter, &node,
+        [&results](int a, int b, int c, int d, int e) {
+          results = {a, b, c, d, e};
+        },
+        10);
+    REQUIRE(results == std::vector<int>{10, 11, 12, 13, 14});
+    REQUIRE(counter.posted == 4);
+  }
+
+  SECTION("Groups are bounded by the grain") {
+    auto node = tg::when_all(
+        tg::with_cost([] { return 0; }, 15us),
+        tg::with_cost([] { return 1; }, 15us),
+        tg::with_cost([] { return 2; }, 15us),
+        tg::with_cost([] { return 3; }, 15us));
+    int sum = 0;
+    tg::sync_execute(&counter, &node, [&sum](int a, int b, int c, int d) {
+      sum = a + b + c + d;
+    });
+    REQUIRE(sum == 6);
+    REQUIRE(counter.posted == 2);
+  }
+
+  SECTION("Measured costs are known after the first execution") {
+    auto node = tg::measure_cost([](int val) { return val * 2; });
+    REQUIRE(node.cost() == std::chrono::nanoseconds::max());
+    int result = 0;
+    tg::sync_execute(&tr, &node, [&result](int val) { result = val; }, 21);
+    REQUIRE(result == 42);
+    REQUIRE(node.cost() < 1s);
+
+    auto wide = tg::when_all(node, tg::measure_cost([](int val) {
+                               return val + 1;
+                             }));
+    tg::sync_execute(&tr, &wide, [&result](int a, int b) { result = a + b; },
+                     1);
+    REQUIRE(result == 4);
+  }
+
+  SECTION("Instrumented subnodes keep their hints") {
+    tg::graph_profile profile;
+    auto node = tg::instrument(
+        tg::when_all(tg::with_cost([](int val) { return val; }, 100ns),
+                     tg::with_cost([](int val) { return val + 1; }, 100ns),
+                     tg::with_cost([](int val) { return val + 2; }, 100ns)),
+        &profile);
+    std::vector<int> results;
+    tg::sync_execute(
+        &counter, &node,
+        [&results](int a, int b, int c) { results = {a, b, c}; }, 10);
+    REQUIRE(results == std::vector<int>{10, 11, 12});
+    REQUIRE(counter.posted == 1);
+  }
+}
+
+namespace {
+
+// Executes posted tasks only when asked, in order of posting.
+struct manual_runner {
+  template <class F>
+  void run(F&& f) {
+    tasks.emplace_back(std::forward<F>(f));
+  }
+
+  void run_all() {
+    while (!tasks.empty()) {
+      auto task = std::move(tasks.front());
+      tasks.pop_front();
+      task();
+    }
+  }
+
+  std::deque<std::function<void()>> tasks;
+};
+
+}  // namespace
+
+TEST_CASE("task_graph_critical_path_first_test", "[task_graph]") {
+  using namespace std::chrono_literals;
+  manual_runner tr;
+  std::vector<int> order;
+
+  SECTION("Costliest branches are posted first") {
+    auto node = tg::critical_path_first(tg::when_all(
+        tg::with_cost([&order] { order.push_back(0); }, 30us),
+        tg::with_cost([&order] { order.push_back(1); }, 5ms),
+        tg::with_cost([&order] { order.push_back(2); }, 100us)));
+    bool finished = false;
+    node.execute(&tr, [&finished] { finished = true; });
+    tr.run_all();
+    REQUIRE(finished);
+    REQUIRE(order == std::vector<int>{1, 2, 0});
+  }
+
+  SECTION("Order follows recorded execution times") {
+    auto node = tg::critical_path_first(tg::when_all(
+        [&order](int val) {
+          order.push_back(0);
+          return val;
+        },
+        [&order](int val) {
+          order.push_back(1);
+          std::this_thread::sleep_for(2ms);
+          return val + 1;
+        }));
+    int sum = 0;
+    const auto then = [&sum](int a, int b) { sum = a + b; };
+
+    node.execute(&tr, then, 1);
+    tr.run_all();
+    REQUIRE(order == std::vector<int>{0, 1});
+    REQUIRE(sum == 3);
+
+    order.clear();
+    node.execute(&tr, then, 2);
+    tr.run_all();
+    REQUIRE(order == std::vector<int>{1, 0});
+    REQUIRE(sum == 5);
+  }
+}
+
+TEST_CASE("task_graph_when_each_test", "[task_graph]") {
+  base::simple_task_runner tr;
+
+  SECTION("Results are passed to sink one by one") {
+    std::mutex mtx;
+    std::vector<std::pair<std::size_t, int>> results;
+    auto node = tg::when_each(
+        [&](std::size_t index, int val) {
+          std::unique_lock guard{mtx};
+          results.emplace_back(index, val);
+        },
+        [](int val) { return val; }, [](int val) { return val * 2; },
+        tg::when_all([](int val) { return val * 3; }));
+    bool finished = false;
+    tg::sync_execute(&tr, &node, [&finished] { finished = true; }, 10);
+    REQUIRE(finished);
+    std::sort(results.begin(), results.end());
+    const std::vector<std::pair<std::size_t, int>> expected{
+        {0, 10}, {1, 20}, {2, 30}};
+    REQUIRE(results == expected);
+  }
+
+  SECTION("Subnodes may have different results") {
+    std::atomic<int> sum = 0;
+    std::string text;
+    auto node = tg::when_each(
+                    [&](auto index, auto&&... results) {
+                      if constexpr (index == 0) {
+                        text = (results + ...);
+                      } else if constexpr (index == 1) {
+                        sum += (results + ...);
+                      } else {
+                        static_assert(sizeof...(results) == 0);
+                        ++sum;
+                      }
+                    },
+                    [](int) { return std::string{"a"}; },
+                    tg::when_all([](int val) { return val; },
+                                 [](int val) { return val + 1; }),
+                    [](int) {})
+                    .then([&sum] { return sum.load(); });
+    int result = 0;
+    tg::sync_execute(&tr, &node, [&result](int val) { result = val; }, 1);
+    REQUIRE(result == 4);
+    REQUIRE(text == "a");
+  }
+
+  SECTION("Sink sees results before slow subnodes finish") {
+    base::manual_event first_seen;
+    auto node = tg::when_each(
+        [&](std::size_t index) {
+          if (index == 0) {
+            first_seen.notify();
+          }
+        },
+        [] {},
+        [&] {
+          base::blocking_region blocking;
+          first_seen.wait();
+        });
+    tg::sync_execute(&tr, &node, [] {});
+  }
+}
+
+TEST_CASE("task_graph_any_node_test", "[task_graph]") {
+  using int_node = tg::any_node<int(int), base::simple_task_runner>;
+  base::simple_task_runner tr;
+
+  SECTION("Holds leaves and subtrees") {
+    int_node leaf = [](int val) { return val + 1; };
+    int_node tree = tg::when_all([](int val) { return val; },
+                                 [](int val) { return val * 2; })
+                        .then([](int a, int b) { return a + b; });
+    int result = 0;
+    tg::sync_execute(&tr, &leaf, [&result](int val) { result = val; }, 1);
+    REQUIRE(result == 2);
+    tg::sync_execute(&tr, &tree, [&result](int val) { result = val; }, 2);
+    REQUIRE(result == 6);
+
+    leaf = std::move(tree);
+    tg::sync_execute(&tr, &leaf, [&result](int val) { result = val; }, 3);
+    REQUIRE(result == 9);
+  }
+
+  SECTION("Composes with other nodes") {
+    auto node = tg::when_all(int_node{[](int val) { return val + 1; }},
+                             int_node{[](int val) { return val + 2; }},
+                             int_node{[](int val) { return val + 3; }})
+                    .then([](int a, int b, int c) { return a + b + c; });
+    int_node erased = std::move(node);
+    auto chain = std::move(erased).then([](int val) { return val * 10; });
+    int result = 0;
+    tg::sync_execute(&tr, &chain, [&result](int val) { result = val; }, 0);
+    REQUIRE(result == 60);
+  }
+
+  SECTION("Big subtrees are kept on the heap") {
+    std::array<long, 64> values{};
+    values[63] = 42;
+    auto shared = std::make_shared<int>(0);
+    tg::any_node<void(), base::simple_task_runner> node =
+        [values, shared] { *shared = static_cast<int>(values[63]); };
+    auto moved = std::move(node);
+    tg::sync_execute(&tr, &moved, [] {});
+    REQUIRE(*shared == 42);
+    REQUIRE(shared.use_count() == 2);
+  }
+}
@@ -0,0 +1,140 @@
+#ifndef _TASK_GROUP_H_
+#define _TASK_GROUP_H_
+
+#include <cassert>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <utility>
+
+#include "blocking.h"
+#include "unique_function.h"
+
+namespace base {
+
+// Group of tasks spawned at run time, for fork-join recursion (parallel
+// quicksort, tree traversals) that task graphs, fixed before execution,
+// can't express. Usable from inside tasks of the task runner:
+//
+//   task_group group{tr};
+//   group.run([&] { sort(left); });
+//   sort(right);
+//   group.wait();
+//
+// wait() doesn't just block the calling worker. It executes tasks of the
+// group that haven't started yet, newest first, then other queued tasks of
+// the task runner, and blocks (inside blocking_region) only when the rest of
+// the group is running on other threads. So recursion deeper than the number
+// of workers doesn't exhaust them, unlike sync_execute from inside a task.
+// Helping executes tasks on the stack of wait(), so stack depth grows with
+// the depth of the recursion.
+// Task runner must outlive the group.
+template <class TaskRunner>
+class task_group {
+ public:
+  explicit task_group(TaskRunner* const tr)
+      : tr_{tr}, state_{std::make_shared<state>()} {
+    assert(tr_ != nullptr);
+  }
+
+  // Waits for the tasks of the group.
+  ~task_group() { wait(); }
+
+  task_group(const task_group&) = delete;
+  task_group& operator=(const task_group&) = delete;
+
+  // Spawns f() as a task of the group. Can be called from tasks of the group
+  // too.
+  template <class F>
+  void run(F&& f) {
+    {
+      std::unique_lock guard{state_->mtx};
+      state_->tasks.emplace_back(std::forward<F>(f));
+      ++state_->unfinished;
+    }
+    state_->cv.notify_all();
+    // The task itself stays in the group, so wait() can take it. Whoever
+    // comes first executes it, the runner task might find nothing to do.
+    tr_->run([s = state_] { s->run_oldest(); });
+  }
+
+  // Returns when all tasks spawned by run() have finished.
+  void wait() {
+    auto& s = *state_;
+    for (;;) {
+      if (s.run_newest()) {
+        continue;
+      }
+      {
+        std::unique_lock guard{s.mtx};
+        if (s.unfinished == 0) {
+          return;
+        }
+      }
+      if (tr_->running_in_this_thread() && tr_->run_pending_task()) {
+        continue;
+      }
+      // Rest of the group runs on other workers.
+      blocking_region blocking;
+      std::unique_lock guard{s.mtx};
+      while (s.unfinished != 0 && s.tasks.empty()) {
+        s.cv.wait(guard);
+      }
+    }
+  }
+
+ private:
+  // Shared with the runner tasks, which may outlive the group.
+  struct state {
+    // Executes the oldest task not yet started, runner tasks take those since
+    // they tend to be the largest.
+    bool run_oldest() { return run_one(/*newest=*/false); }
+    // Executes the newest task not yet started, waiter takes those since
+    // their data is likely still in its cache.
+    bool run_newest() { return run_one(/*newest=*/true); }
+
+    bool run_one(const bool newest) {
+      unique_function<void()> task;
+      {
+        std::unique_lock guard{mtx};
+        if (tasks.empty()) {
+          return false;
+        }
+        if (newest) {
+          task = std::move(tasks.back());
+          tasks.pop_back();
+        } else {
+          task = std::move(tasks.front());
+          tasks.pop_front();
+        }
+      }
+      task();
+      bool finished = false;
+      {
+        std::unique_lock guard{mtx};
+        finished = --unfinished == 0;
+      }
+      if (finished) {
+        cv.notify_all();
+      }
+      return true;
+    }
+
+    std::mutex mtx;
+    std::condition_variable cv;
+    // Spawned tasks not yet started.
+    std::deque<unique_function<void()>> tasks;
+    // Spawned tasks not yet finished.
+    std::size_t unfinished = 0;
+  };
+
+ private:
+  TaskRunner* const tr_;
+  const std::shared_ptr<state> state_;
+};
+
+}  // namespace base
+
+#endif  // _TASK_GROUP_H_
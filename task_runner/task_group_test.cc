@@ -0,0 +1,102 @@
+#include "task_group.h"
+
+#include <algorithm>
+#include <atomic>
+#include <random>
+#include <vector>
+
+#include "catch2/catch_all.hpp"
+#include "event.h"
+#include "inline_task_system.h"
+#include "task_runner.h"
+
+namespace {
+
+template <class TaskRunner>
+long fib(TaskRunner* const tr, const int n) {
+  if (n < 2) {
+    return n;
+  }
+  long a = 0;
+  base::task_group group{tr};
+  group.run([&] { a = fib(tr, n - 1); });
+  const long b = fib(tr, n - 2);
+  group.wait();
+  return a + b;
+}
+
+template <class TaskRunner, class It>
+void quicksort(TaskRunner* const tr, const It first, const It last) {
+  if (last - first < 32) {
+    std::sort(first, last);
+    return;
+  }
+  const auto pivot = *(first + (last - first) / 2);
+  const It middle1 =
+      std::partition(first, last, [&](int v) { return v < pivot; });
+  const It middle2 =
+      std::partition(middle1, last, [&](int v) { return !(pivot < v); });
+  base::task_group group{tr};
+  group.run([=] { quicksort(tr, first, middle1); });
+  group.run([=] { quicksort(tr, middle2, last); });
+  group.wait();
+}
+
+}  // namespace
+
+TEST_CASE("task_group_test", "[task_group]") {
+  base::simple_task_runner tr;
+
+  SECTION("Recursion inside a task doesn't exhaust workers") {
+    long result = 0;
+    base::manual_event done;
+    tr.run([&] {
+      result = fib(&tr, 18);
+      done.notify();
+    });
+    done.wait();
+    REQUIRE(result == 2584);
+  }
+
+  SECTION("Waiting outside of the task runner") {
+    std::vector<int> v(100000);
+    std::mt19937 gen{42};
+    std::generate(v.begin(), v.end(),
+                  [&] { return static_cast<int>(gen() % 1000); });
+    quicksort(&tr, v.begin(), v.end());
+    REQUIRE(std::is_sorted(v.begin(), v.end()));
+  }
+
+  SECTION("Tasks spawn into their own group") {
+    std::atomic<int> count = 0;
+    base::task_group group{&tr};
+    for (int i = 0; i < 10; ++i) {
+      group.run([&] {
+        ++count;
+        for (int j = 0; j < 10; ++j) {
+          group.run([&] { ++count; });
+        }
+      });
+    }
+    group.wait();
+    REQUIRE(count == 110);
+  }
+
+  SECTION("Destructor waits") {
+    std::atomic<int> count = 0;
+    {
+      base::task_group group{&tr};
+      for (int i = 0; i < 100; ++i) {
+        group.run([&] { ++count; });
+      }
+    }
+    REQUIRE(count == 100);
+  }
+}
+
+TEST_CASE("task_group_inline_test", "[task_group]") {
+  base::task_runner_base<base::inline_task_system> tr;
+  long result = 0;
+  tr.run([&] { result = fib(&tr, 15); });
+  REQUIRE(result == 610);
+}
@@ -1,32 +1,162 @@
 #ifndef _TASK_RUNNER_H_
 #define _TASK_RUNNER_H_
 
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <tuple>
+#include <type_traits>
+
+#include "stop_flag.h"
 #include "task_system.h"
+#include "tenant.h"
 
 namespace base {
 
 template <class TaskSystem>
 class task_runner_base {
  public:
+  // Arguments are passed to the task system constructor.
+  template <class... Ts>
+  explicit task_runner_base(Ts&&... ts)
+      : task_system_{std::forward<Ts>(ts)...} {}
+
   template <class F, class... Args>
   void run(F&& f, Args&&... args) {
-    using args_tuple = std::tuple<std::decay_t<Args>...>;
-    using invoke_tuple = std::tuple<std::decay_t<F>, args_tuple>;
+    post</*TryOnly=*/false>(
+        bind(std::forward<F>(f), std::forward<Args>(args)...));
+  }
+
+  // Schedules f(args...) only if the task system can accept it right away
+  // (e.g. its bounded queue is not full). Returns whether f was scheduled.
+  template <class F, class... Args>
+  bool try_run(F&& f, Args&&... args) {
+    return post</*TryOnly=*/true>(
+        bind(std::forward<F>(f), std::forward<Args>(args)...));
+  }
+
+  // Schedules f(args...) on the shard of a sharded task system.
+  template <class F, class... Args>
+  void run_on(const std::size_t shard, F&& f, Args&&... args) {
+    post_on(shard, bind(std::forward<F>(f), std::forward<Args>(args)...));
+  }
+
+  // Number of shards of a sharded task system.
+  std::size_t shard_count() const { return task_system_.shard_count(); }
+
+  // Executes one task waiting for execution on the calling thread, so
+  // threads waiting for other tasks can help instead of blocking. Returns
+  // false if there was nothing to execute.
+  bool run_pending_task() { return task_system_.run_pending_task(); }
+
+  // Number of tasks waiting for execution.
+  std::size_t queue_size() const { return task_system_.queue_size(); }
 
-    auto p = std::make_unique<invoke_tuple>(
-        std::forward<F>(f), std::forward_as_tuple(std::forward<Args>(args)...));
+  // Whether the task system may discard tasks without executing them (see
+  // overflow_policy::drop_oldest). Such task runners only take fire-and-forget
+  // tasks, graphs refuse to run on them.
+  bool discards_tasks() const { return task_system_.discards_tasks(); }
+
+  // Whether calling thread executes tasks of this task runner.
+  bool running_in_this_thread() const {
+    return task_system_.running_in_this_thread();
+  }
+
+  // Index of calling worker of the task runner, see TaskSystem.
+  std::size_t current_worker_index() const {
+    return task_system_.current_worker_index();
+  }
 
-    task_system_.run(trampoline<invoke_tuple>, p.get());
-    // Context transfered to task system successfully.
-    p.release();
+  // Upper bound of worker indices.
+  std::size_t max_worker_count() const {
+    return TaskSystem::max_worker_count;
+  }
+
+  // Sets share of tenant in a fair task system.
+  void set_tenant_weight(const tenant_id tenant, const std::uint32_t weight) {
+    task_system_.set_weight(tenant, weight);
+  }
+
+  // Queue and execution counters of tenant in a fair task system.
+  auto tenant_stats(const tenant_id tenant) const {
+    return task_system_.stats(tenant);
   }
 
  private:
-  // InvokeContext == std::tuple<F, std::tuple<Args...>>
-  template <class InvokeContext>
-  static void trampoline(void* p) {
-    std::unique_ptr<InvokeContext> ctx{static_cast<InvokeContext*>(p)};
-    std::apply(std::move(std::get<0>(*ctx)), std::move(std::get<1>(*ctx)));
+  template <class F, class... Args>
+  static decltype(auto) bind(F&& f, Args&&... args) {
+    if constexpr (sizeof...(Args) == 0) {
+      return std::forward<F>(f);
+    } else {
+      return [f = std::forward<F>(f),
+              args = std::make_tuple(std::forward<Args>(args)...)]() mutable {
+        std::apply(std::move(f), std::move(args));
+      };
+    }
+  }
+
+  // Posted function with the tenant and the stop flag of its poster, so hops
+  // through other runners (e.g. on()) keep running as that tenant and later
+  // tasks of a racer still see its stop flag.
+  template <class F>
+  struct tenant_task {
+    tenant_id tenant;
+    const std::atomic<bool>* stop_flag;
+    F f;
+  };
+
+  // Tasks are owned with plain new/delete instead of std::unique_ptr on
+  // purpose: this code is instantiated for every task type, and unique_ptr
+  // instantiations turned out to dominate compile time of wide graphs.
+  // Once passed to the task system, the task belongs to it: trampoline() or
+  // discard() release it. Inline task systems execute the task inside run(),
+  // so exceptions escaping run() may come from an already released task.
+  template <bool TryOnly, class F>
+  bool post(F&& f) {
+    using func_type = tenant_task<std::decay_t<F>>;
+    auto* const p = new func_type{current_tenant(), current_stop_flag(),
+                                  std::forward<F>(f)};
+    if constexpr (TryOnly) {
+      if (!task_system_.try_run(trampoline<func_type>, p,
+                                discard<func_type>)) {
+        delete p;
+        return false;
+      }
+    } else {
+      task_system_.run(trampoline<func_type>, p, discard<func_type>);
+    }
+    return true;
+  }
+
+  template <class F>
+  void post_on(const std::size_t shard, F&& f) {
+    using func_type = tenant_task<std::decay_t<F>>;
+    auto* const p = new func_type{current_tenant(), current_stop_flag(),
+                                  std::forward<F>(f)};
+    task_system_.run_on(shard, trampoline<func_type>, p, discard<func_type>);
+  }
+
+  // Deletes the task even if it throws: the exception reaches callers of
+  // run() (inline task systems) and run_pending_task(). Much cheaper to
+  // instantiate than std::unique_ptr.
+  template <class Task>
+  struct task_guard {
+    ~task_guard() { delete task; }
+    Task* const task;
+  };
+
+  template <class Task>
+  static void trampoline(void* const p) {
+    const task_guard<Task> task{static_cast<Task*>(p)};
+    scoped_tenant tenant{task.task->tenant};
+    scoped_stop_flag stop_flag{task.task->stop_flag};
+    std::move(task.task->f)();
+  }
+
+  // Releases task discarded by the task system without execution.
+  template <class F>
+  static void discard(void* const p) {
+    delete static_cast<F*>(p);
   }
 
  private:
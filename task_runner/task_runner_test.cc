@@ -100,6 +100,31 @@ TEMPLATE_PRODUCT_TEST_CASE("task_runner_test", "[task_runner]",
     }
   }
 
+  SECTION("Task runner knows its threads") {
+    REQUIRE_FALSE(task_runner.running_in_this_thread());
+    bool in_runner = false;
+    base::manual_event event;
+    task_runner.run([&] {
+      in_runner = task_runner.running_in_this_thread();
+      event.notify();
+    });
+    event.wait();
+    REQUIRE(in_runner);
+  }
+
+  SECTION("Task runner knows its worker indices") {
+    REQUIRE(task_runner.current_worker_index() >=
+            task_runner.max_worker_count());
+    std::size_t index = task_runner.max_worker_count();
+    base::manual_event event;
+    task_runner.run([&] {
+      index = task_runner.current_worker_index();
+      event.notify();
+    });
+    event.wait();
+    REQUIRE(index < task_runner.max_worker_count());
+  }
+
   SECTION("Reference wrappers are applicable") {
     auto f = [](std::vector<int>& v, base::manual_event& e) {
       v.push_back(10);
@@ -5,4 +5,156 @@ namespace base {
 const std::size_t simple_task_system::thread_count =
     std::thread::hardware_concurrency();
 
+const std::size_t simple_task_system::max_spare_count =
+    4 * simple_task_system::thread_count;
+
+const std::size_t simple_task_system::max_worker_count =
+    simple_task_system::thread_count + simple_task_system::max_spare_count;
+
+thread_local const simple_task_system* simple_task_system::current_ = nullptr;
+
+thread_local std::size_t simple_task_system::current_index_ = no_worker;
+
+simple_task_system::simple_task_system(const options opts)
+    : policy_{opts.policy}, tasks_queue_{opts.capacity} {
+  threads_.resize(thread_count);
+  for (std::size_t i = 0; i < threads_.size(); ++i) {
+    threads_[i] = std::thread{[this, i] { worker_loop(i); }};
+  }
+}
+
+simple_task_system::~simple_task_system() {
+  tasks_queue_.done();
+  {
+    std::unique_lock guard{spares_mtx_};
+    stopping_ = true;
+  }
+  spares_cv_.notify_all();
+  for (auto& t : threads_) {
+    t.join();
+  }
+  // No new spares can appear after stopping_ is set.
+  for (auto& t : spares_) {
+    t.join();
+  }
+}
+
+void simple_task_system::run(const task_type f, void* const args,
+                             const task_type drop) {
+  const task_context task{f, args, drop};
+  if (running_in_this_thread()) {
+    tasks_queue_.push(task);
+    return;
+  }
+  switch (policy_) {
+    case overflow_policy::block:
+      if (detail::current_thread_nonblocking) {
+        tasks_queue_.push(task);
+      } else {
+        tasks_queue_.push_wait(task);
+      }
+      break;
+    case overflow_policy::drop_oldest: {
+      task_context dropped;
+      if (tasks_queue_.push_drop_oldest(task, &dropped) &&
+          dropped.drop != nullptr) {
+        dropped.drop(dropped.args);
+      }
+      break;
+    }
+  }
+}
+
+bool simple_task_system::try_run(const task_type f, void* const args,
+                                 const task_type drop) {
+  const task_context task{f, args, drop};
+  if (running_in_this_thread()) {
+    tasks_queue_.push(task);
+    return true;
+  }
+  return tasks_queue_.try_push(task);
+}
+
+bool simple_task_system::run_pending_task() {
+  task_context task;
+  if (!tasks_queue_.try_pop_now(&task)) {
+    return false;
+  }
+  assert(task.func != nullptr);
+  task.func(task.args);
+  return true;
+}
+
+void simple_task_system::worker_loop(const std::size_t index) {
+  current_ = this;
+  current_index_ = index;
+  scoped_blocking_observer observer{this};
+  task_context task;
+  for (;;) {
+    if (!tasks_queue_.try_pop(&task)) {
+      break;
+    }
+    assert(task.func != nullptr);
+    task.func(task.args);
+  }
+}
+
+void simple_task_system::spare_loop(const std::size_t index) {
+  current_ = this;
+  current_index_ = index;
+  scoped_blocking_observer observer{this};
+  task_context task;
+  for (;;) {
+    if (!park_if_redundant() || !tasks_queue_.try_pop(&task)) {
+      break;
+    }
+    assert(task.func != nullptr);
+    task.func(task.args);
+  }
+}
+
+bool simple_task_system::park_if_redundant() {
+  std::unique_lock guard{spares_mtx_};
+  if (active_spares_ <= blocked_) {
+    return !stopping_;
+  }
+  --active_spares_;
+  ++parked_spares_;
+  while (wakeups_ == 0 && !stopping_) {
+    spares_cv_.wait(guard);
+  }
+  if (stopping_) {
+    return false;
+  }
+  // Waker has already counted this worker as active.
+  --wakeups_;
+  return true;
+}
+
+void simple_task_system::on_blocking_start() {
+  std::unique_lock guard{spares_mtx_};
+  ++blocked_;
+  if (active_spares_ >= blocked_ || active_spares_ >= max_spare_count ||
+      stopping_) {
+    return;
+  }
+  ++active_spares_;
+  if (parked_spares_ > 0) {
+    --parked_spares_;
+    ++wakeups_;
+    spares_cv_.notify_one();
+  } else {
+    // Spares never exit before the task system stops, so their number
+    // doesn't exceed max_spare_count and indices stay unique.
+    spares_.emplace_back(
+        [this, index = thread_count + spares_.size()] { spare_loop(index); });
+  }
+}
+
+void simple_task_system::on_blocking_finish() {
+  std::unique_lock guard{spares_mtx_};
+  assert(blocked_ > 0);
+  --blocked_;
+}
+
 }  // namespace base
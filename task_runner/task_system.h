@@ -3,24 +3,90 @@
 
 #include <cassert>
 #include <condition_variable>
-#include <queue>
+#include <deque>
+#include <mutex>
 #include <thread>
+#include <vector>
+
+#include "blocking.h"
 
 namespace base {
 
+// What to do when a task is submitted to a full bounded task queue.
+enum class overflow_policy {
+  // Submitter waits until there is space in the queue.
+  block,
+  // The oldest queued task is discarded to make space for the new one.
+  // Only for independent fire-and-forget tasks: a discarded task of a graph
+  // would never reach its join, so graphs refuse to run on such task systems
+  // (see task_graph::sync_execute).
+  drop_oldest,
+};
+
 namespace detail {
 
 template <class T>
 class notification_queue {
  public:
+  // Zero capacity means the queue is unbounded.
+  explicit notification_queue(const std::size_t capacity = 0)
+      : capacity_{capacity} {}
+
+  // Pushers notify workers under the lock: a pusher not belonging to the
+  // task system (e.g. a timer thread) must be done with the queue by the time
+  // its task can run, since the task may be the last one before the task
+  // system is destroyed.
+
+  // Pushes value ignoring capacity.
   template <class U>
   void push(U&& value) {
-    {
-      std::unique_lock guard{queue_mtx_};
-      assert(running_);
-      queue_.emplace(std::forward<U>(value));
+    std::unique_lock guard{queue_mtx_};
+    assert(running_);
+    queue_.emplace_back(std::forward<U>(value));
+    queue_cv_.notify_one();
+  }
+
+  // Pushes value if there is space for it.
+  template <class U>
+  bool try_push(U&& value) {
+    std::unique_lock guard{queue_mtx_};
+    assert(running_);
+    if (full()) {
+      return false;
     }
+    queue_.emplace_back(std::forward<U>(value));
     queue_cv_.notify_one();
+    return true;
+  }
+
+  // Pushes value waiting until there is space for it.
+  template <class U>
+  void push_wait(U&& value) {
+    std::unique_lock guard{queue_mtx_};
+    assert(running_);
+    while (full()) {
+      space_cv_.wait(guard);
+    }
+    queue_.emplace_back(std::forward<U>(value));
+    queue_cv_.notify_one();
+  }
+
+  // Pushes value discarding the oldest element if there is no space.
+  // Returns true and stores the discarded element to *dropped in that case.
+  template <class U>
+  bool push_drop_oldest(U&& value, T* const dropped) {
+    assert(dropped != nullptr);
+    std::unique_lock guard{queue_mtx_};
+    assert(running_);
+    bool result = false;
+    if (full()) {
+      *dropped = std::move(queue_.front());
+      queue_.pop_front();
+      result = true;
+    }
+    queue_.emplace_back(std::forward<U>(value));
+    queue_cv_.notify_one();
+    return result;
   }
 
   bool try_pop(T* const ret) {
@@ -33,8 +99,28 @@ class notification_queue {
     if (queue_.empty()) {
       return false;
     }
-    *ret = queue_.front();
-    queue_.pop();
+    *ret = std::move(queue_.front());
+    queue_.pop_front();
+    if (capacity_ != 0) {
+      guard.unlock();
+      space_cv_.notify_one();
+    }
+    return true;
+  }
+
+  // Pops value if there is one, never waits.
+  bool try_pop_now(T* const ret) {
+    assert(ret != nullptr);
+    std::unique_lock guard{queue_mtx_};
+    if (queue_.empty()) {
+      return false;
+    }
+    *ret = std::move(queue_.front());
+    queue_.pop_front();
+    if (capacity_ != 0) {
+      guard.unlock();
+      space_cv_.notify_one();
+    }
     return true;
   }
 
@@ -46,57 +132,134 @@ class notification_queue {
     queue_cv_.notify_all();
   }
 
+  std::size_t size() const {
+    std::unique_lock guard{queue_mtx_};
+    return queue_.size();
+  }
+
  private:
+  bool full() const { return capacity_ != 0 && queue_.size() >= capacity_; }
+
+ private:
+  const std::size_t capacity_;
   bool running_ = true;
-  std::queue<T> queue_;
+  std::deque<T> queue_;
   std::condition_variable queue_cv_;
-  std::mutex queue_mtx_;
+  std::condition_variable space_cv_;
+  mutable std::mutex queue_mtx_;
 };
 
 }  // namespace detail
 
-class simple_task_system {
+// Pool of worker threads sharing a single task queue.
+// Queue may be bounded (see options): external submitters then feel
+// back-pressure according to the overflow policy. Tasks submitted by the
+// workers themselves are never blocked or rejected, since waiting for space
+// on a worker could deadlock the pool. Threads marked by nonblocking_scope
+// (e.g. the timer thread) don't wait for space either.
+// Workers blocking inside blocking_region are compensated: for the time of
+// the block a spare worker is woken up (or spawned), so the number of
+// runnable workers stays at thread_count. Spare workers retire when blocked
+// workers return.
+class simple_task_system final : public blocking_observer {
  public:
   static const std::size_t thread_count;
+  // Upper bound of spare workers running at the same time.
+  static const std::size_t max_spare_count;
+  // Workers are indexed by [0, max_worker_count): regular workers come first,
+  // spare ones follow them.
+  static const std::size_t max_worker_count;
+  // Worker index of threads not belonging to the task system.
+  static constexpr std::size_t no_worker = static_cast<std::size_t>(-1);
   using task_type = void (*)(void*);
 
+  struct options {
+    // Maximal number of queued tasks, zero means unbounded queue.
+    std::size_t capacity = 0;
+    overflow_policy policy = overflow_policy::block;
+  };
+
  public:
-  simple_task_system() {
-    threads_.resize(thread_count);
-    for (auto& t : threads_) {
-      t = std::thread{[&] {
-        task_context task;
-        for (;;) {
-          if (!tasks_queue_.try_pop(&task)) {
-            break;
-          }
-          assert(task.func != nullptr);
-          task.func(task.args);
-        }
-      }};
-    }
+  simple_task_system() : simple_task_system{options{}} {}
+  explicit simple_task_system(options opts);
+  ~simple_task_system();
+
+  // Queues f(args) for execution. Under drop_oldest policy tasks might be
+  // discarded without execution: drop(args) is called for them then, it is
+  // supposed to release args.
+  void run(task_type f, void* const args, task_type drop = nullptr);
+
+  // Like run(), but never waits for space in the queue and never discards
+  // other tasks: returns false if the queue is full instead.
+  bool try_run(task_type f, void* const args, task_type drop = nullptr);
+
+  // Executes the oldest queued task on the calling thread if there is one.
+  // Returns false if the queue is empty.
+  bool run_pending_task();
+
+  // Number of queued tasks.
+  std::size_t queue_size() const { return tasks_queue_.size(); }
+
+  // Whether queued tasks may be discarded without execution (see
+  // overflow_policy::drop_oldest).
+  bool discards_tasks() const {
+    return policy_ == overflow_policy::drop_oldest;
   }
 
-  ~simple_task_system() {
-    tasks_queue_.done();
-    for (auto& t : threads_) {
-      t.join();
-    }
+  // Whether calling thread is one of the workers of this task system.
+  bool running_in_this_thread() const { return current_ == this; }
+
+  // Index of calling worker or no_worker if calling thread is not one of the
+  // workers of this task system.
+  std::size_t current_worker_index() const {
+    return running_in_this_thread() ? current_index_ : no_worker;
   }
 
-  void run(task_type f, void* const args) {
-    tasks_queue_.push(task_context{f, args});
+  // Number of spare workers running at the moment.
+  std::size_t active_spare_count() const {
+    std::unique_lock guard{spares_mtx_};
+    return active_spares_;
   }
 
+ private:
+  void on_blocking_start() override;
+  void on_blocking_finish() override;
+
  private:
   struct task_context {
     task_type func = nullptr;
     void* args = nullptr;
+    task_type drop = nullptr;
   };
 
+  void worker_loop(std::size_t index);
+  void spare_loop(std::size_t index);
+  // Parks spare worker if it isn't needed anymore. Returns false if worker
+  // should exit.
+  bool park_if_redundant();
+
  private:
+  // Task system owning the calling worker thread.
+  static thread_local const simple_task_system* current_;
+  // Index of the calling worker inside current_.
+  static thread_local std::size_t current_index_;
+
+  const overflow_policy policy_;
   std::vector<std::thread> threads_;
   detail::notification_queue<task_context> tasks_queue_;
+
+  mutable std::mutex spares_mtx_;
+  std::condition_variable spares_cv_;
+  std::vector<std::thread> spares_;
+  // Number of workers inside blocking regions.
+  std::size_t blocked_ = 0;
+  // Number of spare workers executing tasks.
+  std::size_t active_spares_ = 0;
+  // Number of parked spare workers not yet asked to wake up.
+  std::size_t parked_spares_ = 0;
+  // Number of parked spare workers asked to wake up.
+  std::size_t wakeups_ = 0;
+  bool stopping_ = false;
 };
 
 }  // namespace base
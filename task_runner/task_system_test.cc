@@ -1,6 +1,11 @@
 #include "task_system.h"
 
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <iostream>
+#include <mutex>
+#include <thread>
 
 #include "catch2/catch_all.hpp"
 #include "event.h"
@@ -23,3 +28,187 @@ TEST_CASE("simple_test", "[simple_task_system]") {
   event.wait();
   REQUIRE(global_done);
 }
+
+TEST_CASE("blocking_region_test", "[simple_task_system]") {
+  base::simple_task_system pool;
+  const std::size_t n = base::simple_task_system::thread_count;
+
+  // Every worker blocks until all of the tasks have started. Without spare
+  // workers the last task would never start.
+  struct context {
+    std::mutex mtx;
+    std::condition_variable cv;
+    std::size_t started = 0;
+    std::size_t total = 0;
+    base::manual_event done;
+    std::size_t finished = 0;
+  } ctx;
+  ctx.total = n + 1;
+
+  auto task = [](void* arg) {
+    auto* ctx = static_cast<context*>(arg);
+    {
+      std::unique_lock guard{ctx->mtx};
+      ++ctx->started;
+      ctx->cv.notify_all();
+      base::blocking_region blocking;
+      while (ctx->started < ctx->total) {
+        ctx->cv.wait(guard);
+      }
+      if (++ctx->finished < ctx->total) {
+        return;
+      }
+    }
+    ctx->done.notify();
+  };
+
+  for (std::size_t i = 0; i < ctx.total; ++i) {
+    pool.run(task, &ctx);
+  }
+  ctx.done.wait();
+  REQUIRE(ctx.finished == ctx.total);
+}
+
+TEST_CASE("blocking_region_outside_of_pool_test", "[simple_task_system]") {
+  base::simple_task_system pool;
+  {
+    // Does nothing on threads not belonging to any task system.
+    base::blocking_region blocking;
+    REQUIRE(pool.active_spare_count() == 0);
+  }
+  REQUIRE(pool.active_spare_count() == 0);
+}
+
+namespace {
+
+// Occupies every worker of the pool until release() is called.
+// Must outlive the pool.
+class pool_blocker {
+ public:
+  void block(base::simple_task_system* const pool) {
+    for (std::size_t i = 0; i < base::simple_task_system::thread_count; ++i) {
+      pool->run(wait_task, this);
+    }
+    std::unique_lock guard{mtx_};
+    while (started_ < base::simple_task_system::thread_count) {
+      cv_.wait(guard);
+    }
+  }
+
+  void release() { released_.notify(); }
+
+ private:
+  static void wait_task(void* arg) {
+    auto* self = static_cast<pool_blocker*>(arg);
+    {
+      std::unique_lock guard{self->mtx_};
+      ++self->started_;
+      self->cv_.notify_all();
+    }
+    self->released_.wait();
+  }
+
+  std::mutex mtx_;
+  std::condition_variable cv_;
+  std::size_t started_ = 0;
+  base::manual_event released_;
+};
+
+struct counters {
+  std::atomic<int> executed = 0;
+  std::atomic<int> dropped = 0;
+};
+
+void count_executed(void* arg) { ++static_cast<counters*>(arg)->executed; }
+
+void count_dropped(void* arg) { ++static_cast<counters*>(arg)->dropped; }
+
+}  // namespace
+
+TEST_CASE("bounded_queue_test", "[simple_task_system]") {
+  constexpr std::size_t capacity = 2;
+  counters cnt;
+
+  SECTION("try_run fails on full queue") {
+    pool_blocker blocker;
+    base::simple_task_system pool{{capacity, base::overflow_policy::block}};
+    blocker.block(&pool);
+    REQUIRE(pool.try_run(count_executed, &cnt));
+    REQUIRE(pool.try_run(count_executed, &cnt));
+    REQUIRE_FALSE(pool.try_run(count_executed, &cnt));
+    REQUIRE(pool.queue_size() == capacity);
+    blocker.release();
+  }
+
+  SECTION("Oldest tasks are dropped") {
+    pool_blocker blocker;
+    base::simple_task_system pool{
+        {capacity, base::overflow_policy::drop_oldest}};
+    blocker.block(&pool);
+    for (int i = 0; i < 5; ++i) {
+      pool.run(count_executed, &cnt, count_dropped);
+    }
+    REQUIRE(cnt.dropped == 3);
+    REQUIRE(pool.queue_size() == capacity);
+    blocker.release();
+  }
+
+  SECTION("Submitter waits for space") {
+    {
+      pool_blocker blocker;
+      base::simple_task_system pool{{capacity, base::overflow_policy::block}};
+      blocker.block(&pool);
+      std::atomic<bool> overflowing = false;
+      std::atomic<bool> submitted = false;
+      std::thread submitter{[&] {
+        for (std::size_t i = 0; i < capacity; ++i) {
+          pool.run(count_executed, &cnt);
+        }
+        overflowing = true;
+        for (int i = 0; i < 3; ++i) {
+          pool.run(count_executed, &cnt);
+        }
+        submitted = true;
+      }};
+      while (!overflowing || pool.queue_size() < capacity) {
+        std::this_thread::yield();
+      }
+      // Give the submitter time to park.
+      std::this_thread::sleep_for(std::chrono::milliseconds{10});
+      REQUIRE_FALSE(submitted);
+      REQUIRE(pool.queue_size() == capacity);
+      blocker.release();
+      submitter.join();
+    }
+    REQUIRE(cnt.executed == capacity + 3);
+  }
+
+  SECTION("Nonblocking threads don't wait for space") {
+    pool_blocker blocker;
+    base::simple_task_system pool{{capacity, base::overflow_policy::block}};
+    blocker.block(&pool);
+    std::thread submitter{[&] {
+      base::nonblocking_scope nonblocking;
+      for (std::size_t i = 0; i < capacity + 3; ++i) {
+        pool.run(count_executed, &cnt);
+      }
+    }};
+    submitter.join();
+    REQUIRE(pool.queue_size() == capacity + 3);
+    blocker.release();
+  }
+}
+
+TEST_CASE("run_pending_task_test", "[simple_task_system]") {
+  counters cnt;
+  pool_blocker blocker;
+  base::simple_task_system pool;
+  blocker.block(&pool);
+  pool.run(count_executed, &cnt);
+  pool.run(count_executed, &cnt);
+  REQUIRE(pool.run_pending_task());
+  REQUIRE(pool.run_pending_task());
+  REQUIRE_FALSE(pool.run_pending_task());
+  REQUIRE(cnt.executed == 2);
+  blocker.release();
+}
@@ -0,0 +1,44 @@
+#ifndef _TENANT_H_
+#define _TENANT_H_
+
+#include <cstdint>
+
+namespace base {
+
+// Tag of the party (customer, request class) work is done for. Task systems
+// scheduling tenants fairly (see fair_task_system) queue every task under the
+// tenant of its submitter, and run it as that tenant, so all tasks of an
+// execution share the tenant of the thread that has started it.
+using tenant_id = std::uint64_t;
+
+inline constexpr tenant_id default_tenant = 0;
+
+namespace detail {
+
+inline thread_local tenant_id current_tenant = default_tenant;
+
+}  // namespace detail
+
+// Tenant the calling thread works for.
+inline tenant_id current_tenant() { return detail::current_tenant; }
+
+// Makes the calling thread work for tenant while alive.
+class scoped_tenant {
+ public:
+  explicit scoped_tenant(const tenant_id tenant)
+      : previous_{detail::current_tenant} {
+    detail::current_tenant = tenant;
+  }
+
+  ~scoped_tenant() { detail::current_tenant = previous_; }
+
+  scoped_tenant(const scoped_tenant&) = delete;
+  scoped_tenant& operator=(const scoped_tenant&) = delete;
+
+ private:
+  const tenant_id previous_;
+};
+
+}  // namespace base
+
+#endif  // _TENANT_H_
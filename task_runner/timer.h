@@ -0,0 +1,139 @@
+#ifndef _TIMER_H_
+#define _TIMER_H_
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+
+#include "blocking.h"
+#include "tenant.h"
+#include "unique_function.h"
+
+namespace base {
+
+// Thread calling functions after specified delays.
+// Functions are called on the timer thread one after another, so they are
+// supposed to be short: usually they just schedule the real work to a task
+// runner. Functions still pending on destruction are dropped.
+// The timer thread never waits for space in bounded task queues (see
+// nonblocking_scope), so full task runners don't delay other timers.
+// Functions run as the tenant of the thread that has posted them.
+class timer_thread {
+ public:
+  using clock = std::chrono::steady_clock;
+
+ public:
+  timer_thread() : thread_{[this] { loop(); }} {}
+
+  ~timer_thread() {
+    {
+      std::unique_lock guard{mtx_};
+      stopping_ = true;
+    }
+    cv_.notify_one();
+    thread_.join();
+  }
+
+  timer_thread(const timer_thread&) = delete;
+  timer_thread& operator=(const timer_thread&) = delete;
+
+  // Identifies a posted function, see cancel().
+  using timer_id = std::uint64_t;
+
+  // Calls f on the timer thread not earlier than delay from now.
+  timer_id post_after(const clock::duration delay,
+                      unique_function<void()> f) {
+    bool earliest = false;
+    timer_id id = 0;
+    {
+      std::unique_lock guard{mtx_};
+      id = ++last_id_;
+      auto it = pending_.emplace(clock::now() + delay,
+                                 entry{id, current_tenant(), std::move(f)});
+      ids_.emplace(id, it);
+      earliest = it == pending_.begin();
+    }
+    if (earliest) {
+      cv_.notify_one();
+    }
+    return id;
+  }
+
+  // Drops the function posted as id unless it has been called already (or is
+  // being called right now). Returns whether the function was dropped.
+  bool cancel(const timer_id id) {
+    unique_function<void()> f;
+    {
+      std::unique_lock guard{mtx_};
+      const auto it = ids_.find(id);
+      if (it == ids_.end()) {
+        return false;
+      }
+      // Destroyed outside of the lock, it may post other functions.
+      f = std::move(it->second->second.f);
+      pending_.erase(it->second);
+      ids_.erase(it);
+    }
+    return true;
+  }
+
+  // Timer shared by everything in the process that needs one occasionally.
+  static timer_thread& shared() {
+    static timer_thread instance;
+    return instance;
+  }
+
+ private:
+  void loop() {
+    nonblocking_scope nonblocking;
+    std::unique_lock guard{mtx_};
+    while (!stopping_) {
+      if (pending_.empty()) {
+        cv_.wait(guard);
+        continue;
+      }
+      const auto when = pending_.begin()->first;
+      if (clock::now() < when) {
+        cv_.wait_until(guard, when);
+        continue;
+      }
+      auto e = std::move(pending_.begin()->second);
+      pending_.erase(pending_.begin());
+      ids_.erase(e.id);
+      guard.unlock();
+      {
+        scoped_tenant tenant{e.tenant};
+        e.f();
+      }
+      guard.lock();
+    }
+  }
+
+ private:
+  // Pending function with the tenant of its poster.
+  struct entry {
+    timer_id id;
+    tenant_id tenant;
+    unique_function<void()> f;
+  };
+
+  std::mutex mtx_;
+  std::condition_variable cv_;
+  // Equal deadlines keep the order of posting.
+  std::multimap<clock::time_point, entry> pending_;
+  std::unordered_map<timer_id,
+                     std::multimap<clock::time_point, entry>::iterator>
+      ids_;
+  timer_id last_id_ = 0;
+  bool stopping_ = false;
+  std::thread thread_;
+};
+
+}  // namespace base
+
+#endif  // _TIMER_H_
@@ -0,0 +1,65 @@
+#ifndef _UNIQUE_FUNCTION_H_
+#define _UNIQUE_FUNCTION_H_
+
+#include <cassert>
+#include <functional>
+#include <memory>
+#include <type_traits>
+#include <utility>
+
+namespace base {
+
+template <class Sig>
+class unique_function;
+
+// Move-only analogue of std::function. Unlike std::function it can hold
+// invocables that are not copyable (e.g. continuations owning some state),
+// which is the usual case for callbacks stored until some event happens.
+template <class R, class... Args>
+class unique_function<R(Args...)> {
+ public:
+  unique_function() = default;
+  unique_function(std::nullptr_t) {}
+
+  template <class F,
+            class = std::enable_if_t<
+                !std::is_same_v<std::decay_t<F>, unique_function> &&
+                std::is_invocable_r_v<R, std::decay_t<F>&, Args...>>>
+  unique_function(F&& f)
+      : impl_{std::make_unique<impl<std::decay_t<F>>>(std::forward<F>(f))} {}
+
+  unique_function(unique_function&&) noexcept = default;
+  unique_function& operator=(unique_function&&) noexcept = default;
+
+  R operator()(Args... args) {
+    assert(impl_ != nullptr);
+    return impl_->call(std::forward<Args>(args)...);
+  }
+
+  explicit operator bool() const { return impl_ != nullptr; }
+
+ private:
+  struct impl_base {
+    virtual ~impl_base() = default;
+    virtual R call(Args&&... args) = 0;
+  };
+
+  template <class F>
+  struct impl final : impl_base {
+    template <class U>
+    explicit impl(U&& u) : f{std::forward<U>(u)} {}
+
+    R call(Args&&... args) override {
+      return std::invoke(f, std::forward<Args>(args)...);
+    }
+
+    F f;
+  };
+
+ private:
+  std::unique_ptr<impl_base> impl_;
+};
+
+}  // namespace base
+
+#endif  // _UNIQUE_FUNCTION_H_
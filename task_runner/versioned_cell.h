@@ -0,0 +1,58 @@
+#ifndef _VERSIONED_CELL_H_
+#define _VERSIONED_CELL_H_
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <utility>
+
+namespace base {
+
+// Part of versioned_cell that doesn't depend on the stored type.
+class versioned_cell_base {
+ public:
+  // Version is incremented on every modification of the cell.
+  std::uint64_t version() const {
+    return version_.load(std::memory_order_acquire);
+  }
+
+ protected:
+  void bump_version() { version_.fetch_add(1, std::memory_order_acq_rel); }
+
+ private:
+  std::atomic<std::uint64_t> version_ = 0;
+};
+
+// Thread safe value holder that remembers how many times it was modified.
+// Lets consumers of the value find out whether it has changed since they have
+// seen it last time without comparing values themselves.
+template <class T>
+class versioned_cell : public versioned_cell_base {
+ public:
+  versioned_cell() = default;
+  explicit versioned_cell(T value) : value_{std::move(value)} {}
+
+  versioned_cell(const versioned_cell&) = delete;
+  versioned_cell& operator=(const versioned_cell&) = delete;
+
+  // Returns copy of the current value.
+  T get() const {
+    std::unique_lock guard{mtx_};
+    return value_;
+  }
+
+  // Replaces current value and increments version.
+  void set(T value) {
+    std::unique_lock guard{mtx_};
+    value_ = std::move(value);
+    bump_version();
+  }
+
+ private:
+  mutable std::mutex mtx_;
+  T value_{};
+};
+
+}  // namespace base
+
+#endif  // _VERSIONED_CELL_H_
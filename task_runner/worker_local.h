@@ -0,0 +1,111 @@
+#ifndef _WORKER_LOCAL_H_
+#define _WORKER_LOCAL_H_
+
+#include <cassert>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+
+#include "cache_line.h"
+
+namespace base {
+
+// Separate instance of T for every worker of a task runner, e.g. scratch
+// buffers reused by all tasks running on the same worker without locking.
+// Instances are constructed lazily on the first access from the worker and
+// live in their own cache lines. Threads not belonging to the task runner
+// (e.g. the one calling sync_execute) get instances of their own too, those
+// are looked up under a lock.
+// Task runner must outlive the object.
+template <class T>
+class worker_local {
+ public:
+  template <class TaskRunner>
+  explicit worker_local(const TaskRunner* const tr)
+      : worker_local{tr, [] { return T{}; }} {}
+
+  // make() constructs every instance.
+  template <class TaskRunner, class Make>
+  worker_local(const TaskRunner* const tr, Make make)
+      : tr_{tr},
+        index_{current_index<TaskRunner>},
+        size_{tr->max_worker_count()},
+        slots_{std::make_unique<slot[]>(size_)},
+        make_{std::move(make)} {
+    assert(tr != nullptr);
+  }
+
+  worker_local(const worker_local&) = delete;
+  worker_local& operator=(const worker_local&) = delete;
+
+  // Instance of the calling thread.
+  T& local() {
+    const std::size_t index = index_(tr_);
+    if (index >= size_) {
+      std::unique_lock guard{external_mtx_};
+      const auto id = std::this_thread::get_id();
+      auto it = external_.find(id);
+      if (it == external_.end()) {
+        it = external_.emplace(id, make_()).first;
+      }
+      return it->second;
+    }
+    auto& value = slots_[index].value;
+    if (!value) {
+      value.emplace(make_());
+    }
+    return *value;
+  }
+
+  // Calls f for every constructed instance. Must not run concurrently with
+  // tasks using the object.
+  template <class F>
+  void for_each(F&& f) {
+    for (std::size_t i = 0; i < size_; ++i) {
+      if (auto& value = slots_[i].value) {
+        std::invoke(f, *value);
+      }
+    }
+    std::unique_lock guard{external_mtx_};
+    for (auto& [id, value] : external_) {
+      std::invoke(f, value);
+    }
+  }
+
+  // Folds all constructed instances with op starting from init. Must not run
+  // concurrently with tasks using the object.
+  template <class U, class BinaryOp>
+  U combine(U init, BinaryOp op) {
+    for_each([&init, &op](T& value) {
+      init = std::invoke(op, std::move(init), value);
+    });
+    return init;
+  }
+
+ private:
+  struct alignas(detail::cache_line_size) slot {
+    std::optional<T> value;
+  };
+
+  template <class TaskRunner>
+  static std::size_t current_index(const void* const tr) {
+    return static_cast<const TaskRunner*>(tr)->current_worker_index();
+  }
+
+  const void* const tr_;
+  std::size_t (*const index_)(const void*);
+  const std::size_t size_;
+  std::unique_ptr<slot[]> slots_;
+  std::function<T()> make_;
+  std::mutex external_mtx_;
+  std::unordered_map<std::thread::id, T> external_;
+};
+
+}  // namespace base
+
+#endif  // _WORKER_LOCAL_H_
@@ -0,0 +1,49 @@
+#include "worker_local.h"
+
+#include <atomic>
+#include <vector>
+
+#include "catch2/catch_all.hpp"
+#include "event.h"
+#include "task_runner.h"
+
+TEST_CASE("worker_local_test", "[worker_local]") {
+  base::simple_task_runner tr;
+
+  SECTION("Every task sees instance of its worker") {
+    base::worker_local<std::vector<int>> scratch{&tr};
+    constexpr int total = 1000;
+    std::atomic<int> finished = 0;
+    base::manual_event done;
+    for (int i = 0; i < total; ++i) {
+      tr.run([&, i] {
+        scratch.local().push_back(i);
+        if (++finished == total) {
+          done.notify();
+        }
+      });
+    }
+    done.wait();
+
+    std::size_t count = scratch.combine(
+        std::size_t{0}, [](std::size_t acc, const std::vector<int>& v) {
+          return acc + v.size();
+        });
+    REQUIRE(count == total);
+  }
+
+  SECTION("Instances are constructed lazily") {
+    int made = 0;
+    base::worker_local<int> counter{&tr, [&made] {
+                                      ++made;
+                                      return 10;
+                                    }};
+    REQUIRE(made == 0);
+    // Calling thread doesn't belong to tr, but still has an instance.
+    counter.local() += 5;
+    REQUIRE(counter.local() == 15);
+    REQUIRE(made == 1);
+    REQUIRE(counter.combine(0, [](int acc, int val) { return acc + val; }) ==
+            15);
+  }
+}